@@ -0,0 +1,70 @@
+'use strict';
+
+// binary APDU batches compared with JSON arrays of hex strings
+
+const ApduBatch = require('../lib/index').ApduBatch;
+
+const COUNT = 10000;
+const ROUNDS = 20;
+
+const commands = [];
+const results = [];
+for (let i = 0; i < COUNT; i++) {
+  commands.push(Buffer.from([0x00, 0xb0, i >> 8, i & 0xff, 0xdf]));
+  const response = Buffer.alloc(0xdf + 2, i & 0xff);
+  response.writeUInt16BE(0x9000, response.length - 2);
+  results.push({ response, durationMs: 1.5 });
+}
+
+const time = (label, fn) => {
+  fn();
+  const start = process.hrtime.bigint();
+  let out;
+  for (let i = 0; i < ROUNDS; i++) out = fn();
+  const ms = Number(process.hrtime.bigint() - start) / 1e6 / ROUNDS;
+  console.log(`${label.padEnd(28)} ${ms.toFixed(2).padStart(8)} ms`);
+  return out;
+};
+
+const binaryCommands = time('binary encode commands', () =>
+  ApduBatch.encodeCommands(commands)
+);
+time('binary decode commands', () =>
+  ApduBatch.decodeCommands(binaryCommands)
+);
+const jsonCommands = time('json encode commands', () =>
+  JSON.stringify(commands.map((c) => c.toString('hex')))
+);
+time('json decode commands', () =>
+  JSON.parse(jsonCommands).map((c) => Buffer.from(c, 'hex'))
+);
+
+const binaryResults = time('binary encode results', () =>
+  ApduBatch.encodeResults(results)
+);
+time('binary decode + scan SWs', () => {
+  const decoded = ApduBatch.decodeResults(binaryResults);
+  return decoded.firstFailure();
+});
+const jsonResults = time('json encode results', () =>
+  JSON.stringify(
+    results.map((r) => ({
+      response: r.response.toString('hex'),
+      durationMs: r.durationMs,
+    }))
+  )
+);
+time('json decode + scan SWs', () =>
+  JSON.parse(jsonResults)
+    .map((r) => Buffer.from(r.response, 'hex'))
+    .findIndex((r) => r.readUInt16BE(r.length - 2) !== 0x9000)
+);
+
+console.log(
+  `commands: ${binaryCommands.length} bytes binary, ` +
+    `${Buffer.byteLength(jsonCommands)} bytes json`
+);
+console.log(
+  `results: ${binaryResults.length} bytes binary, ` +
+    `${Buffer.byteLength(jsonResults)} bytes json`
+);
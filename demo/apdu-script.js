@@ -0,0 +1,41 @@
+'use strict';
+
+// the PSE and application selection of smartcard-demo.js as a script
+
+const api = require('../lib/index');
+const Devices = api.Devices;
+const ApduScript = api.ApduScript;
+
+const plan = ApduScript.compile([
+  {
+    name: 'pse',
+    apdu: '00A404000E315041592E5359532E444446303100',
+    capture: { sfi: { tag: 0x88 } },
+  },
+  {
+    name: 'records',
+    repeat: [{ apdu: '00B2{record}{p2}00', expect: ['9000', '6A83'] }],
+    counter: { var: 'record', from: 1 },
+    until: { sw: '6A83' },
+  },
+  { apdu: '00A4040007A000000004101000' },
+  { apdu: '80A8000002830000' },
+]);
+
+const devices = new Devices();
+devices.on('device-activated', (event) => {
+  event.device.on('card-inserted', (event) => {
+    plan
+      .run(event.card, { p2: 0x0c })
+      .then((result) => {
+        result.steps.forEach((step) => {
+          console.log(
+            `${step.command.toString('hex')} -> ${step.sw.toString(16)} ` +
+              `${step.durationMs.toFixed(1)} ms`
+          );
+        });
+        console.log(`ok: ${result.ok}, ${result.durationMs.toFixed(1)} ms`);
+      })
+      .catch((error) => console.error(error));
+  });
+});
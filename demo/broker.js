@@ -0,0 +1,32 @@
+'use strict';
+
+// node demo/broker.js           owns the readers and serves them
+// node demo/broker.js client    uses them from another process
+
+const api = require('../lib/index');
+
+if (process.argv[2] === 'client') {
+  const devices = new api.RemoteDevices();
+  devices.on('device-activated', (event) => {
+    const device = event.device;
+    console.log(`Device '${device}' activated`);
+    device.on('card-inserted', (event) => {
+      const card = event.card;
+      console.log(`Card '${card.getAtr()}' inserted into '${device}'`);
+      card
+        .issueCommand('00A404000E315041592E5359532E444446303100')
+        .then((response) => {
+          console.log(`Response '${response.toString('hex')}'`);
+        })
+        .catch((error) => console.error(error));
+    });
+  });
+  devices.on('error', (event) => console.error(event.error));
+} else {
+  const broker = new api.Broker();
+  broker.listen().then(() => console.log(`Broker on ${broker.path}`));
+  broker.on('client-connected', (event) =>
+    console.log(`Client ${event.id} connected`)
+  );
+  setInterval(() => console.log(broker.getStats()), 10000);
+}
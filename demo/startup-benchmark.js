@@ -0,0 +1,38 @@
+'use strict';
+
+// time to require the package, and to first use, in fresh processes
+
+const { execFileSync } = require('child_process');
+const path = require('path');
+
+const RUNS = 15;
+const lib = path.join(__dirname, '..', 'lib', 'index');
+
+const probe = `
+const t0 = process.hrtime.bigint();
+const api = require(${JSON.stringify(lib)});
+const t1 = process.hrtime.bigint();
+const devices = new api.Devices();
+const t2 = process.hrtime.bigint();
+const Card = api.Card;
+const t3 = process.hrtime.bigint();
+console.log(JSON.stringify({
+  require: Number(t1 - t0) / 1e6,
+  construct: Number(t2 - t1) / 1e6,
+  firstAccess: Number(t3 - t2) / 1e6,
+  started: devices.pcsc !== null,
+}));
+`;
+
+const median = (values) => values.sort((a, b) => a - b)[values.length >> 1];
+
+const samples = [];
+for (let i = 0; i < RUNS; i++) {
+  samples.push(JSON.parse(execFileSync(process.execPath, ['-e', probe])));
+}
+
+['require', 'construct', 'firstAccess'].forEach((key) => {
+  const ms = median(samples.map((sample) => sample[key]));
+  console.log(`${key.padEnd(12)} ${ms.toFixed(2).padStart(8)} ms`);
+});
+console.log(`PC/SC context started: ${samples[0].started}`);
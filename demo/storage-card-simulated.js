@@ -0,0 +1,25 @@
+'use strict';
+
+const api = require('../lib/index');
+const Card = api.Card;
+const StorageCard = api.StorageCard;
+const StorageCardSimulator = api.StorageCardSimulator;
+
+const simulator = new StorageCardSimulator({
+  blockCount: 64,
+  maxBlocksPerRead: 2,
+  latencyMs: 2,
+});
+const card = new Card(simulator, simulator.atr, 2);
+const storageCard = new StorageCard(card);
+
+storageCard
+  .writeBlocks(4, Buffer.alloc(48, 0x42))
+  .then(() => storageCard.readBlocks(0, 64))
+  .then((data) => {
+    console.log(`Read ${data.length} bytes`);
+    console.log(storageCard.getStats());
+  })
+  .catch((error) => {
+    console.error('Error:', error, error.stack);
+  });
@@ -0,0 +1,67 @@
+'use strict';
+
+// per command cost of await card.issueCommand() on the main thread against
+// SyncCard.transmitSync() in a worker, on a simulated card
+
+const { Worker, isMainThread, workerData } = require('worker_threads');
+const {
+  Card,
+  StorageCardSimulator,
+  SyncTransmit,
+  SyncCard,
+} = require('../lib/index');
+
+const COUNT = 2000;
+const read = Buffer.from([0xff, 0xb0, 0x00, 0x04, 0x10]);
+
+if (!isMainThread) {
+  const card = new SyncCard(workerData.channel);
+  const start = process.hrtime.bigint();
+  for (let i = 0; i < COUNT; i++) {
+    if (!card.transmitSync(read).isOk()) throw new Error('read failed');
+  }
+  const ms = Number(process.hrtime.bigint() - start) / 1e6;
+  require('worker_threads').parentPort.postMessage(ms);
+  return;
+}
+
+const report = (label, ms) =>
+  console.log(
+    `${label.padEnd(32)} ${((ms * 1000) / COUNT).toFixed(1).padStart(8)} us`
+  );
+
+const simulator = new StorageCardSimulator({ mifareClassic: false });
+// no timer between command and response, only the code paths are measured
+simulator.transmit = (data, resLen, protocol, cb) =>
+  setImmediate(() => cb(null, simulator.handle(Buffer.from(data))));
+const card = new Card(simulator, simulator.atr, 2);
+
+const runAsync = async () => {
+  const start = process.hrtime.bigint();
+  for (let i = 0; i < COUNT; i++) {
+    await card.issueCommand(read);
+  }
+  return Number(process.hrtime.bigint() - start) / 1e6;
+};
+
+const runSync = () =>
+  new Promise((resolve, reject) => {
+    const host = new SyncTransmit(card);
+    const channel = host.channel();
+    const worker = new Worker(__filename, {
+      workerData: { channel },
+      transferList: [channel.port],
+    });
+    worker.on('message', (ms) => {
+      host.close();
+      resolve(ms);
+    });
+    worker.on('error', reject);
+  });
+
+runAsync()
+  .then((ms) => {
+    report('async issueCommand, main thread', ms);
+    return runSync();
+  })
+  .then((ms) => report('transmitSync, worker', ms));
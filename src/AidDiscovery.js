@@ -0,0 +1,244 @@
+'use strict';
+
+import Stopwatch from './Stopwatch';
+import Tlv from './Tlv';
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('AidDiscovery');
+
+const PSE = Buffer.from('1PAY.SYS.DDF01');
+const PPSE = Buffer.from('2PAY.SYS.DDF01');
+// short file identifier of EF.DIR
+const EF_DIR = 0x1e;
+
+const select = (aid, next) =>
+  Buffer.concat([
+    Buffer.from([0x00, 0xa4, 0x04, next ? 0x02 : 0x00, aid.length]),
+    aid,
+    Buffer.from([0x00]),
+  ]);
+
+const readRecord = (sfi, record) =>
+  Buffer.from([0x00, 0xb2, record, (sfi << 3) | 4, 0x00]);
+
+const statusOf = (response) => response.readUInt16BE(response.length - 2);
+const dataOf = (response) => response.subarray(0, response.length - 2);
+
+// directory entries, template 61 with 4F AID, 50 label, 87 priority
+const entries = (nodes, source) =>
+  Tlv.findAll(nodes, 0x61)
+    .filter((entry) => entry.find(0x4f))
+    .map((entry) => {
+      const label = entry.find(0x50);
+      const priority = entry.find(0x87);
+      return {
+        aid: entry.find(0x4f).value.toString('hex'),
+        label: label ? label.value.toString() : null,
+        priority: priority ? priority.value[0] & 0x0f : null,
+        source,
+      };
+    });
+
+// a selected candidate, the FCI has the full AID and maybe a label
+const describe = (candidate, response) => {
+  const fci = Tlv.parse(dataOf(response));
+  const name = Tlv.find(fci, 0x84);
+  const label = Tlv.find(fci, 0x50);
+  return {
+    aid: name ? name.value.toString('hex') : candidate.aid,
+    label: label ? label.value.toString() : candidate.name || null,
+    priority: null,
+    source: 'select',
+  };
+};
+
+// the warm-up profile, else the ATR
+const profileOf = (card) =>
+  card.warmUp && card.warmUp.profile ? card.warmUp.profile : card.getAtr();
+
+/*
+Finds the applications on a card. Directories come first: the PPSE, the
+PSE and EF.DIR. Only when none lists anything are the candidate AIDs
+selected, all in one batch. A candidate marked `partial` is a prefix; it
+is followed with SELECT next occurrence to find every matching AID.
+Results are cached per ATR profile.
+
+  new AidDiscovery({
+    candidates: [{ name: 'visa', aid: 'a000000003', partial: true }],
+    stop: 'first',
+  })
+*/
+class AidDiscovery {
+  constructor(options) {
+    const opts = options || {};
+    this.candidates = (opts.candidates || []).map((candidate) =>
+      typeof candidate === 'string' ? { aid: candidate } : candidate
+    );
+    this.directories = opts.directories !== false;
+    // 'all', 'first', or (applications) => true to stop
+    this.stop = opts.stop || 'all';
+    this.profileOf = opts.profile || profileOf;
+    this.cacheSize = opts.cacheSize === undefined ? 64 : opts.cacheSize;
+    this.cache = new Map();
+  }
+
+  // resolves with { applications, source, cached, commands, durationMs }
+  discover(card) {
+    const stopwatch = Stopwatch.start();
+    const profile = this.profileOf(card);
+    const hit = this.cache.get(profile);
+    if (hit) {
+      // most recently used last
+      this.cache.delete(profile);
+      this.cache.set(profile, hit);
+      return Promise.resolve(
+        Object.assign({}, hit, {
+          cached: true,
+          commands: 0,
+          durationMs: stopwatch.elapsed(),
+        })
+      );
+    }
+    const run = { card, commands: 0 };
+    const directories = this.directories
+      ? this.fromDirectories(run)
+      : Promise.resolve(null);
+    return directories
+      .then((found) => found || this.fromCandidates(run))
+      .then((found) => {
+        const result = {
+          applications: found.applications,
+          source: found.source,
+        };
+        this.remember(profile, result);
+        logger.debug(
+          `${found.applications.length} applications from ${found.source}`
+        );
+        return Object.assign({}, result, {
+          cached: false,
+          commands: run.commands,
+          durationMs: stopwatch.elapsed(),
+        });
+      });
+  }
+
+  remember(profile, result) {
+    if (!this.cacheSize) {
+      return;
+    }
+    this.cache.set(profile, result);
+    if (this.cache.size > this.cacheSize) {
+      this.cache.delete(this.cache.keys().next().value);
+    }
+  }
+
+  clearCache() {
+    this.cache.clear();
+  }
+
+  transmit(run, command) {
+    run.commands++;
+    return new Promise((resolve, reject) => {
+      run.card.transmit(command, (err, response) =>
+        err ? reject(err) : resolve(response)
+      );
+    });
+  }
+
+  fromDirectories(run) {
+    return this.transmit(run, select(PPSE))
+      .then((response) => {
+        if (statusOf(response) !== 0x9000) return null;
+        const applications = entries(Tlv.parse(dataOf(response)), 'ppse');
+        return applications.length ? { applications, source: 'ppse' } : null;
+      })
+      .then((found) => found || this.fromPse(run))
+      .then((found) => found || this.fromRecords(run, EF_DIR, 'ef.dir'));
+  }
+
+  fromPse(run) {
+    return this.transmit(run, select(PSE)).then((response) => {
+      if (statusOf(response) !== 0x9000) return null;
+      const sfi = Tlv.find(Tlv.parse(dataOf(response)), 0x88);
+      return sfi ? this.fromRecords(run, sfi.value[0], 'pse') : null;
+    });
+  }
+
+  // reads records until the file ends
+  fromRecords(run, sfi, source) {
+    const applications = [];
+    const next = (record) =>
+      this.transmit(run, readRecord(sfi, record)).then((response) => {
+        if (statusOf(response) !== 0x9000) {
+          return applications.length ? { applications, source } : null;
+        }
+        applications.push(...entries(Tlv.parse(dataOf(response)), source));
+        return record < 0xfe ? next(record + 1) : { applications, source };
+      });
+    return next(1);
+  }
+
+  stopAfter(applications) {
+    if (this.stop === 'first') return applications.length > 0;
+    if (typeof this.stop === 'function') return this.stop(applications);
+    return false;
+  }
+
+  fromCandidates(run) {
+    const applications = [];
+    const commands = this.candidates.map((candidate) =>
+      select(Buffer.from(candidate.aid, 'hex'))
+    );
+    run.commands += commands.length;
+    const check = (i, response) => {
+      if (statusOf(response) === 0x9000) {
+        applications.push(describe(this.candidates[i], response));
+        if (this.stopAfter(applications)) return false;
+      }
+      return true;
+    };
+    return run.card
+      .issueBatch(commands, check)
+      .then((results) => {
+        // batch stopped early, the rest was never sent
+        run.commands -= commands.length - results.length;
+        const partial = this.candidates.filter(
+          (candidate, i) =>
+            candidate.partial &&
+            i < results.length &&
+            statusOf(results[i].response) === 0x9000
+        );
+        return partial.reduce(
+          (chain, candidate) =>
+            chain.then(() =>
+              this.nextOccurrences(run, candidate, applications)
+            ),
+          Promise.resolve()
+        );
+      })
+      .then(() => ({ applications, source: 'select' }));
+  }
+
+  // SELECT next occurrence of the same prefix until the card says no more
+  // or returns an AID already found. Next is relative to the current
+  // selection, which after the batch is another candidate: the prefix is
+  // selected again first.
+  nextOccurrences(run, candidate, applications) {
+    const prefix = Buffer.from(candidate.aid, 'hex');
+    const next = () => {
+      if (this.stopAfter(applications)) return null;
+      return this.transmit(run, select(prefix, true)).then((response) => {
+        if (statusOf(response) !== 0x9000) return null;
+        const application = describe(candidate, response);
+        if (applications.some((a) => a.aid === application.aid)) return null;
+        applications.push(application);
+        return next();
+      });
+    };
+    if (this.stopAfter(applications)) return null;
+    return this.transmit(run, select(prefix)).then((response) =>
+      statusOf(response) === 0x9000 ? next() : null
+    );
+  }
+}
+
+module.exports = AidDiscovery;
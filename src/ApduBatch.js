@@ -0,0 +1,220 @@
+'use strict';
+
+import hexify from 'hexify';
+import CommandApdu from './CommandApdu';
+import ResponseApdu from './ResponseApdu';
+import Stopwatch from './Stopwatch';
+
+/*
+Binary form of APDU sequences and their results, for IPC and captures.
+
+commands: u8 version | u8 kind 1 | u32 count | count x (u32 length, bytes)
+results:  u8 version | u8 kind 2 | u32 count
+          | (count + 1) x u32 offsets into the blob
+          | count x u16 status words
+          | count x f32 durations in ms
+          | blob of responses, each with its status word
+
+All numbers are big endian. Decoding returns views over the encoded buffer,
+after checking every length and offset against it.
+*/
+
+const VERSION = 1;
+const COMMANDS = 1;
+const RESULTS = 2;
+const HEADER = 6;
+
+const toBuffer = (command) => {
+  if (Buffer.isBuffer(command)) return command;
+  if (Array.isArray(command)) return Buffer.from(command);
+  if (typeof command === 'string') {
+    return Buffer.from(hexify.toByteArray(command));
+  }
+  return command.toBuffer();
+};
+
+const checkHeader = (buffer, kind) => {
+  if (buffer.length < HEADER || buffer[0] !== VERSION || buffer[1] !== kind) {
+    throw new Error(`not an APDU batch of kind ${kind}`);
+  }
+  return buffer.readUInt32BE(2);
+};
+
+const malformed = (reason) => new Error(`malformed APDU batch, ${reason}`);
+
+// an extended command with an Le, case 2E or 4E; only then is the receive
+// length in its last two bytes
+const hasExtendedLe = (bytes) => {
+  if (bytes.length < 7 || bytes[4] !== 0x00) return false;
+  return bytes.length === 7 || bytes.length === 9 + bytes.readUInt16BE(5);
+};
+
+// decoded results, read on demand from the encoded buffer
+class ApduResults {
+  constructor(buffer) {
+    this.buffer = buffer;
+    this.length = checkHeader(buffer, RESULTS);
+    this.offsetsAt = HEADER;
+    this.statusWordsAt = this.offsetsAt + (this.length + 1) * 4;
+    this.durationsAt = this.statusWordsAt + this.length * 2;
+    this.blobAt = this.durationsAt + this.length * 4;
+    if (this.blobAt > buffer.length) {
+      throw malformed(`${this.length} results in ${buffer.length} bytes`);
+    }
+    let previous = 0;
+    for (let i = 0; i <= this.length; i++) {
+      const offset = buffer.readUInt32BE(this.offsetsAt + i * 4);
+      if (offset < previous || this.blobAt + offset > buffer.length) {
+        throw malformed(`offset ${offset} of result ${i}`);
+      }
+      previous = offset;
+    }
+    if (this.blobAt + previous !== buffer.length) {
+      throw malformed(`${buffer.length - this.blobAt - previous} bytes left`);
+    }
+  }
+
+  response(i) {
+    if (!(i >= 0 && i < this.length)) {
+      throw new Error(`no result ${i} of ${this.length}`);
+    }
+    const start = this.buffer.readUInt32BE(this.offsetsAt + i * 4);
+    const end = this.buffer.readUInt32BE(this.offsetsAt + (i + 1) * 4);
+    return this.buffer.subarray(this.blobAt + start, this.blobAt + end);
+  }
+
+  data(i) {
+    const response = this.response(i);
+    return response.subarray(0, response.length - 2);
+  }
+
+  statusWord(i) {
+    return this.buffer.readUInt16BE(this.statusWordsAt + i * 2);
+  }
+
+  durationMs(i) {
+    return this.buffer.readFloatBE(this.durationsAt + i * 4);
+  }
+
+  responseApdu(i) {
+    return new ResponseApdu(this.response(i));
+  }
+
+  // index of the first response whose status word is not expected
+  firstFailure(isOk) {
+    const ok = isOk || ((sw) => sw === 0x9000);
+    for (let i = 0; i < this.length; i++) {
+      if (!ok(this.statusWord(i))) return i;
+    }
+    return -1;
+  }
+
+  toArray() {
+    const results = [];
+    for (let i = 0; i < this.length; i++) {
+      results.push({
+        response: this.response(i),
+        sw: this.statusWord(i),
+        durationMs: this.durationMs(i),
+      });
+    }
+    return results;
+  }
+}
+
+class ApduBatch {
+  static encodeCommands(commands) {
+    const buffers = commands.map(toBuffer);
+    const size = buffers.reduce((sum, b) => sum + 4 + b.length, HEADER);
+    const out = Buffer.allocUnsafe(size);
+    out[0] = VERSION;
+    out[1] = COMMANDS;
+    out.writeUInt32BE(buffers.length, 2);
+    let offset = HEADER;
+    buffers.forEach((b) => {
+      out.writeUInt32BE(b.length, offset);
+      b.copy(out, offset + 4);
+      offset += 4 + b.length;
+    });
+    return out;
+  }
+
+  // CommandApdus over views of the buffer
+  static decodeCommands(buffer) {
+    const count = checkHeader(buffer, COMMANDS);
+    if (count * 4 > buffer.length - HEADER) {
+      throw malformed(`${count} commands in ${buffer.length} bytes`);
+    }
+    const commands = new Array(count);
+    let offset = HEADER;
+    for (let i = 0; i < count; i++) {
+      if (offset + 4 > buffer.length) {
+        throw malformed(`command ${i} past the end`);
+      }
+      const length = buffer.readUInt32BE(offset);
+      if (length < 4 || offset + 4 + length > buffer.length) {
+        throw malformed(`length ${length} of command ${i}`);
+      }
+      const bytes = buffer.subarray(offset + 4, offset + 4 + length);
+      commands[i] = new CommandApdu({ bytes, extended: hasExtendedLe(bytes) });
+      offset += 4 + length;
+    }
+    if (offset !== buffer.length) {
+      throw malformed(`${buffer.length - offset} bytes left`);
+    }
+    return commands;
+  }
+
+  // results: Array of { response, durationMs }, response with status word
+  static encodeResults(results) {
+    const count = results.length;
+    const blob = results.reduce((sum, r) => sum + r.response.length, 0);
+    const statusWordsAt = HEADER + (count + 1) * 4;
+    const durationsAt = statusWordsAt + count * 2;
+    const blobAt = durationsAt + count * 4;
+    const out = Buffer.allocUnsafe(blobAt + blob);
+    out[0] = VERSION;
+    out[1] = RESULTS;
+    out.writeUInt32BE(count, 2);
+    let position = 0;
+    results.forEach((result, i) => {
+      const response = result.response;
+      out.writeUInt32BE(position, HEADER + i * 4);
+      out.writeUInt16BE(
+        response.length >= 2 ? response.readUInt16BE(response.length - 2) : 0,
+        statusWordsAt + i * 2
+      );
+      out.writeFloatBE(result.durationMs || 0, durationsAt + i * 4);
+      response.copy(out, blobAt + position);
+      position += response.length;
+    });
+    out.writeUInt32BE(position, HEADER + count * 4);
+    return out;
+  }
+
+  static decodeResults(buffer) {
+    return new ApduResults(buffer);
+  }
+
+  // issues an encoded command sequence and returns its encoded results
+  static transmit(card, buffer) {
+    const commands = ApduBatch.decodeCommands(buffer);
+    const results = [];
+    return commands
+      .reduce(
+        (previous, command) =>
+          previous.then(() => {
+            const stopwatch = Stopwatch.start();
+            return card.issueCommand(command).then((response) => {
+              results.push({ response, durationMs: stopwatch.elapsed() });
+            });
+          }),
+        Promise.resolve()
+      )
+      .then(() => ApduBatch.encodeResults(results));
+  }
+}
+
+ApduBatch.ApduResults = ApduResults;
+
+module.exports = ApduBatch;
@@ -0,0 +1,374 @@
+'use strict';
+
+import Stopwatch from './Stopwatch';
+import Tlv from './Tlv';
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('ApduScript');
+
+/*
+Declarative APDU scripts, compiled once into a plan of instructions.
+
+A script is an Array of steps (or { steps }):
+
+  { name, apdu: '00B2{record}0C00', expect: '9000' | ['9000', '62xx'],
+    capture: 'fci' | { fci: { tag: 0x6f } | { offset: 0, length: 8 } } }
+  { if: { sw: '6A82' } | { var: 'x', equals: '01' } | { var: 'x' },
+    goto: 'name' | 'end' }
+  { loop: { var: 'record', from: 1, to: 10 }, steps: [...] }
+  { repeat: [...], until: { sw: '6A83' }, counter: { var: 'record',
+    from: 1 }, max: 255 }
+
+{var} in an APDU is replaced by the hex of the variable. expect defaults
+to 9000 and takes x as a wildcard nibble, null accepts any status word. A
+counted loop is unrolled; repeat and if are the only data dependent steps.
+*/
+
+const parseMask = (mask) => {
+  const text = mask.replace(/\s/g, '');
+  if (!/^[0-9a-fx]{4}$/i.test(text)) {
+    throw new Error(`bad status word mask '${mask}'`);
+  }
+  let value = 0;
+  let bits = 0;
+  for (let i = 0; i < 4; i++) {
+    const c = text[i].toLowerCase();
+    value <<= 4;
+    bits <<= 4;
+    if (c !== 'x') {
+      value |= parseInt(c, 16);
+      bits |= 0xf;
+    }
+  }
+  return { value, bits };
+};
+
+const matches = (masks, sw) =>
+  masks.some((mask) => (sw & mask.bits) === mask.value);
+
+const toHex = (value) => {
+  if (Buffer.isBuffer(value)) return value.toString('hex');
+  if (typeof value === 'number') {
+    const hex = value.toString(16);
+    return hex.length % 2 ? '0' + hex : hex;
+  }
+  return String(value);
+};
+
+const parseTemplate = (apdu) => {
+  const parts = apdu.replace(/\s/g, '').split(/\{(\w+)\}/);
+  const segments = parts.map((part, i) => {
+    if (i % 2) return { variable: part };
+    if (!/^([0-9a-f]{2})*$/i.test(part)) {
+      throw new Error(`bad hex in apdu '${apdu}'`);
+    }
+    return { bytes: Buffer.from(part, 'hex') };
+  });
+  const variables = segments.filter((s) => s.variable).map((s) => s.variable);
+  return {
+    source: apdu,
+    variables,
+    bytes: variables.length ? null : segments[0].bytes,
+    segments: segments.filter((s) => s.variable || s.bytes.length),
+  };
+};
+
+const render = (template, variables) => {
+  if (template.bytes) {
+    return template.bytes;
+  }
+  return Buffer.concat(
+    template.segments.map((segment) => {
+      if (segment.bytes) return segment.bytes;
+      const value = variables[segment.variable];
+      if (value === undefined) {
+        throw new Error(`variable '${segment.variable}' is not set`);
+      }
+      return Buffer.from(toHex(value), 'hex');
+    })
+  );
+};
+
+const parseCapture = (capture) => {
+  if (!capture) return [];
+  if (typeof capture === 'string') return [{ name: capture }];
+  return Object.keys(capture).map((name) =>
+    Object.assign({ name }, capture[name])
+  );
+};
+
+const parseCondition = (condition) => {
+  if (condition.sw !== undefined) {
+    const masks = [].concat(condition.sw).map(parseMask);
+    return (state) => matches(masks, state.sw);
+  }
+  const equals =
+    condition.equals === undefined
+      ? null
+      : Buffer.from(toHex(condition.equals), 'hex');
+  return (state) => {
+    const value = state.variables[condition.var];
+    if (value === undefined) return false;
+    if (!equals) return true;
+    return Buffer.from(toHex(value), 'hex').equals(equals);
+  };
+};
+
+const substitute = (template, name, value) =>
+  template.split(`{${name}}`).join(toHex(value));
+
+// an unrolled body is compiled once per counter value, its names, nested
+// ones included, would label every copy
+const unnamed = (steps) =>
+  steps.map((step) => {
+    const copy = Object.assign({}, step, { name: undefined });
+    if (step.steps) copy.steps = unnamed(step.steps);
+    if (step.repeat) copy.repeat = unnamed(step.repeat);
+    return copy;
+  });
+
+const compileSteps = (steps, instructions, labels) => {
+  steps.forEach((step) => {
+    if (step.name) {
+      labels[step.name] = instructions.length;
+    }
+    if (step.apdu) {
+      const expect = step.expect === undefined ? '9000' : step.expect;
+      instructions.push({
+        op: 'command',
+        name: step.name,
+        template: parseTemplate(step.apdu),
+        expect: expect === null ? null : [].concat(expect).map(parseMask),
+        capture: parseCapture(step.capture),
+      });
+    } else if (step.if) {
+      instructions.push({
+        op: 'jump',
+        name: step.name,
+        test: parseCondition(step.if),
+        target: step.goto,
+      });
+    } else if (step.loop) {
+      const loop = step.loop;
+      for (let i = loop.from; i <= loop.to; i += loop.step || 1) {
+        // counters are known up front, the body is unrolled
+        const body = JSON.parse(JSON.stringify(step.steps), (key, value) =>
+          key === 'apdu' ? substitute(value, loop.var, i) : value
+        );
+        compileSteps(unnamed(body), instructions, labels);
+      }
+    } else if (step.repeat) {
+      const counter = step.counter;
+      if (counter) {
+        instructions.push({
+          op: 'set',
+          var: counter.var,
+          value: counter.from === undefined ? 1 : counter.from,
+        });
+      }
+      const start = instructions.length;
+      compileSteps(step.repeat, instructions, labels);
+      if (counter) {
+        instructions.push({ op: 'increment', var: counter.var });
+      }
+      const until = parseCondition(step.until);
+      instructions.push({
+        op: 'jump',
+        name: step.name,
+        test: (state) => !until(state),
+        target: start,
+        max: step.max || 255,
+      });
+    } else {
+      throw new Error(`unknown step ${JSON.stringify(step)}`);
+    }
+  });
+};
+
+const capture = (instruction, response, variables) => {
+  const data = response.subarray(0, response.length - 2);
+  instruction.capture.forEach((spec) => {
+    let value = data;
+    if (spec.tag !== undefined) {
+      const node = Tlv.find(Tlv.parse(data), spec.tag);
+      value = node ? node.value : undefined;
+    } else if (spec.offset !== undefined || spec.length !== undefined) {
+      const offset = spec.offset || 0;
+      value = data.subarray(
+        offset,
+        spec.length === undefined ? data.length : offset + spec.length
+      );
+    }
+    if (value !== undefined) {
+      variables[spec.name] = value;
+    }
+  });
+};
+
+class ApduPlan {
+  constructor(instructions) {
+    this.instructions = instructions;
+    const captured = {};
+    instructions.forEach((instruction) => {
+      if (instruction.op === 'command') {
+        instruction.capture.forEach((spec) => (captured[spec.name] = true));
+      }
+    });
+    // only commands, none built from a response: one batch will do
+    this.batchable = instructions.every(
+      (instruction) =>
+        instruction.op === 'command' &&
+        !instruction.template.variables.some((name) => captured[name])
+    );
+  }
+
+  /*
+  options.from resumes at an instruction index, with options.sw as the
+  last status word; options.onStep(index, variables, sw) is called after
+  each command that met its expectation, with the index to resume at.
+  */
+  run(card, variables, options) {
+    const opts = options || {};
+    const state = {
+      variables: Object.assign({}, variables),
+      sw: opts.sw === undefined ? null : opts.sw,
+      steps: [],
+      onStep: opts.onStep,
+    };
+    const stopwatch = Stopwatch.start();
+    const run =
+      this.batchable && !opts.from
+        ? this.runBatch(card, state)
+        : this.runSteps(card, state, opts.from || 0);
+    return run.then((failure) => ({
+      ok: !failure,
+      failedStep: failure ? failure.failedStep : undefined,
+      exceeded: failure ? failure.exceeded : undefined,
+      batched: this.batchable,
+      steps: state.steps,
+      variables: state.variables,
+      durationMs: stopwatch.elapsed(),
+    }));
+  }
+
+  record(state, instruction, command, response, durationMs) {
+    state.sw = response.readUInt16BE(response.length - 2);
+    state.steps.push({
+      name: instruction.name,
+      command,
+      response,
+      sw: state.sw,
+      durationMs,
+    });
+    const ok = !instruction.expect || matches(instruction.expect, state.sw);
+    if (ok) {
+      capture(instruction, response, state.variables);
+    }
+    return ok;
+  }
+
+  runBatch(card, state) {
+    let commands;
+    try {
+      commands = this.instructions.map((instruction) =>
+        render(instruction.template, state.variables)
+      );
+    } catch (err) {
+      return Promise.reject(err);
+    }
+    let failure;
+    return card
+      .issueBatch(commands, (i, response) => {
+        const instruction = this.instructions[i];
+        const ok = this.record(state, instruction, commands[i], response, 0);
+        if (!ok) failure = { failedStep: state.steps.length - 1 };
+        else if (state.onStep) state.onStep(i + 1, state.variables, state.sw);
+        return ok;
+      })
+      .then((results) => {
+        results.forEach((result, i) => {
+          state.steps[i].durationMs = result.durationMs;
+        });
+        return failure;
+      });
+  }
+
+  runSteps(card, state, from) {
+    const instructions = this.instructions;
+    const counters = {};
+    return new Promise((resolve, reject) => {
+      let pc = from;
+      const next = () => {
+        while (pc < instructions.length && instructions[pc].op !== 'command') {
+          const jump = instructions[pc];
+          if (jump.op === 'set' || jump.op === 'increment') {
+            const value = state.variables[jump.var];
+            state.variables[jump.var] =
+              jump.op === 'set' ? jump.value : value + 1;
+            pc++;
+            continue;
+          }
+          const taken = jump.test(state);
+          counters[pc] = (counters[pc] || 0) + 1;
+          if (taken && jump.max && counters[pc] > jump.max) {
+            logger.debug(`repeat at ${pc} exceeded ${jump.max}`);
+            return resolve({ exceeded: { name: jump.name, max: jump.max } });
+          }
+          pc = taken ? jump.index : pc + 1;
+        }
+        if (pc >= instructions.length) {
+          return resolve();
+        }
+        const instruction = instructions[pc];
+        let command;
+        try {
+          command = render(instruction.template, state.variables);
+        } catch (err) {
+          return reject(err);
+        }
+        const stopwatch = Stopwatch.start();
+        card.transmit(command, (err, response) => {
+          if (err) return reject(err);
+          const durationMs = stopwatch.elapsed();
+          if (!this.record(state, instruction, command, response, durationMs)) {
+            logger.debug(`step ${pc} failed, sw ${state.sw.toString(16)}`);
+            return resolve({ failedStep: state.steps.length - 1 });
+          }
+          pc++;
+          if (state.onStep) state.onStep(pc, state.variables, state.sw);
+          next();
+        });
+      };
+      next();
+    });
+  }
+}
+
+class ApduScript {
+  static compile(script) {
+    const steps = Array.isArray(script) ? script : script.steps;
+    const instructions = [];
+    const labels = { end: -1 };
+    compileSteps(steps, instructions, labels);
+    labels.end = instructions.length;
+    instructions.forEach((instruction) => {
+      if (instruction.op !== 'jump') return;
+      const index =
+        typeof instruction.target === 'number'
+          ? instruction.target
+          : labels[instruction.target];
+      if (index === undefined) {
+        throw new Error(`unknown step '${instruction.target}'`);
+      }
+      instruction.index = index;
+    });
+    return new ApduPlan(instructions);
+  }
+
+  static run(card, script, variables, options) {
+    return ApduScript.compile(script).run(card, variables, options);
+  }
+}
+
+ApduScript.ApduPlan = ApduPlan;
+
+module.exports = ApduScript;
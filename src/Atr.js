@@ -0,0 +1,155 @@
+'use strict';
+
+// PC/SC part 3, supplemental document: standard (SS) and card name (C0 C1)
+const standards = {
+  0x01: 'ISO 14443 A, part 1',
+  0x02: 'ISO 14443 A, part 2',
+  0x03: 'ISO 14443 A, part 3',
+  0x05: 'ISO 14443 B, part 1',
+  0x06: 'ISO 14443 B, part 2',
+  0x07: 'ISO 14443 B, part 3',
+  0x09: 'ISO 15693, part 1',
+  0x0a: 'ISO 15693, part 2',
+  0x0b: 'ISO 15693, part 3',
+  0x0c: 'ISO 15693, part 4',
+  0x11: 'FeliCa',
+};
+
+const cardNames = {
+  0x0001: 'MIFARE Classic 1K',
+  0x0002: 'MIFARE Classic 4K',
+  0x0003: 'MIFARE Ultralight',
+  0x0026: 'MIFARE Mini',
+  0x0030: 'Topaz/Jewel',
+  0x0036: 'MIFARE Plus SL1 2K',
+  0x0037: 'MIFARE Plus SL1 4K',
+  0x0038: 'MIFARE Plus SL2 2K',
+  0x0039: 'MIFARE Plus SL2 4K',
+  0x003a: 'MIFARE Ultralight C',
+  0x003b: 'FeliCa',
+};
+
+const PCSC_RID = Buffer.from('a000000306', 'hex');
+
+/*
+ISO 7816-3 answer to reset, with the ISO 7816-4 compact-TLV historical bytes.
+*/
+class Atr {
+  constructor(bytes) {
+    this.bytes = Buffer.isBuffer(bytes) ? bytes : Buffer.from(bytes, 'hex');
+    this.protocols = [];
+    this.interfaceBytes = [];
+    this.historicalBytes = Buffer.alloc(0);
+    this.parse();
+  }
+
+  static parse(bytes) {
+    return new Atr(bytes);
+  }
+
+  parse() {
+    const bytes = this.bytes;
+    if (bytes.length < 2) {
+      return;
+    }
+    const historicalLength = bytes[1] & 0x0f;
+    let y = bytes[1] >> 4;
+    let offset = 2;
+    let index = 1;
+    while (offset < bytes.length) {
+      const group = { index };
+      ['ta', 'tb', 'tc', 'td'].forEach((name, bit) => {
+        if (y & (1 << bit)) {
+          group[name] = bytes[offset++];
+        }
+      });
+      this.interfaceBytes.push(group);
+      if (group.td === undefined) {
+        break;
+      }
+      const protocol = group.td & 0x0f;
+      if (this.protocols.indexOf(protocol) < 0) {
+        this.protocols.push(protocol);
+      }
+      y = group.td >> 4;
+      index++;
+    }
+    if (this.protocols.length === 0) {
+      this.protocols.push(0);
+    }
+    this.historicalBytes = bytes.subarray(offset, offset + historicalLength);
+  }
+
+  static parseHistoricalBytes(historical) {
+    const result = {
+      categoryIndicator: historical.length ? historical[0] : undefined,
+      objects: {},
+      extendedLength: false,
+      commandChaining: false,
+    };
+    if (!historical.length || historical[0] !== 0x00) {
+      return result;
+    }
+    // compact-TLV between the category indicator and the 3 status bytes
+    let offset = 1;
+    while (offset < historical.length - 3) {
+      const tag = historical[offset] >> 4;
+      const length = historical[offset] & 0x0f;
+      const value = historical.subarray(offset + 1, offset + 1 + length);
+      result.objects[tag] = value;
+      if (tag === 0x7 && length >= 3) {
+        result.commandChaining = (value[2] & 0x80) === 0x80;
+        result.extendedLength = (value[2] & 0x40) === 0x40;
+      }
+      offset += 1 + length;
+    }
+    return result;
+  }
+
+  // readers build ATRs of contactless cards as 3B 8n 80 01 ...
+  isContactless() {
+    const b = this.bytes;
+    return (
+      b.length > 4 &&
+      b[0] === 0x3b &&
+      (b[1] & 0xf0) === 0x80 &&
+      b[2] === 0x80 &&
+      b[3] === 0x01
+    );
+  }
+
+  getContactlessInfo() {
+    if (!this.isContactless()) {
+      return null;
+    }
+    const h = this.historicalBytes;
+    const storage =
+      h.length >= 15 &&
+      h[0] === 0x80 &&
+      h[1] === 0x4f &&
+      h.subarray(3, 8).equals(PCSC_RID);
+    if (!storage) {
+      return { standard: 'ISO 14443-4', name: 'ISO 14443-4', storage: false };
+    }
+    const code = h.readUInt16BE(9);
+    return {
+      standard: standards[h[8]] || `unknown (${h[8]})`,
+      name: cardNames[code] || `unknown (${code.toString(16)})`,
+      code,
+      storage: true,
+    };
+  }
+
+  getCapabilities() {
+    if (!this.capabilities) {
+      this.capabilities = Atr.parseHistoricalBytes(this.historicalBytes);
+    }
+    return this.capabilities;
+  }
+
+  toString() {
+    return this.bytes.toString('hex');
+  }
+}
+
+export default Atr;
@@ -0,0 +1,381 @@
+'use strict';
+
+import fs from 'fs';
+import net from 'net';
+import { EventEmitter } from 'events';
+import Devices from './Devices';
+import Stopwatch from './Stopwatch';
+import {
+  defaultDirectory,
+  defaultPath,
+  types,
+  encode,
+  FrameReader,
+} from './BrokerProtocol';
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('Broker');
+
+// an extended Le of 65536 bytes and the status word
+const MAX_RESPONSE_LENGTH = 0x10002;
+
+/*
+Owns the readers of the host and shares them with other processes over a
+UNIX socket. Each device runs one command at a time; waiting commands are
+taken round robin across clients, so a busy client cannot starve the rest.
+A client that needs a sequence of commands kept together (a secure channel,
+GET RESPONSE chains) begins a transaction on the device: until it ends it,
+or disconnects, only that client's commands are sent.
+*/
+class Broker extends EventEmitter {
+  constructor(options) {
+    super();
+    const opts = options || {};
+    this.path = opts.path || defaultPath();
+    this.privateDirectory = opts.path ? null : defaultDirectory();
+    this.devices = opts.devices || new Devices();
+    this.ownsDevices = !opts.devices;
+    this.clients = {};
+    this.nextClientId = 1;
+    this.queues = {};
+    this.server = null;
+
+    const watch = (device) => {
+      device.on('card-inserted', (event) => {
+        this.broadcast(
+          encode(types.CARD_INSERTED, 0, {
+            name: device.name,
+            atr: Buffer.from(event.card.atr, 'hex'),
+            protocol: event.card.protocol,
+          })
+        );
+      });
+      device.on('card-removed', () => {
+        this.broadcast(encode(types.CARD_REMOVED, 0, { name: device.name }));
+      });
+    };
+    this.devices.listDevices().forEach(watch);
+    this.devices.on('device-activated', (event) => {
+      watch(event.device);
+      this.broadcast(
+        encode(types.DEVICE_ACTIVATED, 0, { name: event.device.name })
+      );
+    });
+    this.devices.on('device-deactivated', (event) => {
+      const name = event.device.name;
+      this.failQueue(name, 'device deactivated');
+      this.broadcast(encode(types.DEVICE_DEACTIVATED, 0, { name }));
+    });
+  }
+
+  /*
+  Only a stale socket of this user is replaced, anything else at the path
+  is an error. The socket is made accessible to this user alone.
+  */
+  listen() {
+    return new Promise((resolve, reject) => {
+      try {
+        this.prepareDirectory();
+        this.removeStaleSocket();
+      } catch (err) {
+        return reject(err);
+      }
+      this.server = net.createServer((socket) => this.accept(socket));
+      this.server.on('error', (error) => this.emit('error', { error }));
+      this.server.listen(this.path, () => {
+        try {
+          fs.chmodSync(this.path, 0o600);
+        } catch (err) {
+          this.server.close();
+          return reject(err);
+        }
+        logger.debug(`listening on ${this.path}`);
+        resolve(this);
+      });
+    });
+  }
+
+  prepareDirectory() {
+    const directory = this.privateDirectory;
+    if (!directory || directory === process.env.XDG_RUNTIME_DIR) {
+      return;
+    }
+    try {
+      fs.mkdirSync(directory, { mode: 0o700 });
+    } catch (err) {
+      if (err.code !== 'EEXIST') throw err;
+    }
+    const stats = fs.lstatSync(directory);
+    if (
+      !stats.isDirectory() ||
+      (typeof process.getuid === 'function' &&
+        stats.uid !== process.getuid()) ||
+      (stats.mode & 0o077) !== 0
+    ) {
+      throw new Error(`'${directory}' is not a private directory`);
+    }
+  }
+
+  removeStaleSocket() {
+    let stats;
+    try {
+      stats = fs.lstatSync(this.path);
+    } catch (err) {
+      if (err.code === 'ENOENT') return;
+      throw err;
+    }
+    const own =
+      typeof process.getuid !== 'function' || stats.uid === process.getuid();
+    if (!stats.isSocket() || !own) {
+      throw new Error(`'${this.path}' exists and is not this user's socket`);
+    }
+    fs.unlinkSync(this.path);
+  }
+
+  // readers the broker opened itself are closed too, after their running
+  // commands have drained
+  close() {
+    Object.keys(this.clients).forEach((id) => this.clients[id].socket.end());
+    const closed = new Promise((resolve) => {
+      if (!this.server) {
+        return resolve();
+      }
+      this.server.close(() => resolve());
+    });
+    if (!this.ownsDevices) {
+      return closed;
+    }
+    return Promise.all([closed, this.devices.close({ drain: true })]).then(
+      () => undefined
+    );
+  }
+
+  accept(socket) {
+    const client = {
+      id: this.nextClientId++,
+      socket,
+      reader: new FrameReader(),
+    };
+    this.clients[client.id] = client;
+    logger.debug(`client ${client.id} connected`);
+    this.emit('client-connected', { id: client.id });
+
+    // what a new client has missed so far
+    this.devices.listDevices().forEach((device) => {
+      socket.write(encode(types.DEVICE_ACTIVATED, 0, { name: device.name }));
+      if (device.card) {
+        socket.write(
+          encode(types.CARD_INSERTED, 0, {
+            name: device.name,
+            atr: Buffer.from(device.card.atr, 'hex'),
+            protocol: device.card.protocol,
+          })
+        );
+      }
+    });
+
+    socket.on('data', (chunk) => {
+      let messages;
+      try {
+        messages = client.reader.push(chunk);
+      } catch (err) {
+        // only this client goes, the broker and the others carry on
+        logger.debug(`client ${client.id}`, err.message);
+        this.reply(client, 0, err);
+        socket.destroy();
+        return;
+      }
+      messages.forEach((message) => {
+        if (
+          message.type === types.TRANSMIT ||
+          message.type === types.BEGIN_TRANSACTION ||
+          message.type === types.END_TRANSACTION
+        ) {
+          this.enqueue(client, message);
+        } else {
+          this.reply(client, message.id, new Error('unknown request'));
+        }
+      });
+    });
+    socket.on('error', (error) => logger.debug(`client ${client.id}`, error));
+    socket.on('close', () => {
+      delete this.clients[client.id];
+      Object.keys(this.queues).forEach((name) => {
+        const queue = this.queues[name];
+        delete queue.waiting[client.id];
+        queue.turns = queue.turns.filter((id) => id !== client.id);
+        if (queue.holder === client.id) {
+          logger.debug(`client ${client.id} left a transaction on ${name}`);
+          queue.holder = null;
+          this.pump(name);
+        }
+      });
+      this.emit('client-disconnected', { id: client.id });
+    });
+  }
+
+  broadcast(frame) {
+    Object.keys(this.clients).forEach((id) => {
+      this.clients[id].socket.write(frame);
+    });
+  }
+
+  reply(client, id, error, response) {
+    if (!this.clients[client.id]) {
+      return;
+    }
+    client.socket.write(
+      error
+        ? encode(types.ERROR, id, { message: error.message })
+        : encode(types.RESPONSE, id, { data: response })
+    );
+  }
+
+  queueFor(name) {
+    if (!this.queues[name]) {
+      this.queues[name] = {
+        waiting: {},
+        turns: [],
+        busy: false,
+        holder: null,
+        failed: null,
+        requests: 0,
+        busyMs: 0,
+      };
+    }
+    return this.queues[name];
+  }
+
+  // requests for a reader the broker does not know are refused here, so a
+  // client cannot make it keep a queue per name it makes up
+  enqueue(client, message) {
+    if (!this.devices.lookup(message.name)) {
+      const error = new Error(`no device '${message.name}'`);
+      return this.reply(client, message.id, error);
+    }
+    const queue = this.queueFor(message.name);
+    if (queue.failed) {
+      return this.reply(client, message.id, new Error(queue.failed));
+    }
+    if (!queue.waiting[client.id]) {
+      queue.waiting[client.id] = [];
+      queue.turns.push(client.id);
+    }
+    queue.waiting[client.id].push({ client, message });
+    this.pump(message.name);
+  }
+
+  // the oldest waiting request of a client, which then goes last in turn
+  take(queue, clientId) {
+    const waiting = queue.waiting[clientId];
+    const request = waiting.shift();
+    queue.turns = queue.turns.filter((id) => id !== clientId);
+    if (waiting.length) {
+      queue.turns.push(clientId);
+    } else {
+      delete queue.waiting[clientId];
+    }
+    return request;
+  }
+
+  // one command per device in flight, the next client in turn goes next,
+  // or only the transaction holder while there is one
+  pump(name) {
+    const queue = this.queues[name];
+    if (!queue || queue.busy) {
+      return;
+    }
+    const clientId = queue.holder || queue.turns[0];
+    if (!clientId || !queue.waiting[clientId]) {
+      return;
+    }
+    const { client, message } = this.take(queue, clientId);
+    if (message.type !== types.TRANSMIT) {
+      this.transaction(queue, client, message);
+      return this.pump(name);
+    }
+    const device = this.devices.lookup(name);
+    if (!device || !device.card) {
+      this.reply(client, message.id, new Error(`no card in '${name}'`));
+      return this.pump(name);
+    }
+    queue.busy = true;
+    const stopwatch = Stopwatch.start();
+    device.transmit(
+      message.data,
+      Math.min(message.responseLength, MAX_RESPONSE_LENGTH),
+      message.protocol,
+      (err, response) => {
+        queue.busy = false;
+        queue.requests++;
+        queue.busyMs += stopwatch.elapsed();
+        this.reply(client, message.id, err, response);
+        if (queue.failed) {
+          if (this.queues[name] === queue) delete this.queues[name];
+          return;
+        }
+        this.pump(name);
+      }
+    );
+  }
+
+  transaction(queue, client, message) {
+    const begin = message.type === types.BEGIN_TRANSACTION;
+    let error = null;
+    if (begin && !this.devices.lookup(message.name)) {
+      error = new Error(`no device '${message.name}'`);
+    } else if (begin && queue.holder === client.id) {
+      error = new Error('transaction already begun');
+    } else if (!begin && queue.holder !== client.id) {
+      error = new Error('no transaction to end');
+    } else {
+      queue.holder = begin ? client.id : null;
+      logger.debug(
+        `client ${client.id} ${begin ? 'began' : 'ended'} a transaction`
+      );
+    }
+    this.reply(client, message.id, error, Buffer.alloc(0));
+  }
+
+  // a command still running keeps the queue, refusing new requests, until
+  // it returns, so nothing is sent to the reader alongside it
+  failQueue(name, reason) {
+    const queue = this.queues[name];
+    if (!queue) {
+      return;
+    }
+    Object.keys(queue.waiting).forEach((id) => {
+      queue.waiting[id].forEach((request) =>
+        this.reply(request.client, request.message.id, new Error(reason))
+      );
+    });
+    queue.waiting = {};
+    queue.turns = [];
+    queue.holder = null;
+    if (queue.busy) {
+      queue.failed = reason;
+      return;
+    }
+    delete this.queues[name];
+  }
+
+  getStats() {
+    const devices = {};
+    Object.keys(this.queues).forEach((name) => {
+      const queue = this.queues[name];
+      devices[name] = {
+        requests: queue.requests,
+        waiting: Object.keys(queue.waiting).reduce(
+          (sum, id) => sum + queue.waiting[id].length,
+          0
+        ),
+        busyMs: queue.busyMs,
+        holder: queue.holder,
+      };
+    });
+    return { clients: Object.keys(this.clients).length, devices };
+  }
+}
+
+Broker.defaultPath = defaultPath;
+
+module.exports = Broker;
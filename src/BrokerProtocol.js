@@ -0,0 +1,167 @@
+'use strict';
+
+import os from 'os';
+import path from 'path';
+
+/*
+Framing between Broker and RemoteDevices over a local socket:
+
+  u32 length | u8 type | u32 id | fields
+
+length counts everything after itself. Fields follow the schema of the
+type: strings are u16 length + utf8, bytes are u32 length + data, numbers
+are u32. Requests carry a non-zero id that is echoed in the reply, events
+use id 0. Frames above MAX_FRAME, or with fields running past their end,
+are rejected.
+*/
+
+// per user: the runtime directory, else a private directory in tmp
+const defaultDirectory = () => {
+  if (process.env.XDG_RUNTIME_DIR) {
+    return process.env.XDG_RUNTIME_DIR;
+  }
+  const user =
+    typeof process.getuid === 'function'
+      ? process.getuid()
+      : os.userInfo().username;
+  return path.join(os.tmpdir(), `smartcard-${user}`);
+};
+
+const defaultPath = () =>
+  path.join(defaultDirectory(), 'smartcard-broker.sock');
+
+const types = {
+  DEVICE_ACTIVATED: 0x10,
+  DEVICE_DEACTIVATED: 0x11,
+  CARD_INSERTED: 0x12,
+  CARD_REMOVED: 0x13,
+  TRANSMIT: 0x20,
+  RESPONSE: 0x21,
+  ERROR: 0x22,
+  BEGIN_TRANSACTION: 0x23,
+  END_TRANSACTION: 0x24,
+};
+
+const schemas = {
+  [types.DEVICE_ACTIVATED]: ['name'],
+  [types.DEVICE_DEACTIVATED]: ['name'],
+  [types.CARD_INSERTED]: ['name', 'atr', 'protocol'],
+  [types.CARD_REMOVED]: ['name'],
+  [types.TRANSMIT]: ['name', 'responseLength', 'protocol', 'data'],
+  [types.RESPONSE]: ['data'],
+  [types.ERROR]: ['message'],
+  [types.BEGIN_TRANSACTION]: ['name'],
+  [types.END_TRANSACTION]: ['name'],
+};
+
+const stringFields = ['name', 'message'];
+const bytesFields = ['atr', 'data'];
+
+const HEADER = 9;
+
+// an extended APDU with its fields, with room to spare
+const MAX_FRAME = 0x11000;
+
+const malformed = (reason) => new Error(`malformed frame, ${reason}`);
+
+const encode = (type, id, message) => {
+  const parts = [];
+  let length = HEADER - 4;
+  schemas[type].forEach((field) => {
+    const value = message[field];
+    if (stringFields.indexOf(field) >= 0) {
+      const text = Buffer.from(value || '', 'utf8');
+      const prefix = Buffer.alloc(2);
+      prefix.writeUInt16BE(text.length, 0);
+      parts.push(prefix, text);
+      length += 2 + text.length;
+    } else if (bytesFields.indexOf(field) >= 0) {
+      const data = Buffer.isBuffer(value) ? value : Buffer.from(value || []);
+      const prefix = Buffer.alloc(4);
+      prefix.writeUInt32BE(data.length, 0);
+      parts.push(prefix, data);
+      length += 4 + data.length;
+    } else {
+      const number = Buffer.alloc(4);
+      number.writeUInt32BE(value >>> 0, 0);
+      parts.push(number);
+      length += 4;
+    }
+  });
+  const header = Buffer.alloc(HEADER);
+  header.writeUInt32BE(length, 0);
+  header[4] = type;
+  header.writeUInt32BE(id >>> 0, 5);
+  return Buffer.concat([header].concat(parts), length + 4);
+};
+
+// byte fields of the decoded message are views over the frame
+const decode = (frame) => {
+  if (frame.length < HEADER) {
+    throw malformed(`${frame.length} bytes`);
+  }
+  const type = frame[4];
+  const message = { type, id: frame.readUInt32BE(5) };
+  let offset = HEADER;
+  const take = (count, field) => {
+    if (offset + count > frame.length) {
+      throw malformed(`'${field}' past the end`);
+    }
+    const start = offset;
+    offset += count;
+    return start;
+  };
+  (schemas[type] || []).forEach((field) => {
+    if (stringFields.indexOf(field) >= 0) {
+      const length = frame.readUInt16BE(take(2, field));
+      const start = take(length, field);
+      message[field] = frame.toString('utf8', start, start + length);
+    } else if (bytesFields.indexOf(field) >= 0) {
+      const length = frame.readUInt32BE(take(4, field));
+      const start = take(length, field);
+      message[field] = frame.subarray(start, start + length);
+    } else {
+      message[field] = frame.readUInt32BE(take(4, field));
+    }
+  });
+  return message;
+};
+
+// splits a socket byte stream into decoded messages, throws on a bad frame
+class FrameReader {
+  constructor() {
+    this.pending = Buffer.alloc(0);
+  }
+
+  push(chunk) {
+    this.pending = this.pending.length
+      ? Buffer.concat([this.pending, chunk])
+      : chunk;
+    const messages = [];
+    let offset = 0;
+    while (this.pending.length - offset >= 4) {
+      const length = this.pending.readUInt32BE(offset);
+      if (length < HEADER - 4 || length > MAX_FRAME) {
+        this.pending = Buffer.alloc(0);
+        throw malformed(`length ${length}`);
+      }
+      if (this.pending.length - offset < 4 + length) {
+        break;
+      }
+      messages.push(decode(this.pending.subarray(offset, offset + 4 + length)));
+      offset += 4 + length;
+    }
+    this.pending = this.pending.subarray(offset);
+    return messages;
+  }
+}
+
+module.exports = {
+  defaultDirectory,
+  defaultPath,
+  MAX_FRAME,
+  types,
+  encode,
+  decode,
+  FrameReader,
+};
@@ -0,0 +1,50 @@
+'use strict';
+
+import CardCrypto from './CardCrypto';
+
+const keyOf = (rid, index) =>
+  `${Buffer.from(rid).toString('hex')}:${Number(index).toString(16)}`;
+
+const toBuffer = (value) =>
+  Buffer.isBuffer(value) ? value : Buffer.from(value, 'hex');
+
+/*
+Certification authority public keys for EMV offline data authentication,
+indexed by RID and CA public key index (tag 8F). The node key object is
+built once, when the key is added.
+*/
+class CaKeyStore {
+  constructor(keys) {
+    this.keys = {};
+    (keys || []).forEach((key) => this.add(key));
+  }
+
+  // { rid, index, modulus, exponent, expiry }, byte values as hex or Buffer
+  add(key) {
+    const modulus = toBuffer(key.modulus);
+    const exponent = toBuffer(key.exponent || '03');
+    this.keys[keyOf(toBuffer(key.rid), key.index)] = {
+      rid: toBuffer(key.rid).toString('hex'),
+      index: key.index,
+      modulus,
+      exponent,
+      expiry: key.expiry || null,
+      publicKey: CardCrypto.rsaPublicKey(modulus, exponent),
+    };
+    return this;
+  }
+
+  get(rid, index) {
+    return this.keys[keyOf(toBuffer(rid), index)] || null;
+  }
+
+  remove(rid, index) {
+    delete this.keys[keyOf(toBuffer(rid), index)];
+  }
+
+  size() {
+    return Object.keys(this.keys).length;
+  }
+}
+
+module.exports = CaKeyStore;
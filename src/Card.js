@@ -3,9 +3,36 @@
 import { EventEmitter } from 'events';
 import hexify from 'hexify';
 import ResponseApdu from './ResponseApdu';
-import pino from 'pino';
+import RetryPolicy from './RetryPolicy';
+import Stopwatch from './Stopwatch';
+import lazyLogger from './lazyLogger';
 
-const logger = pino({ name: 'Card' });
+const logger = lazyLogger('Card');
+
+// SCARD_W_RESET_CARD, the card was reset by another process
+const isReset = (err) => /0x80100068|card was reset/i.test(err.message);
+
+// a card reset again and again is given up on after this many recoveries
+// of one command
+const MAX_RECOVERIES = 3;
+
+// the attempts of one command: retries, recoveries and the policy retrying
+const attemptsOf = (attempt) =>
+  attempt || {
+    count: 0,
+    recoveries: 0,
+    stopwatch: Stopwatch.start(),
+    policy: null,
+  };
+
+const toBuffer = (command) => {
+  if (Buffer.isBuffer(command)) return command;
+  if (Array.isArray(command)) return new Buffer(command);
+  if (typeof command === 'string') {
+    return new Buffer(hexify.toByteArray(command));
+  }
+  return command.toBuffer();
+};
 
 class Card extends EventEmitter {
   constructor(device, atr, protocol) {
@@ -14,6 +41,14 @@ class Card extends EventEmitter {
     this.device = device;
     this.protocol = protocol;
     this.atr = atr.toString('hex');
+    this.uid = null;
+    this.tag = null;
+    // what a reset card needs to get back to where it was
+    this.session = { selected: {}, hooks: {} };
+    this.recovery = null;
+    this.internal = false;
+    this.retryPolicy =
+      RetryPolicy.from(device.options && device.options.retry) || null;
   }
 
   getAtr() {
@@ -25,34 +60,26 @@ class Card extends EventEmitter {
   }
 
   issueCommand(commandApdu, callback) {
-    let buffer;
-    if (Array.isArray(commandApdu)) {
-      buffer = new Buffer(commandApdu);
-    } else if (typeof commandApdu === 'string') {
-      buffer = new Buffer(hexify.toByteArray(commandApdu));
-    } else if (Buffer.isBuffer(commandApdu)) {
-      buffer = commandApdu;
-    } else if (typeof commandApdu === 'string') {
-      buffer = new Buffer(hexify.toByteArray(commandApdu));
-    } else {
-      buffer = commandApdu.toBuffer();
-    }
-
-    const protocol = this.protocol;
+    const buffer = toBuffer(commandApdu);
+    const resLen = commandApdu.getResponseLength
+      ? commandApdu.getResponseLength()
+      : 0x102;
 
     this.emit('command-issued', { card: this, command: commandApdu });
     if (callback) {
-      this.device.transmit(buffer, 0x102, protocol, (err, response) => {
-        this.emit('response-received', {
-          card: this,
-          command: commandApdu,
-          response: new ResponseApdu(response),
-        });
+      this.exchange(buffer, resLen, (err, response) => {
+        if (!err) {
+          this.emit('response-received', {
+            card: this,
+            command: commandApdu,
+            response: new ResponseApdu(response),
+          });
+        }
         callback(err, response);
       });
     } else {
       return new Promise((resolve, reject) => {
-        this.device.transmit(buffer, 0x102, protocol, (err, response) => {
+        this.exchange(buffer, resLen, (err, response) => {
           if (err) reject(err);
           else {
             this.emit('response-received', {
@@ -66,6 +93,207 @@ class Card extends EventEmitter {
       });
     }
   }
+
+  // sends through the device; a card reset by someone else is reconnected,
+  // its session restored and the command sent again, up to MAX_RECOVERIES
+  // times, transient errors are retried as the retry policy says. Commands
+  // wait for a running recovery, except those of the restore itself, sent
+  // through its internal view.
+  exchange(buffer, resLen, callback, attempt) {
+    if (this.recovery && !this.internal) {
+      return this.recovery.then(
+        () => this.exchange(buffer, resLen, callback, attempt),
+        (err) => callback(err)
+      );
+    }
+    this.device.transmit(buffer, resLen, this.protocol, (err, response) => {
+      const tries = attemptsOf(attempt);
+      if (err && isReset(err) && this.canRecover()) {
+        if (tries.recoveries < MAX_RECOVERIES) {
+          tries.recoveries++;
+          return this.recover().then(
+            () => this.exchange(buffer, resLen, callback, tries),
+            (recoveryErr) => callback(recoveryErr)
+          );
+        }
+        logger.debug(`card reset ${tries.recoveries} times, giving up`);
+      }
+      if (err && this.retryPolicy) {
+        return this.retry(err, buffer, resLen, callback, tries);
+      }
+      if (!err) {
+        // the policy that retried, even if the card has another one now
+        if (tries.count && tries.policy) {
+          tries.policy.stats.recovered++;
+        }
+        this.record(buffer, response);
+      }
+      callback(err, response);
+    });
+  }
+
+  retry(err, buffer, resLen, callback, tries) {
+    const policy = this.retryPolicy;
+    tries.policy = policy;
+    tries.count++;
+    const delay = policy.delay(err, tries.count, tries.stopwatch.elapsed());
+    if (delay < 0) {
+      return callback(err);
+    }
+    logger.debug(`retry ${tries.count} in ${delay}ms`, err.message);
+    const rule = policy.classify(err).rule;
+    setTimeout(() => {
+      if (!rule.reconnect || !this.canRecover()) {
+        return this.exchange(buffer, resLen, callback, tries);
+      }
+      this.recover().then(
+        () => this.exchange(buffer, resLen, callback, tries),
+        (recoveryErr) => callback(recoveryErr)
+      );
+    }, delay);
+  }
+
+  // options as for RetryPolicy, or a RetryPolicy shared between cards,
+  // null to stop retrying
+  setRetryPolicy(policy) {
+    this.retryPolicy = RetryPolicy.from(policy) || null;
+    return this;
+  }
+
+  canRecover() {
+    return (
+      !this.internal &&
+      typeof this.device.reconnect === 'function' &&
+      this.device.options.recover !== false
+    );
+  }
+
+  // remembers the application selected by name on each basic channel
+  record(buffer, response) {
+    if (this.internal || buffer.length < 5) {
+      return;
+    }
+    if (buffer[1] !== 0xa4 || buffer[2] !== 0x04) {
+      return;
+    }
+    const sw1 = response[response.length - 2];
+    const ok =
+      sw1 === 0x61 || (sw1 === 0x90 && response[response.length - 1] === 0);
+    if (ok) {
+      this.session.selected[buffer[0] & 0x03] = Buffer.from(buffer);
+    }
+  }
+
+  // hooks run after the selects are replayed, each (card) => Promise:
+  // secureMessaging, then verifyPin; they must send through the card given
+  onRestore(hooks) {
+    Object.assign(this.session.hooks, hooks);
+    return this;
+  }
+
+  recover() {
+    if (this.recovery) {
+      return this.recovery;
+    }
+    logger.debug(`recover ${this}`);
+    this.recovery = new Promise((resolve, reject) => {
+      this.device.reconnect((err, protocol) =>
+        err ? reject(err) : resolve(protocol)
+      );
+    })
+      .then((protocol) => {
+        this.protocol = protocol;
+        return this.restore();
+      })
+      .then(
+        () => {
+          this.recovery = null;
+          this.device.recovered(this, null);
+        },
+        (err) => {
+          this.recovery = null;
+          this.device.recovered(this, err);
+          throw err;
+        }
+      );
+    return this.recovery;
+  }
+
+  // replays through a view of the card whose commands skip the recovery
+  // wait; the hooks get that view, application commands keep waiting
+  restore() {
+    const hooks = this.session.hooks;
+    const internal = Object.create(this, { internal: { value: true } });
+    const selects = Object.keys(this.session.selected)
+      .sort()
+      .map((channel) => this.session.selected[channel]);
+    return selects
+      .reduce(
+        (chain, select) =>
+          chain.then(() => internal.issueCommand(select)).then((response) => {
+            const sw1 = response[response.length - 2];
+            if (sw1 !== 0x90 && sw1 !== 0x61) {
+              const hex = select.toString('hex');
+              throw new Error(`restore, select failed '${hex}'`);
+            }
+          }),
+        Promise.resolve()
+      )
+      .then(() => hooks.secureMessaging && hooks.secureMessaging(internal))
+      .then(() => hooks.verifyPin && hooks.verifyPin(internal));
+  }
+
+  /*
+  Callback only exchange of anything issueCommand takes, T=0 61xx/9Fxx
+  answered with GET RESPONSE and 6Cxx with the command again under the
+  right Le. Iso7816Application.exchange() is this as a Promise.
+  */
+  transmit(command, callback) {
+    const buffer = toBuffer(command);
+    this.issueCommand(command, (err, response) => {
+      if (err) return callback(err);
+      const sw1 = response[response.length - 2];
+      const sw2 = response[response.length - 1];
+      if (sw1 === 0x61 || sw1 === 0x9f) {
+        const cla = buffer[0] === 0xa0 ? 0xa0 : buffer[0] & 0x03;
+        const getResponse = Buffer.from([cla, 0xc0, 0x00, 0x00, sw2]);
+        return this.transmit(getResponse, (err, more) => {
+          if (err) return callback(err);
+          const data = response.subarray(0, response.length - 2);
+          callback(null, Buffer.concat([data, more]));
+        });
+      }
+      if (sw1 === 0x6c) {
+        const retry = Buffer.from(buffer);
+        retry[retry.length - 1] = sw2;
+        return this.transmit(retry, callback);
+      }
+      callback(null, response);
+    });
+  }
+
+  // sends the commands back to back under a single promise; check(index,
+  // response) returning false stops the batch after that command
+  issueBatch(commands, check) {
+    return new Promise((resolve, reject) => {
+      const results = [];
+      const next = (i) => {
+        if (i >= commands.length) {
+          return resolve(results);
+        }
+        const stopwatch = Stopwatch.start();
+        this.transmit(commands[i], (err, response) => {
+          if (err) return reject(err);
+          results.push({ response, durationMs: stopwatch.elapsed() });
+          if (check && check(i, response) === false) {
+            return resolve(results);
+          }
+          next(i + 1);
+        });
+      };
+      next(0);
+    });
+  }
 }
 
 export default Card;
@@ -0,0 +1,185 @@
+'use strict';
+
+import crypto from 'crypto';
+import Tlv from './Tlv';
+
+const ZERO_IV_8 = Buffer.alloc(8);
+
+const pad = (data, blockSize) => {
+  const size = blockSize || 8;
+  const padded = Buffer.alloc((Math.floor(data.length / size) + 1) * size);
+  Buffer.from(data).copy(padded);
+  padded[data.length] = 0x80;
+  return padded;
+};
+
+const unpad = (data) => {
+  let end = data.length - 1;
+  while (end >= 0 && data[end] === 0x00) {
+    end--;
+  }
+  if (end < 0 || data[end] !== 0x80) {
+    throw new Error('invalid ISO 9797-1 padding');
+  }
+  return data.subarray(0, end);
+};
+
+const xor = (a, b) => {
+  const result = Buffer.alloc(a.length);
+  for (let i = 0; i < a.length; i++) {
+    result[i] = a[i] ^ b[i];
+  }
+  return result;
+};
+
+const cipher = (algorithm, key, iv, data, decrypt) => {
+  const c = decrypt
+    ? crypto.createDecipheriv(algorithm, key, iv)
+    : crypto.createCipheriv(algorithm, key, iv);
+  c.setAutoPadding(false);
+  return Buffer.concat([c.update(data), c.final()]);
+};
+
+// 2-key 3DES keys are passed as 16 bytes, single DES keys as 8
+const tdesKey = (key) =>
+  key.length === 8 ? Buffer.concat([key, key]) : key.subarray(0, 16);
+
+const tdesEncrypt = (key, data, iv) =>
+  cipher('des-ede-cbc', tdesKey(key), iv || ZERO_IV_8, data, false);
+
+const tdesDecrypt = (key, data, iv) =>
+  cipher('des-ede-cbc', tdesKey(key), iv || ZERO_IV_8, data, true);
+
+const tdesEcb = (key, data, decrypt) =>
+  cipher('des-ede-ecb', tdesKey(key), null, data, decrypt);
+
+const aesAlgorithm = (key, mode) => `aes-${key.length * 8}-${mode}`;
+
+const aesEncrypt = (key, data, iv) =>
+  cipher(aesAlgorithm(key, 'cbc'), key, iv || Buffer.alloc(16), data, false);
+
+const aesDecrypt = (key, data, iv) =>
+  cipher(aesAlgorithm(key, 'cbc'), key, iv || Buffer.alloc(16), data, true);
+
+const aesEcb = (key, data, decrypt) =>
+  cipher(aesAlgorithm(key, 'ecb'), key, null, data, decrypt);
+
+// ISO 9797-1 MAC algorithm 3 (retail MAC) with padding method 2
+const retailMac = (key, data) => {
+  const ka = key.subarray(0, 8);
+  const kb = key.subarray(8, 16);
+  const chained = tdesEncrypt(ka, pad(data, 8));
+  const last = chained.subarray(chained.length - 8);
+  return tdesEcb(ka, tdesEcb(kb, last, true), false);
+};
+
+const shiftLeft = (block) => {
+  const shifted = Buffer.alloc(block.length);
+  for (let i = 0; i < block.length; i++) {
+    const carry = i + 1 < block.length ? block[i + 1] >> 7 : 0;
+    shifted[i] = (block[i] << 1) | carry;
+  }
+  return shifted;
+};
+
+const cmacSubkey = (block) => {
+  const shifted = shiftLeft(block);
+  if (block[0] & 0x80) {
+    shifted[15] ^= 0x87;
+  }
+  return shifted;
+};
+
+// message with its last block masked, from l the encrypted zero block
+const cmacMessage = (l, data) => {
+  const k1 = cmacSubkey(l);
+  const complete = data.length > 0 && data.length % 16 === 0;
+  let message;
+  if (complete) {
+    message = Buffer.from(data);
+    const last = message.length - 16;
+    xor(message.subarray(last), k1).copy(message, last);
+  } else {
+    message = pad(data, 16);
+    const last = message.length - 16;
+    xor(message.subarray(last), cmacSubkey(k1)).copy(message, last);
+  }
+  return message;
+};
+
+// NIST SP 800-38B
+const aesCmac = (key, data) => {
+  const message = cmacMessage(aesEcb(key, Buffer.alloc(16)), data);
+  const chained = aesEncrypt(key, message);
+  return chained.subarray(chained.length - 16);
+};
+
+const adjustParity = (key) => {
+  const adjusted = Buffer.from(key);
+  for (let i = 0; i < adjusted.length; i++) {
+    let bits = 0;
+    for (let b = 1; b < 8; b++) {
+      bits += (adjusted[i] >> b) & 1;
+    }
+    adjusted[i] = (adjusted[i] & 0xfe) | (bits % 2 === 0 ? 1 : 0);
+  }
+  return adjusted;
+};
+
+// ICAO 9303-11 key derivation function
+const kdf = (secret, counter, cipherName, keyLength) => {
+  const c = Buffer.alloc(4);
+  c.writeUInt32BE(counter, 0);
+  const length = keyLength || 16;
+  const hash = crypto
+    .createHash(length > 16 ? 'sha256' : 'sha1')
+    .update(Buffer.concat([secret, c]))
+    .digest();
+  const key = hash.subarray(0, length);
+  return cipherName === '3des' ? adjustParity(key) : key;
+};
+
+// INTEGER contents are signed, a leading zero keeps the modulus positive
+const derInteger = (value) => {
+  let start = 0;
+  while (start < value.length - 1 && value[start] === 0) start++;
+  const body = value.subarray(start);
+  return Tlv.encode(
+    0x02,
+    body[0] & 0x80 ? Buffer.concat([Buffer.from([0]), body]) : body
+  );
+};
+
+// node public key from a bare modulus and exponent (PKCS#1 RSAPublicKey)
+const rsaPublicKey = (modulus, exponent) =>
+  crypto.createPublicKey({
+    key: Tlv.encode(
+      0x30,
+      Buffer.concat([derInteger(modulus), derInteger(exponent)])
+    ),
+    format: 'der',
+    type: 'pkcs1',
+  });
+
+// raw RSA public operation, as used for ISO 9796-2 message recovery
+const rsaRecover = (key, data) =>
+  crypto.publicDecrypt({ key, padding: crypto.constants.RSA_NO_PADDING }, data);
+
+module.exports = {
+  pad,
+  unpad,
+  xor,
+  tdesEncrypt,
+  tdesDecrypt,
+  tdesEcb,
+  aesEncrypt,
+  aesDecrypt,
+  aesEcb,
+  retailMac,
+  aesCmac,
+  cmacMessage,
+  adjustParity,
+  kdf,
+  rsaPublicKey,
+  rsaRecover,
+};
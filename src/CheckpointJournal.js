@@ -0,0 +1,89 @@
+'use strict';
+
+import fs from 'fs';
+
+// Buffers survive the round trip through JSON as { hex }
+const replacer = function (key, value) {
+  const raw = this[key];
+  return Buffer.isBuffer(raw) ? { hex: raw.toString('hex') } : value;
+};
+
+const reviver = (key, value) =>
+  value && typeof value === 'object' && typeof value.hex === 'string'
+    ? Buffer.from(value.hex, 'hex')
+    : value;
+
+/*
+Append-only JSON lines file of per card progress. Every entry is written,
+and by default synced, before the call returns, so after a crash the last
+entry of a card is the last confirmed one. Reopening replays the file.
+*/
+class CheckpointJournal {
+  constructor(path, options) {
+    const opts = options || {};
+    this.path = path;
+    this.sync = opts.sync !== false;
+    this.cards = {};
+    this.entries = 0;
+    if (fs.existsSync(path)) {
+      this.replay(this.repair(fs.readFileSync(path)));
+    }
+    this.fd = fs.openSync(path, 'a');
+  }
+
+  // drops the torn last line of a crashed write, so the next entry starts
+  // on a line of its own
+  repair(content) {
+    const end = content.lastIndexOf(0x0a) + 1;
+    if (end === content.length) {
+      return content.toString('utf8');
+    }
+    fs.truncateSync(this.path, end);
+    return content.toString('utf8', 0, end);
+  }
+
+  replay(text) {
+    text.split('\n').forEach((line) => {
+      if (!line) return;
+      let entry;
+      try {
+        entry = JSON.parse(line, reviver);
+      } catch (err) {
+        throw new Error(`${this.path}: unreadable entry '${line}'`);
+      }
+      this.apply(entry);
+    });
+  }
+
+  apply(entry) {
+    this.entries++;
+    this.cards[entry.card] = Object.assign(
+      {},
+      this.cards[entry.card],
+      entry
+    );
+  }
+
+  append(entry) {
+    const line = `${JSON.stringify(entry, replacer)}\n`;
+    fs.writeSync(this.fd, line);
+    if (this.sync) {
+      fs.fdatasyncSync(this.fd);
+    }
+    this.apply(JSON.parse(line, reviver));
+  }
+
+  // latest state of a card, { card, status, pc, sw, variables, ... }
+  get(card) {
+    return this.cards[card] || null;
+  }
+
+  close() {
+    if (this.fd !== null) {
+      fs.closeSync(this.fd);
+      this.fd = null;
+    }
+  }
+}
+
+module.exports = CheckpointJournal;
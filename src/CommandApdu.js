@@ -15,6 +15,7 @@ class CommandApdu {
   constructor(obj) {
     if (obj.bytes) {
       this.bytes = obj.bytes;
+      this.extended = !!obj.extended;
     } else {
       let size = obj.size;
       let cla = obj.cla;
@@ -24,6 +25,7 @@ class CommandApdu {
       let data = obj.data;
       let le = obj.le || 0;
       let lc;
+      this.extended = !!obj.extended;
 
       // case 1
       if (!size && !data && !le) {
@@ -63,15 +65,27 @@ class CommandApdu {
       this.bytes.push(p1);
       this.bytes.push(p2);
 
-      if (data) {
-        this.bytes.push(lc);
-        this.bytes = this.bytes.concat(data);
+      if (this.extended) {
+        this.bytes.push(0x00);
+        if (data) {
+          this.bytes.push((lc >> 8) & 0xff, lc & 0xff);
+          this.bytes = this.bytes.concat(Array.from(data));
+        }
+        this.bytes.push((le >> 8) & 0xff, le & 0xff);
+      } else {
+        if (data) {
+          this.bytes.push(lc);
+          this.bytes = this.bytes.concat(data);
+        }
+        this.bytes.push(le);
       }
-      this.bytes.push(le);
     }
   }
 
   toString() {
+    if (Buffer.isBuffer(this.bytes)) {
+      return this.bytes.toString('hex');
+    }
     return hexify.toHexString(this.bytes);
   }
 
@@ -79,13 +93,34 @@ class CommandApdu {
     return this.bytes;
   }
 
+  // commands built over a Buffer, e.g. decoded by ApduBatch, are not copied
   toBuffer() {
+    if (Buffer.isBuffer(this.bytes)) {
+      return this.bytes;
+    }
     return new Buffer(this.bytes);
   }
 
   setLe(le) {
+    if (Buffer.isBuffer(this.bytes)) {
+      this.bytes = Array.from(this.bytes);
+    }
     this.bytes.pop();
-    this.bytes.push(le);
+    if (this.extended) {
+      this.bytes.pop();
+      this.bytes.push((le >> 8) & 0xff);
+    }
+    this.bytes.push(le & 0xff);
+  }
+
+  getResponseLength() {
+    if (!this.extended) {
+      return 0x102;
+    }
+    const le =
+      this.bytes[this.bytes.length - 2] * 256 +
+      this.bytes[this.bytes.length - 1];
+    return (le || 0x10000) + 2;
   }
 }
 
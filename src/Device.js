@@ -1,76 +1,424 @@
 'use strict';
 
+import Atr from './Atr';
 import Card from './Card';
+import EventStream from './EventStream';
+import Stopwatch from './Stopwatch';
+import RetryPolicy from './RetryPolicy';
+import WarmUp from './WarmUp';
 import { EventEmitter } from 'events';
-import pino from 'pino';
+import lazyLogger from './lazyLogger';
 
-const logger = pino({ name: 'Device' });
+const logger = lazyLogger('Device');
 
+const states = {
+  EMPTY: 'empty',
+  PRESENT: 'present',
+  CONNECTING: 'connecting',
+  CONNECTED: 'connected',
+  REMOVING: 'removing',
+};
+
+// GET DATA for the UID, straight after connect and before any Card exists,
+// only for contactless cards
+const identify = (reader, atr, protocol, cb) => {
+  const tag = atr.getContactlessInfo();
+  if (!tag) {
+    return cb(null, null);
+  }
+  try {
+    reader.transmit(
+      Buffer.from([0xff, 0xca, 0x00, 0x00, 0x00]),
+      12,
+      protocol,
+      (err, response) => {
+        const ok =
+          !err &&
+          response.length > 2 &&
+          response.readUInt16BE(response.length - 2) === 0x9000;
+        if (!ok) {
+          logger.debug(`identify, no UID`);
+        }
+        cb(ok ? response.subarray(0, response.length - 2) : null, tag);
+      }
+    );
+  } catch (err) {
+    // the card is still emitted, without a UID
+    logger.debug(`identify failed`, err);
+    cb(null, tag);
+  }
+};
+
+/*
+Card state per reader: empty -> present -> connecting -> connected ->
+removing -> empty. Status changes only record the wanted state; while a
+connect or disconnect is in flight further changes are coalesced, and a
+connect that a removal or another card has overtaken is dropped, even when
+the same card was put back.
+*/
 class Device extends EventEmitter {
-  constructor(reader) {
+  constructor(reader, options) {
     super();
     logger.debug(`new Device(${reader})`);
     this.reader = reader;
     this.name = reader.name;
     this.card = null;
-
-    const isCardInserted = (changes, reader, status) => {
-      return (
-        changes & reader.SCARD_STATE_PRESENT &&
-        status.state & reader.SCARD_STATE_PRESENT
-      );
+    this.options = Object.assign({}, options);
+    this.options.warmUp = WarmUp.from(this.options.warmUp);
+    this.options.retry = RetryPolicy.from(this.options.retry);
+    this.state = states.EMPTY;
+    // the ATR of the card in the reader, null when there is none
+    this.wanted = null;
+    // counts removals, so a card pulled and put back is a new card even
+    // with the same ATR
+    this.generation = 0;
+    this.connected = null;
+    this.connectedGeneration = -1;
+    this.debounceTimer = null;
+    this.inFlight = 0;
+    this.busy = false;
+    this.idleWaiters = [];
+    this.closed = false;
+    this.metrics = {
+      statusChanges: 0,
+      coalesced: 0,
+      connects: 0,
+      wastedConnects: 0,
+      insertions: 0,
+      removals: 0,
+      resets: 0,
+      recoveries: 0,
+      failedRecoveries: 0,
+      recoveryMs: 0,
+      transitions: {},
     };
 
-    const isCardRemoved = (changes, reader, status) => {
-      return (
-        changes & reader.SCARD_STATE_EMPTY &&
-        status.state & reader.SCARD_STATE_EMPTY
-      );
+    this.statusListener = (status) => {
+      const changes = reader.state ^ status.state;
+      if (!changes) {
+        return;
+      }
+      this.metrics.statusChanges++;
+      if (status.state & reader.SCARD_STATE_EMPTY) {
+        this.wanted = null;
+        this.generation++;
+      } else if (status.state & reader.SCARD_STATE_PRESENT) {
+        this.wanted = Buffer.from(status.atr || []);
+      }
+      this.reconcile();
     };
+    reader.on('status', this.statusListener);
+  }
+
+  transition(to) {
+    const from = this.state;
+    const key = `${from}->${to}`;
+    this.metrics.transitions[key] = (this.metrics.transitions[key] || 0) + 1;
+    this.state = to;
+    this.emit('state-changed', { device: this, from, to });
+  }
 
-    const cardInserted = (reader, status) => {
-      reader.connect({ share_mode: 2 }, (err, protocol) => {
-        if (err) {
-          this.emit('error', err);
-        } else {
-          this.card = new Card(this, status.atr, protocol);
-          this.emit('card-inserted', { device: this, card: this.card });
+  // moves one step towards the wanted state
+  reconcile() {
+    switch (this.state) {
+      case states.CONNECTING:
+      case states.REMOVING:
+        this.metrics.coalesced++;
+        return;
+      case states.EMPTY:
+        if (this.wanted) {
+          this.transition(states.PRESENT);
+          this.debounce();
+        }
+        return;
+      case states.PRESENT:
+        if (!this.wanted) {
+          clearTimeout(this.debounceTimer);
+          this.debounceTimer = null;
+          this.transition(states.EMPTY);
+        } else if (!this.debounceTimer) {
+          this.debounce();
+        }
+        return;
+      case states.CONNECTED:
+        if (this.stale(this.connected, this.connectedGeneration)) {
+          this.disconnect();
         }
+        return;
+    }
+  }
+
+  // the card connected to is no longer the one in the reader
+  stale(atr, generation) {
+    return (
+      !this.wanted || generation !== this.generation || !this.wanted.equals(atr)
+    );
+  }
+
+  debounce() {
+    const delay = this.options.debounceMs || 0;
+    if (!delay) {
+      return this.connect();
+    }
+    this.debounceTimer = setTimeout(() => {
+      this.debounceTimer = null;
+      if (this.state === states.PRESENT && this.wanted) {
+        this.connect();
+      }
+    }, delay);
+  }
+
+  connect() {
+    const atr = this.wanted;
+    const generation = this.generation;
+    const stopwatch = Stopwatch.start();
+    this.transition(states.CONNECTING);
+    this.metrics.connects++;
+    this.reader.connect({ share_mode: 2 }, (err, protocol) => {
+      if (this.closed) {
+        // the reader handle is gone, and with it the connection
+        return;
+      }
+      if (err) {
+        this.transition(this.wanted ? states.PRESENT : states.EMPTY);
+        this.emit('error', err);
+        return;
+      }
+      this.connected = atr;
+      this.connectedGeneration = generation;
+      if (this.stale(atr, generation)) {
+        // removed or replaced while connecting
+        this.metrics.wastedConnects++;
+        return this.disconnect();
+      }
+      if (!this.options.identify) {
+        return this.connectedTo(atr, protocol, {}, stopwatch);
+      }
+      identify(this.reader, Atr.parse(atr), protocol, (uid, tag) => {
+        const details = { uid, tag, durationMs: stopwatch.elapsed() };
+        this.connectedTo(atr, protocol, details, stopwatch);
       });
-    };
+    });
+  }
 
-    const cardRemoved = (reader) => {
-      const name = reader.name;
-      reader.disconnect(reader.SCARD_LEAVE_CARD, (err) => {
-        if (err) {
-          this.emit('error', err);
-        } else {
-          this.emit('card-removed', { name, card: this.card });
-          this.card = null;
-        }
+  connectedTo(atr, protocol, details, stopwatch) {
+    const card = new Card(this, atr, protocol);
+    if (details.uid !== undefined) {
+      card.uid = details.uid;
+      card.tag = details.tag;
+    }
+    const warmUp = this.options.warmUp;
+    if (!warmUp) {
+      return this.inserted(card, details);
+    }
+    warmUp
+      .run(card)
+      .catch((err) => {
+        logger.debug(`warm up failed`, err);
+        return null;
+      })
+      .then((result) => {
+        card.warmUp = result;
+        this.inserted(
+          card,
+          Object.assign(details, {
+            warmUp: result,
+            durationMs: stopwatch.elapsed(),
+          })
+        );
       });
-    };
+  }
 
-    reader.on('status', (status) => {
-      const changes = reader.state ^ status.state;
-      if (changes) {
-        if (isCardRemoved(changes, reader, status)) {
-          cardRemoved(reader);
-        } else if (isCardInserted(changes, reader, status)) {
-          cardInserted(reader, status);
-        }
+  inserted(card, details) {
+    if (this.closed) {
+      return;
+    }
+    if (this.stale(this.connected, this.connectedGeneration)) {
+      // removed or replaced while identifying or warming up
+      this.metrics.wastedConnects++;
+      return this.disconnect();
+    }
+    this.card = card;
+    this.transition(states.CONNECTED);
+    this.metrics.insertions++;
+    this.emit(
+      'card-inserted',
+      Object.assign({ device: this, card: this.card }, details)
+    );
+  }
+
+  disconnect() {
+    const card = this.card;
+    this.transition(states.REMOVING);
+    this.reader.disconnect(this.reader.SCARD_LEAVE_CARD, (err) => {
+      this.card = null;
+      this.connected = null;
+      this.connectedGeneration = -1;
+      this.transition(states.EMPTY);
+      if (err) {
+        this.emit('error', err);
+      }
+      if (card) {
+        this.metrics.removals++;
+        this.emit('card-removed', { name: this.name, card });
       }
+      this.reconcile();
     });
   }
 
+  // new handle to the same card after it was reset, the state stays
+  // connected; cb(err, protocol)
+  reconnect(cb) {
+    if (this.state !== states.CONNECTED || this.closed) {
+      return process.nextTick(() => cb(new Error('no card to reconnect')));
+    }
+    logger.debug(`reconnect ${this.name}`);
+    this.metrics.resets++;
+    this.recoveryStopwatch = Stopwatch.start();
+    this.reader.disconnect(this.reader.SCARD_LEAVE_CARD, () => {
+      this.reader.connect({ share_mode: 2 }, (err, protocol) => {
+        if (!err && this.state !== states.CONNECTED) {
+          err = new Error('card removed while reconnecting');
+        }
+        cb(err, protocol);
+      });
+    });
+  }
+
+  // the card's session is restored, or could not be
+  recovered(card, err) {
+    const durationMs = this.recoveryStopwatch.elapsed();
+    this.metrics.recoveryMs += durationMs;
+    if (err) {
+      this.metrics.failedRecoveries++;
+      logger.debug(`recovery failed`, err);
+      return;
+    }
+    this.metrics.recoveries++;
+    this.emit('card-recovered', { device: this, card, durationMs });
+  }
+
+  getMetrics() {
+    return Object.assign({}, this.metrics, { state: this.state });
+  }
+
+  // card-inserted and card-removed as an async iterable
+  events(options) {
+    return EventStream.forDevice(this, options);
+  }
+
   transmit(data, res_len, protocol, cb) {
+    if (this.closed) {
+      return process.nextTick(() => cb(new Error('device closed')));
+    }
+    if (!this.inFlight++ && !this.busy) {
+      this.busy = true;
+      this.emit('busy', { device: this });
+    }
+    const done = (err, response) => {
+      this.inFlight--;
+      if (!this.inFlight) {
+        const waiters = this.idleWaiters;
+        this.idleWaiters = [];
+        waiters.forEach((resolve) => resolve(true));
+      }
+      cb(err, response);
+      if (!this.inFlight) {
+        // a follow-up command chained from a callback or promise keeps the
+        // device busy
+        setImmediate(() => this.settle());
+      }
+    };
     try {
-      this.reader.transmit(data, res_len, protocol, cb);
+      this.reader.transmit(data, res_len, protocol, done);
     } catch (err) {
+      // a synchronous throw fails the command like an asynchronous error
       logger.warn(`transmit`, err);
+      process.nextTick(() => done(err));
+    }
+  }
+
+  settle() {
+    if (this.busy && !this.inFlight) {
+      this.busy = false;
+      this.emit('idle', { device: this });
     }
   }
 
+  // resolves with false if commands are still running after timeoutMs
+  drain(timeoutMs) {
+    if (!this.inFlight) {
+      return Promise.resolve(true);
+    }
+    return new Promise((resolve) => {
+      const timer = setTimeout(() => {
+        this.idleWaiters = this.idleWaiters.filter((w) => w !== waiter);
+        resolve(false);
+      }, timeoutMs);
+      const waiter = (drained) => {
+        clearTimeout(timer);
+        resolve(drained);
+      };
+      this.idleWaiters.push(waiter);
+    });
+  }
+
+  /*
+  Refuses new commands, optionally waits for the running ones, disconnects
+  the card and closes the reader handle, which also ends its status wait.
+  The device cannot be used afterwards.
+  */
+  close(options) {
+    const opts = options || {};
+    const stopwatch = Stopwatch.start();
+    if (this.closed) {
+      return Promise.resolve(null);
+    }
+    logger.debug(`close ${this.name}`);
+    this.closed = true;
+    this.wanted = null;
+    clearTimeout(this.debounceTimer);
+    this.debounceTimer = null;
+    this.reader.removeListener('status', this.statusListener);
+    const pending = this.inFlight;
+    const drained = opts.drain
+      ? this.drain(opts.timeoutMs === undefined ? 5000 : opts.timeoutMs)
+      : Promise.resolve(!pending);
+    return drained.then((idle) => {
+      const drainMs = stopwatch.elapsed();
+      const report = {
+        name: this.name,
+        pending,
+        abandoned: this.inFlight,
+        drained: idle,
+        drainMs,
+        disconnected: false,
+        durationMs: 0,
+      };
+      const release = () => {
+        try {
+          this.reader.close();
+        } catch (err) {
+          logger.debug(`close reader`, err);
+        }
+        report.durationMs = stopwatch.elapsed();
+        this.removeAllListeners();
+        return report;
+      };
+      if (this.state !== states.CONNECTED) {
+        // a connect still in flight is dropped when it returns
+        return release();
+      }
+      return new Promise((resolve) => {
+        this.once('card-removed', () => resolve());
+        this.disconnect();
+      }).then(() => {
+        report.disconnected = true;
+        return release();
+      });
+    });
+  }
+
   getName() {
     return this.name;
   }
@@ -80,4 +428,6 @@ class Device extends EventEmitter {
   }
 }
 
+Device.states = states;
+
 export default Device;
@@ -0,0 +1,177 @@
+'use strict';
+
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('DeviceRegistry');
+
+// device events that can change where a device is indexed
+const watched = ['card-inserted', 'card-removed', 'busy', 'idle'];
+
+// pcsclite appends the slot numbers to the reader model
+const readerType = (device) => device.name.replace(/(\s+\d+)+$/, '');
+
+// the warm-up profile, else the contactless tag type, else the ATR
+const cardProfile = (device, card) => {
+  if (card.warmUp && card.warmUp.profile) return card.warmUp.profile;
+  if (card.tag && card.tag.name) return card.tag.name;
+  return card.getAtr();
+};
+
+const flag = (value) => (value ? 1 : 0);
+
+// canonical index key, attributes always in this order; both values of the
+// flags are indexed, so { present: false } finds the empty readers
+const keyOf = (query) => {
+  const parts = [];
+  if (query.type !== undefined) parts.push(`type=${query.type}`);
+  if (query.present !== undefined) {
+    parts.push(`present=${flag(query.present)}`);
+  }
+  if (query.profile !== undefined) parts.push(`profile=${query.profile}`);
+  if (query.idle !== undefined) parts.push(`idle=${flag(query.idle)}`);
+  return parts.join('|');
+};
+
+// every key under which a device is found, one per subset of its attributes
+const keysOf = (attributes) => {
+  const names = Object.keys(attributes);
+  const keys = [];
+  for (let mask = 0; mask < 1 << names.length; mask++) {
+    const query = {};
+    names.forEach((name, i) => {
+      if (mask & (1 << i)) query[name] = attributes[name];
+    });
+    keys.push(keyOf(query));
+  }
+  return keys;
+};
+
+/*
+Indexes the devices of a Devices by reader type, card profile, card
+presence and idleness, updated on device and card events. A query for any
+combination of these is a single lookup of a live Set:
+
+  registry.select({ profile: 'piv', idle: true })
+  registry.subscribe({ type: 'ACS ACR122U' }, ({ device, added }) => ...)
+
+A device is idle while its card is connected and no command is running,
+busy ({ idle: false }) while one is; empty readers are neither.
+*/
+class DeviceRegistry {
+  constructor(devices, options) {
+    const opts = options || {};
+    this.devices = devices;
+    this.type = opts.type || readerType;
+    this.profile = opts.profile || cardProfile;
+    this.indexes = {};
+    this.entries = {};
+    this.subscribers = {};
+
+    this.activated = (event) => this.add(event.device);
+    this.deactivated = (event) => this.remove(event.device);
+    devices.on('device-activated', this.activated);
+    devices.on('device-deactivated', this.deactivated);
+    devices.listDevices().forEach((device) => this.add(device));
+  }
+
+  add(device) {
+    if (this.entries[device.name]) {
+      return;
+    }
+    logger.debug(`add ${device.name}`);
+    const update = () => this.update(device);
+    const entry = {
+      device,
+      type: this.type(device),
+      keys: [],
+      detach: () =>
+        watched.forEach((event) => device.removeListener(event, update)),
+    };
+    this.entries[device.name] = entry;
+    watched.forEach((event) => device.on(event, update));
+    this.update(device);
+  }
+
+  remove(device) {
+    const entry = this.entries[device.name];
+    if (!entry) {
+      return;
+    }
+    logger.debug(`remove ${device.name}`);
+    entry.detach();
+    this.reindex(entry, []);
+    delete this.entries[device.name];
+  }
+
+  update(device) {
+    const entry = this.entries[device.name];
+    const attributes = { type: entry.type, present: !!device.card };
+    if (device.card) {
+      attributes.profile = this.profile(device, device.card);
+      attributes.idle = !device.busy;
+    }
+    this.reindex(entry, keysOf(attributes));
+  }
+
+  // moves the entry from the sets of its old keys to those of the new ones
+  reindex(entry, keys) {
+    const device = entry.device;
+    const next = new Set(keys);
+    entry.keys.forEach((key) => {
+      if (next.has(key)) return;
+      this.indexes[key].delete(device);
+      this.notify(key, device, false);
+    });
+    const previous = new Set(entry.keys);
+    keys.forEach((key) => {
+      if (previous.has(key)) return;
+      (this.indexes[key] = this.indexes[key] || new Set()).add(device);
+      this.notify(key, device, true);
+    });
+    entry.keys = keys;
+  }
+
+  notify(key, device, added) {
+    const subscribers = this.subscribers[key];
+    if (subscribers) {
+      subscribers.slice().forEach((cb) => cb({ device, added }));
+    }
+  }
+
+  // live Set of the matching devices, not to be modified
+  select(query) {
+    const key = keyOf(query || {});
+    return (this.indexes[key] = this.indexes[key] || new Set());
+  }
+
+  first(query) {
+    const set = this.indexes[keyOf(query || {})];
+    return set ? set.values().next().value : undefined;
+  }
+
+  count(query) {
+    return this.select(query).size;
+  }
+
+  // cb({ device, added }) when a device enters or leaves the query's set,
+  // returns a function ending the subscription
+  subscribe(query, cb) {
+    const key = keyOf(query || {});
+    (this.subscribers[key] = this.subscribers[key] || []).push(cb);
+    return () => {
+      const subscribers = this.subscribers[key] || [];
+      this.subscribers[key] = subscribers.filter((s) => s !== cb);
+      if (!this.subscribers[key].length) delete this.subscribers[key];
+    };
+  }
+
+  close() {
+    this.devices.removeListener('device-activated', this.activated);
+    this.devices.removeListener('device-deactivated', this.deactivated);
+    Object.keys(this.entries).forEach((name) => this.entries[name].detach());
+    this.entries = {};
+    this.indexes = {};
+    this.subscribers = {};
+  }
+}
+
+module.exports = DeviceRegistry;
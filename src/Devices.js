@@ -1,57 +1,173 @@
 'use strict';
 
-import pino from 'pino';
-
-const pcsclite = require('@pokusew/pcsclite');
+import lazyLogger from './lazyLogger';
 import { EventEmitter } from 'events';
 import Device from './Device';
-const logger = pino({ name: 'Devices' });
+import EventStream from './EventStream';
+import Stopwatch from './Stopwatch';
+import RetryPolicy from './RetryPolicy';
+import WarmUp from './WarmUp';
+const logger = lazyLogger('Devices');
 
 class Devices extends EventEmitter {
-  constructor() {
+  constructor(options) {
     super();
     logger.debug(`new Devices()`);
-    this.pcsc = pcsclite();
+    // warm-up scripts and the retry policy are shared by all devices
+    this.options = Object.assign({}, options);
+    this.options.warmUp = WarmUp.from(this.options.warmUp);
+    this.options.retry = RetryPolicy.from(this.options.retry);
+    this.pcsc = null;
     this.devices = {};
+    this.endHandlers = {};
+    this.stopped = false;
+    this.closed = false;
+
+    // the PC/SC context is created when someone first listens or asks
+    this.on('newListener', (event) => {
+      if (event === 'device-activated' || event === 'device-deactivated') {
+        this.ensureStarted();
+      }
+    });
+  }
+
+  ensureStarted() {
+    if (
+      !this.pcsc &&
+      !this.stopped &&
+      !this.closed &&
+      this.options.autoStart !== false
+    ) {
+      this.start();
+    }
+  }
+
+  start() {
+    if (this.pcsc) {
+      return this;
+    }
+    if (this.closed) {
+      throw new Error('devices closed');
+    }
+    logger.debug(`start`);
+    this.stopped = false;
+    const pcsclite = require('@pokusew/pcsclite');
+    this.pcsc = pcsclite();
 
     this.pcsc.on('reader', (reader) => {
-      const device = new Device(reader);
+      const device = new Device(reader, this.options);
       this.devices[reader.name] = device;
       this.emit('device-activated', { device, devices: this.listDevices() });
-      reader.on('end', () => {
-        delete this.devices[reader.name];
-        this.emit('device-deactivated', {
-          device,
-          devices: this.listDevices(),
-        });
-      });
+      const end = () => this.deactivate(reader.name);
+      this.endHandlers[reader.name] = end;
+      reader.on('end', end);
       reader.on('error', (error) => {
-        this.emit('error', { reader, error });
+        if (!this.closed) {
+          this.emit('error', { reader, error });
+        }
       });
     });
 
     this.pcsc.on('error', (error) => {
       this.emit('error', { error });
     });
+    return this;
+  }
+
+  deactivate(name) {
+    const device = this.devices[name];
+    if (!device) {
+      return;
+    }
+    device.reader.removeListener('end', this.endHandlers[name]);
+    delete this.endHandlers[name];
+    delete this.devices[name];
+    const devices = Object.keys(this.devices).map((k) => this.devices[k]);
+    this.emit('device-deactivated', { device, devices });
+  }
+
+  // closes the readers and the PC/SC context, start() opens a new one
+  stop() {
+    if (!this.pcsc) {
+      return this;
+    }
+    logger.debug(`stop`);
+    const pcsc = this.pcsc;
+    this.pcsc = null;
+    this.stopped = true;
+    Object.keys(this.devices).forEach((name) => {
+      const reader = this.devices[name].reader;
+      this.deactivate(name);
+      reader.close();
+    });
+    pcsc.close();
+    return this;
+  }
+
+  /*
+  Shuts down for good: every device refuses new commands, waits for the
+  running ones when draining, disconnects its card and closes its reader,
+  then the PC/SC context is released and all listeners are removed.
+  Resolves with the time spent draining and a report per reader.
+  */
+  close(options) {
+    const opts = options || {};
+    const stopwatch = Stopwatch.start();
+    if (this.closed) {
+      return Promise.resolve(null);
+    }
+    logger.debug(`close`);
+    this.closed = true;
+    this.stopped = true;
+    const pcsc = this.pcsc;
+    this.pcsc = null;
+    const names = Object.keys(this.devices);
+    return Promise.all(
+      names.map((name) => this.devices[name].close(opts))
+    ).then((reports) => {
+      // a device closed on its own earlier has no report
+      const readers = reports.filter((report) => report);
+      names.forEach((name) => this.deactivate(name));
+      if (pcsc) {
+        pcsc.removeAllListeners();
+        pcsc.close();
+      }
+      this.removeAllListeners();
+      return {
+        drainMs: readers.reduce((max, r) => Math.max(max, r.drainMs), 0),
+        drained: readers.every((r) => r.drained),
+        abandoned: readers.reduce((sum, r) => sum + r.abandoned, 0),
+        durationMs: stopwatch.elapsed(),
+        readers,
+      };
+    });
   }
 
   onActivated() {
     return new Promise((resolve, reject) => {
-      this.on('device-activated', (event) => resolve(event));
+      this.once('device-activated', (event) => resolve(event));
     });
   }
 
   onDeactivated() {
     return new Promise((resolve, reject) => {
-      this.on('device-deactivated', (event) => resolve(event));
+      this.once('device-deactivated', (event) => resolve(event));
     });
   }
 
+  // device and card events of all readers as an async iterable
+  events(options) {
+    return EventStream.forDevices(this, options);
+  }
+
+  // the devices known so far, empty until PC/SC is started; does not start
+  // it, so logging a Devices stays side effect free
   listDevices() {
     return Object.keys(this.devices).map((k) => this.devices[k]);
   }
 
   lookup(name) {
+    this.ensureStarted();
     return this.devices[name];
   }
 
@@ -0,0 +1,305 @@
+'use strict';
+
+import Stopwatch from './Stopwatch';
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('DiffWriter');
+
+const ins = {
+  APPEND_RECORD: 0xe2,
+  READ_BINARY: 0xb0,
+  READ_RECORD: 0xb2,
+  SELECT_FILE: 0xa4,
+  UPDATE_BINARY: 0xd6,
+  UPDATE_RECORD: 0xdc,
+};
+
+const MAX_OFFSET = 0x7fff;
+
+const statusWord = (response) => response.readUInt16BE(response.length - 2);
+
+const check = (response, what) => {
+  const sw = statusWord(response);
+  if (sw !== 0x9000) {
+    throw new Error(`${what} failed '${sw.toString(16)}'`);
+  }
+  return response.subarray(0, response.length - 2);
+};
+
+// changed byte ranges [start, end), runs closer than gap are merged
+const changedRanges = (current, data, gap) => {
+  const ranges = [];
+  let i = 0;
+  while (i < data.length) {
+    if (i < current.length && current[i] === data[i]) {
+      i++;
+      continue;
+    }
+    const start = i;
+    while (
+      i < data.length &&
+      (i >= current.length || current[i] !== data[i])
+    ) {
+      i++;
+    }
+    const last = ranges[ranges.length - 1];
+    if (last && start - last[1] <= gap) {
+      last[1] = i;
+    } else {
+      ranges.push([start, i]);
+    }
+  }
+  return ranges;
+};
+
+/*
+Writes only what changed. The current content comes from the card, or from
+the image kept after the last write under the same key, and is compared
+with the new content: changed bytes of a transparent EF go out as UPDATE
+BINARY chunks no larger than the card accepts, changed records of a record
+file as UPDATE RECORD, new ones as APPEND RECORD.
+*/
+class DiffWriter {
+  constructor(application, options) {
+    const opts = options || {};
+    this.application = application;
+    this.maxWrite = opts.maxWrite || 0xff;
+    this.maxRead = opts.maxRead || 0x100;
+    // unchanged bytes worth rewriting to save a command
+    this.mergeGap = opts.mergeGap === undefined ? 4 : opts.mergeGap;
+    // kept apart, so a key used for both kinds of file cannot mix them
+    this.binaryImages = new Map();
+    this.recordImages = new Map();
+  }
+
+  send(command, what) {
+    return this.application
+      .exchange(Buffer.from(command))
+      .then((response) => check(response, what));
+  }
+
+  select(fileId) {
+    if (fileId === undefined) {
+      return Promise.resolve();
+    }
+    const fid = [(fileId >> 8) & 0xff, fileId & 0xff];
+    return this.send(
+      [0x00, ins.SELECT_FILE, 0x00, 0x0c, 0x02].concat(fid),
+      `SELECT ${fileId.toString(16)}`
+    );
+  }
+
+  readBinary(offset, length) {
+    const content = [];
+    const next = (position) => {
+      if (position >= offset + length) {
+        return Buffer.concat(content);
+      }
+      const size = Math.min(this.maxRead, offset + length - position);
+      const command = [
+        0x00,
+        ins.READ_BINARY,
+        (position >> 8) & 0x7f,
+        position & 0xff,
+        size & 0xff,
+      ];
+      return this.application.exchange(Buffer.from(command)).then((r) => {
+        const sw = statusWord(r);
+        // end of file reached, the rest counts as changed
+        if (sw === 0x6b00 || sw === 0x6282) {
+          content.push(r.subarray(0, r.length - 2));
+          return Buffer.concat(content);
+        }
+        const data = check(r, `READ BINARY ${position}`);
+        content.push(data);
+        return data.length
+          ? next(position + data.length)
+          : Buffer.concat(content);
+      });
+    };
+    return next(offset);
+  }
+
+  /*
+  Brings a transparent EF to `data`, starting at `offset`. With `key` the
+  written content is remembered, and the next write under that key skips
+  reading the card.
+  */
+  writeBinary(data, options) {
+    const opts = options || {};
+    const stopwatch = Stopwatch.start();
+    const offset = opts.offset || 0;
+    const target = Buffer.from(data);
+    if (offset + target.length - 1 > MAX_OFFSET) {
+      return Promise.reject(new Error(`offset beyond ${MAX_OFFSET}`));
+    }
+    const report = {
+      written: 0,
+      skipped: 0,
+      readBytes: 0,
+      commands: 0,
+      durationMs: 0,
+    };
+    const cached = opts.key !== undefined && this.binaryImages.get(opts.key);
+    return this.select(opts.fileId)
+      .then(() => {
+        if (cached) {
+          return cached.subarray(offset, offset + target.length);
+        }
+        return this.readBinary(offset, target.length).then((current) => {
+          report.readBytes = current.length;
+          return current;
+        });
+      })
+      .then((current) => {
+        const chunks = [];
+        changedRanges(current, target, this.mergeGap).forEach(([s, e]) => {
+          for (let start = s; start < e; start += this.maxWrite) {
+            chunks.push([start, Math.min(e, start + this.maxWrite)]);
+          }
+        });
+        return chunks.reduce(
+          (chain, [start, end]) =>
+            chain.then(() => {
+              const position = offset + start;
+              const bytes = target.subarray(start, end);
+              report.commands++;
+              report.written += bytes.length;
+              return this.send(
+                Buffer.concat([
+                  Buffer.from([
+                    0x00,
+                    ins.UPDATE_BINARY,
+                    (position >> 8) & 0x7f,
+                    position & 0xff,
+                    bytes.length,
+                  ]),
+                  bytes,
+                ]),
+                `UPDATE BINARY ${position}`
+              );
+            }),
+          Promise.resolve()
+        );
+      })
+      .then(() => {
+        if (opts.key !== undefined) {
+          this.remember(opts.key, offset, target);
+        }
+        report.skipped = target.length - report.written;
+        report.durationMs = stopwatch.elapsed();
+        logger.debug(`wrote ${report.written}, skipped ${report.skipped}`);
+        return report;
+      })
+      .catch((err) => this.failed(opts.key, err));
+  }
+
+  // after a partial write the image no longer says what the card holds
+  failed(key, err) {
+    if (key !== undefined) {
+      this.forget(key);
+    }
+    throw err;
+  }
+
+  remember(key, offset, data) {
+    const previous = this.binaryImages.get(key) || Buffer.alloc(0);
+    const length = Math.max(previous.length, offset + data.length);
+    const image = Buffer.alloc(length);
+    previous.copy(image);
+    data.copy(image, offset);
+    this.binaryImages.set(key, image);
+  }
+
+  forget(key) {
+    if (key === undefined) {
+      this.binaryImages.clear();
+      this.recordImages.clear();
+    } else {
+      this.binaryImages.delete(key);
+      this.recordImages.delete(key);
+    }
+  }
+
+  // records of the current EF, or of the one with the short file identifier
+  readRecords(sfi) {
+    const records = [];
+    const p2 = sfi ? (sfi << 3) | 4 : 0x04;
+    const next = (number) =>
+      this.application
+        .exchange(Buffer.from([0x00, ins.READ_RECORD, number, p2, 0x00]))
+        .then((response) => {
+          const sw = statusWord(response);
+          if (sw === 0x6a83 || sw === 0x6a82) {
+            return records;
+          }
+          records.push(check(response, `READ RECORD ${number}`));
+          return number < 0xfe ? next(number + 1) : records;
+        });
+    return next(1);
+  }
+
+  /*
+  Brings a record file to `records`, an Array of Buffers for records 1, 2,
+  and so on. Changed records are updated, missing ones appended; records
+  beyond the new list are left alone.
+  */
+  writeRecords(records, options) {
+    const opts = options || {};
+    const stopwatch = Stopwatch.start();
+    const sfi = opts.sfi || 0;
+    const p2 = sfi ? (sfi << 3) | 4 : 0x04;
+    const report = {
+      written: 0,
+      skipped: 0,
+      updated: 0,
+      appended: 0,
+      unchanged: 0,
+      commands: 0,
+      durationMs: 0,
+    };
+    const cached = opts.key !== undefined && this.recordImages.get(opts.key);
+    return this.select(opts.fileId)
+      .then(() => cached || this.readRecords(sfi))
+      .then((current) =>
+        records.reduce(
+          (chain, record, i) =>
+            chain.then(() => {
+              const data = Buffer.from(record);
+              if (i < current.length && current[i].equals(data)) {
+                report.unchanged++;
+                report.skipped += data.length;
+                return;
+              }
+              const append = i >= current.length;
+              const header = append
+                ? [0x00, ins.APPEND_RECORD, 0x00, sfi << 3, data.length]
+                : [0x00, ins.UPDATE_RECORD, i + 1, p2, data.length];
+              report.commands++;
+              report.written += data.length;
+              report[append ? 'appended' : 'updated']++;
+              return this.send(
+                Buffer.concat([Buffer.from(header), data]),
+                `${append ? 'APPEND' : 'UPDATE'} RECORD ${i + 1}`
+              );
+            }),
+          Promise.resolve()
+        ).then(() => current)
+      )
+      .then((current) => {
+        if (opts.key !== undefined) {
+          const image = records.map((record) => Buffer.from(record));
+          this.recordImages.set(
+            opts.key,
+            image.concat(current.slice(image.length))
+          );
+        }
+        report.durationMs = stopwatch.elapsed();
+        return report;
+      })
+      .catch((err) => this.failed(opts.key, err));
+  }
+}
+
+DiffWriter.changedRanges = changedRanges;
+
+module.exports = DiffWriter;
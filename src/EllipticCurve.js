@@ -0,0 +1,184 @@
+'use strict';
+
+import crypto from 'crypto';
+import Tlv from './Tlv';
+
+const curves = {};
+
+const toBigInt = (buffer) =>
+  buffer.length ? BigInt('0x' + buffer.toString('hex')) : BigInt(0);
+
+const toBuffer = (value, length) =>
+  Buffer.from(value.toString(16).padStart(length * 2, '0'), 'hex');
+
+const mod = (a, m) => {
+  const r = a % m;
+  return r < 0 ? r + m : r;
+};
+
+const modPow = (base, exponent, m) => {
+  let result = BigInt(1);
+  base = mod(base, m);
+  while (exponent > 0) {
+    if (exponent & BigInt(1)) result = (result * base) % m;
+    base = (base * base) % m;
+    exponent >>= BigInt(1);
+  }
+  return result;
+};
+
+/*
+Prime field curve arithmetic for protocols that need more than the ECDH
+offered by node, e.g. the PACE generic mapping (G' = s * G + H).
+Points are affine { x, y } outside this class, Jacobian inside.
+*/
+class EllipticCurve {
+  constructor(name, params) {
+    this.name = name;
+    this.p = params.p;
+    this.a = params.a;
+    this.b = params.b;
+    this.n = params.n;
+    this.size = Math.ceil(this.p.toString(16).length / 2);
+    this.G = this.decodePoint(params.g);
+  }
+
+  // domain parameters come from OpenSSL via an explicit SPKI export
+  static named(name) {
+    if (!curves[name]) {
+      const { publicKey } = crypto.generateKeyPairSync('ec', {
+        namedCurve: name,
+        paramEncoding: 'explicit',
+        publicKeyEncoding: { type: 'spki', format: 'der' },
+        privateKeyEncoding: { type: 'sec1', format: 'der' },
+      });
+      const spki = Tlv.parse(publicKey)[0];
+      const ecParameters = spki.children[0].children[1].children;
+      const fieldId = ecParameters[1].children;
+      const curve = ecParameters[2].children;
+      curves[name] = new EllipticCurve(name, {
+        p: toBigInt(fieldId[1].value),
+        a: toBigInt(curve[0].value),
+        b: toBigInt(curve[1].value),
+        g: ecParameters[3].value,
+        n: toBigInt(ecParameters[4].value),
+      });
+    }
+    return curves[name];
+  }
+
+  decodePoint(buffer) {
+    if (buffer[0] !== 0x04) {
+      throw new Error('only uncompressed points are supported');
+    }
+    const size = (buffer.length - 1) / 2;
+    return {
+      x: toBigInt(buffer.subarray(1, 1 + size)),
+      y: toBigInt(buffer.subarray(1 + size)),
+    };
+  }
+
+  encodePoint(point) {
+    return Buffer.concat([
+      Buffer.from([0x04]),
+      toBuffer(point.x, this.size),
+      toBuffer(point.y, this.size),
+    ]);
+  }
+
+  encodeCoordinate(value) {
+    return toBuffer(value, this.size);
+  }
+
+  isOnCurve(point) {
+    const { x, y } = point;
+    return mod(y * y - (x * x * x + this.a * x + this.b), this.p) === BigInt(0);
+  }
+
+  randomScalar() {
+    let k;
+    do {
+      k = mod(toBigInt(crypto.randomBytes(this.size + 8)), this.n);
+    } while (k === BigInt(0));
+    return k;
+  }
+
+  toJacobian(point) {
+    return point ? [point.x, point.y, BigInt(1)] : null;
+  }
+
+  toAffine(jacobian) {
+    if (!jacobian) return null;
+    const [x, y, z] = jacobian;
+    const zInv = modPow(z, this.p - BigInt(2), this.p);
+    const zInv2 = (zInv * zInv) % this.p;
+    return {
+      x: mod(x * zInv2, this.p),
+      y: mod(y * zInv2 * zInv, this.p),
+    };
+  }
+
+  jacobianDouble(point) {
+    if (!point) return null;
+    const [x, y, z] = point;
+    const p = this.p;
+    if (y === BigInt(0)) return null;
+    const y2 = (y * y) % p;
+    const s = (BigInt(4) * x * y2) % p;
+    const z2 = (z * z) % p;
+    const m = mod(BigInt(3) * x * x + this.a * z2 * z2, p);
+    const x3 = mod(m * m - BigInt(2) * s, p);
+    const y3 = mod(m * (s - x3) - BigInt(8) * y2 * y2, p);
+    const z3 = (BigInt(2) * y * z) % p;
+    return [x3, y3, z3];
+  }
+
+  jacobianAdd(a, b) {
+    if (!a) return b;
+    if (!b) return a;
+    const p = this.p;
+    const [x1, y1, z1] = a;
+    const [x2, y2, z2] = b;
+    const z1z1 = (z1 * z1) % p;
+    const z2z2 = (z2 * z2) % p;
+    const u1 = (x1 * z2z2) % p;
+    const u2 = (x2 * z1z1) % p;
+    const s1 = (y1 * z2 * z2z2) % p;
+    const s2 = (y2 * z1 * z1z1) % p;
+    if (u1 === u2) {
+      return s1 === s2 ? this.jacobianDouble(a) : null;
+    }
+    const h = mod(u2 - u1, p);
+    const r = mod(s2 - s1, p);
+    const h2 = (h * h) % p;
+    const h3 = (h2 * h) % p;
+    const u1h2 = (u1 * h2) % p;
+    const x3 = mod(r * r - h3 - BigInt(2) * u1h2, p);
+    const y3 = mod(r * (u1h2 - x3) - s1 * h3, p);
+    const z3 = (h * z1 * z2) % p;
+    return [x3, y3, z3];
+  }
+
+  add(a, b) {
+    const sum = this.jacobianAdd(this.toJacobian(a), this.toJacobian(b));
+    return this.toAffine(sum);
+  }
+
+  multiply(k, point) {
+    const base = this.toJacobian(point || this.G);
+    let result = null;
+    const bits = mod(k, this.n).toString(2);
+    for (let i = 0; i < bits.length; i++) {
+      result = this.jacobianDouble(result);
+      if (bits[i] === '1') {
+        result = this.jacobianAdd(result, base);
+      }
+    }
+    return this.toAffine(result);
+  }
+}
+
+EllipticCurve.toBigInt = toBigInt;
+EllipticCurve.toBuffer = toBuffer;
+
+export default EllipticCurve;
@@ -0,0 +1,634 @@
+'use strict';
+
+import crypto from 'crypto';
+import { Readable } from 'stream';
+import Atr from './Atr';
+import CardCrypto from './CardCrypto';
+import CommandApdu from './CommandApdu';
+import EllipticCurve from './EllipticCurve';
+import Iso7816Application from './Iso7816Application';
+import ResponseApdu from './ResponseApdu';
+import SecureMessaging from './SecureMessaging';
+import Stopwatch from './Stopwatch';
+import Tlv from './Tlv';
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('EmrtdApplication');
+
+const AID = [0xa0, 0x00, 0x00, 0x02, 0x47, 0x10, 0x01];
+
+const ins = {
+  EXTERNAL_AUTHENTICATE: 0x82,
+  GENERAL_AUTHENTICATE: 0x86,
+  GET_CHALLENGE: 0x84,
+  MSE: 0x22,
+  READ_BINARY: 0xb0,
+  READ_BINARY_ODD: 0xb1,
+  SELECT_FILE: 0xa4,
+};
+
+const sfi = {
+  ATR_INFO: 0x01,
+  CARD_ACCESS: 0x1c,
+  SOD: 0x1d,
+  COM: 0x1e,
+};
+
+const dataGroupTags = {
+  0x61: 1,
+  0x75: 2,
+  0x63: 3,
+  0x76: 4,
+  0x65: 5,
+  0x66: 6,
+  0x67: 7,
+  0x68: 8,
+  0x69: 9,
+  0x6a: 10,
+  0x6b: 11,
+  0x6c: 12,
+  0x6d: 13,
+  0x6e: 14,
+  0x6f: 15,
+  0x70: 16,
+};
+
+// BSI TR-03110 standardized domain parameters
+const domainParameters = {
+  12: 'prime256v1',
+  13: 'brainpoolP256r1',
+  14: 'brainpoolP320r1',
+  15: 'secp384r1',
+  16: 'brainpoolP384r1',
+  17: 'brainpoolP512r1',
+  18: 'secp521r1',
+};
+
+// id-PACE-ECDH-GM-*, 0.4.0.127.0.7.2.2.4.2.x
+const PACE_ECDH_GM = Buffer.from('04007f000702020402', 'hex');
+const paceCiphers = {
+  1: { cipher: '3des', keyLength: 16 },
+  2: { cipher: 'aes', keyLength: 16 },
+  3: { cipher: 'aes', keyLength: 24 },
+  4: { cipher: 'aes', keyLength: 32 },
+};
+
+const SHORT_CHUNK = 0xdf;
+
+const checkDigit = (value) => {
+  const weights = [7, 3, 1];
+  let sum = 0;
+  for (let i = 0; i < value.length; i++) {
+    const c = value.charCodeAt(i);
+    let v = 0;
+    if (c >= 0x30 && c <= 0x39) v = c - 0x30;
+    else if (c >= 0x41 && c <= 0x5a) v = c - 0x41 + 10;
+    sum += v * weights[i % 3];
+  }
+  return String(sum % 10);
+};
+
+const mrzInformation = (mrz) => {
+  const documentNumber = mrz.documentNumber.toUpperCase().padEnd(9, '<');
+  return (
+    documentNumber +
+    checkDigit(documentNumber) +
+    mrz.dateOfBirth +
+    checkDigit(mrz.dateOfBirth) +
+    mrz.dateOfExpiry +
+    checkDigit(mrz.dateOfExpiry)
+  );
+};
+
+const plainCommand = (command) => {
+  const bytes = [command.cla, command.ins, command.p1, command.p2];
+  const extended =
+    command.le > 256 || (command.data && command.data.length > 255);
+  if (command.data && command.data.length) {
+    const lc = command.data.length;
+    if (extended) bytes.push(0x00, (lc >> 8) & 0xff, lc & 0xff);
+    else bytes.push(lc);
+    bytes.push(...command.data);
+  }
+  if (command.le !== undefined) {
+    if (extended && !(command.data && command.data.length)) bytes.push(0x00);
+    if (extended) bytes.push((command.le >> 8) & 0xff);
+    bytes.push(command.le & 0xff);
+  }
+  return { bytes, extended };
+};
+
+const headerLength = (buffer) => {
+  let offset = (buffer[0] & 0x1f) === 0x1f ? 2 : 1;
+  const length = buffer[offset];
+  if (length & 0x80) {
+    const count = length & 0x7f;
+    let value = 0;
+    for (let i = 0; i < count; i++) {
+      value = value * 256 + buffer[offset + 1 + i];
+    }
+    return { header: offset + 1 + count, length: value };
+  }
+  return { header: offset + 1, length };
+};
+
+class EmrtdApplication extends Iso7816Application {
+  constructor(card, options) {
+    super(card);
+    this.options = options || {};
+    this.secureMessaging = null;
+    this.limits = null;
+    this.atr = Atr.parse(card.atr || '');
+  }
+
+  transmit(command) {
+    let wrapped;
+    try {
+      wrapped = this.secureMessaging
+        ? this.secureMessaging.wrap(command)
+        : plainCommand(command);
+    } catch (err) {
+      return Promise.reject(err);
+    }
+    const apdu = new CommandApdu({
+      bytes: Array.from(wrapped.bytes),
+      extended: wrapped.extended,
+    });
+    return this.exchange(apdu).then((response) => {
+      if (!this.secureMessaging) {
+        return new ResponseApdu(response);
+      }
+      // a plain error status ends the secure messaging session
+      if (response.length === 2 && response[0] !== 0x90) {
+        logger.debug(`secure messaging ended by card`);
+        this.secureMessaging = null;
+        return new ResponseApdu(response);
+      }
+      return new ResponseApdu(this.secureMessaging.unwrap(response));
+    });
+  }
+
+  issueCommand(commandApdu) {
+    if (!this.secureMessaging) {
+      return super.issueCommand(commandApdu);
+    }
+    return this.transmit(SecureMessaging.parseCommand(commandApdu.toBuffer()));
+  }
+
+  select() {
+    logger.debug(`select`);
+    return this.transmit({
+      cla: 0x00,
+      ins: ins.SELECT_FILE,
+      p1: 0x04,
+      p2: 0x0c,
+      data: AID,
+    }).then((response) => {
+      if (response.isOk()) {
+        this.emit('application-selected', {
+          application: Buffer.from(AID).toString('hex'),
+        });
+      }
+      return response;
+    });
+  }
+
+  readPlain(shortFileIdentifier) {
+    return this.transmit({
+      cla: 0x00,
+      ins: ins.READ_BINARY,
+      p1: 0x80 | shortFileIdentifier,
+      p2: 0x00,
+      le: 256,
+    }).then((response) => {
+      const sw = response.getStatusCode();
+      return sw === '9000' || sw === '6282'
+        ? Buffer.from(response.getDataOnly(), 'hex')
+        : null;
+    });
+  }
+
+  readAtrInfo() {
+    return this.readPlain(sfi.ATR_INFO).then((data) => {
+      this.limits = this.resolveLimits(data ? Tlv.parse(data) : []);
+      return this.limits;
+    });
+  }
+
+  resolveLimits(atrInfo) {
+    const options = this.options;
+    const capabilities = this.atr.getCapabilities();
+    const cardCapabilities = Tlv.find(atrInfo, 0x47);
+    let extended = capabilities.extendedLength;
+    if (cardCapabilities && cardCapabilities.value.length >= 3) {
+      extended = (cardCapabilities.value[2] & 0x40) === 0x40;
+    }
+    let maxResponseLength = options.maxResponseLength || 0x0800;
+    const lengthInfo = Tlv.find(atrInfo, 0x7f66);
+    if (lengthInfo && lengthInfo.children) {
+      const values = lengthInfo.children.filter((node) => node.tag === 0x02);
+      if (values.length >= 2) {
+        extended = true;
+        maxResponseLength = Math.min(
+          maxResponseLength,
+          values[1].value.readUInt16BE(0)
+        );
+      }
+    }
+    if (options.extendedLength !== undefined) {
+      extended = options.extendedLength;
+    }
+    return { extended, maxResponseLength };
+  }
+
+  // largest plain chunk whose SM-wrapped response still fits
+  chunkSize() {
+    const limits = this.limits || this.resolveLimits([]);
+    if (!limits.extended) {
+      return SHORT_CHUNK;
+    }
+    const blockSize = this.secureMessaging
+      ? this.secureMessaging.blockSize
+      : 8;
+    // SW, DO'8E', DO'99', DO'87' header and padding indicator
+    const available = limits.maxResponseLength - 2 - 10 - 4 - 4 - 1;
+    return Math.max(
+      SHORT_CHUNK,
+      Math.floor(available / blockSize) * blockSize - 1
+    );
+  }
+
+  readCardAccess() {
+    return this.readPlain(sfi.CARD_ACCESS).then((data) => {
+      if (!data) {
+        return [];
+      }
+      return Tlv.findAll(Tlv.parse(data), 0x30)
+        .map((info) => {
+          const children = info.children || [];
+          const oid = children[0] && children[0].value;
+          const supported =
+            oid &&
+            children[0].tag === 0x06 &&
+            oid.length === 10 &&
+            oid.subarray(0, 9).equals(PACE_ECDH_GM);
+          if (!supported) {
+            return null;
+          }
+          const parameterId = children[2] && children[2].value[0];
+          return {
+            oid,
+            cipher: paceCiphers[oid[9]],
+            parameterId,
+            curve: domainParameters[parameterId],
+          };
+        })
+        .filter((info) => info && info.cipher && info.curve);
+    });
+  }
+
+  doBac(mrz) {
+    logger.debug(`doBac`);
+    const seed = crypto
+      .createHash('sha1')
+      .update(mrzInformation(mrz))
+      .digest()
+      .subarray(0, 16);
+    const kEnc = CardCrypto.kdf(seed, 1, '3des');
+    const kMac = CardCrypto.kdf(seed, 2, '3des');
+    const rndIfd = crypto.randomBytes(8);
+    const kIfd = crypto.randomBytes(16);
+    let rndIc;
+    this.secureMessaging = null;
+    return this.transmit({
+      cla: 0x00,
+      ins: ins.GET_CHALLENGE,
+      p1: 0x00,
+      p2: 0x00,
+      le: 8,
+    })
+      .then((response) => {
+        if (!response.isOk()) {
+          throw new Error(`GET CHALLENGE failed '${response.getStatusCode()}'`);
+        }
+        rndIc = Buffer.from(response.getDataOnly(), 'hex');
+        const eIfd = CardCrypto.tdesEncrypt(
+          kEnc,
+          Buffer.concat([rndIfd, rndIc, kIfd])
+        );
+        const mIfd = CardCrypto.retailMac(kMac, eIfd);
+        return this.transmit({
+          cla: 0x00,
+          ins: ins.EXTERNAL_AUTHENTICATE,
+          p1: 0x00,
+          p2: 0x00,
+          data: Array.from(Buffer.concat([eIfd, mIfd])),
+          le: 40,
+        });
+      })
+      .then((response) => {
+        if (!response.isOk()) {
+          throw new Error(
+            `EXTERNAL AUTHENTICATE failed '${response.getStatusCode()}'`
+          );
+        }
+        const data = Buffer.from(response.getDataOnly(), 'hex');
+        const eIc = data.subarray(0, 32);
+        if (!CardCrypto.retailMac(kMac, eIc).equals(data.subarray(32, 40))) {
+          throw new Error('BAC response MAC verification failed');
+        }
+        const r = CardCrypto.tdesDecrypt(kEnc, eIc);
+        if (!r.subarray(8, 16).equals(rndIfd)) {
+          throw new Error('BAC response does not match challenge');
+        }
+        const seed = CardCrypto.xor(kIfd, r.subarray(16, 32));
+        this.secureMessaging = new SecureMessaging({
+          cipher: '3des',
+          encKey: CardCrypto.kdf(seed, 1, '3des'),
+          macKey: CardCrypto.kdf(seed, 2, '3des'),
+          ssc: Buffer.concat([rndIc.subarray(4, 8), rndIfd.subarray(4, 8)]),
+        });
+        logger.debug(`BAC established`);
+        this.emit('access-control-established', { protocol: 'BAC' });
+      });
+  }
+
+  generalAuthenticate(tag, data, last) {
+    const body = Tlv.encode(0x7c, data ? Tlv.encode(tag, data) : []);
+    return this.transmit({
+      cla: last ? 0x00 : 0x10,
+      ins: ins.GENERAL_AUTHENTICATE,
+      p1: 0x00,
+      p2: 0x00,
+      data: Array.from(body),
+      le: 256,
+    }).then((response) => {
+      if (!response.isOk()) {
+        throw new Error(
+          `GENERAL AUTHENTICATE failed '${response.getStatusCode()}'`
+        );
+      }
+      return Tlv.parse(Buffer.from(response.getDataOnly(), 'hex'))[0];
+    });
+  }
+
+  doPace(password, info) {
+    logger.debug(`doPace, ${info.curve}`);
+    const { cipher, keyLength } = info.cipher;
+    const curve = EllipticCurve.named(info.curve);
+    const secret =
+      password.can !== undefined
+        ? Buffer.from(String(password.can), 'latin1')
+        : crypto.createHash('sha1').update(mrzInformation(password)).digest();
+    const kPi = CardCrypto.kdf(secret, 3, cipher, keyLength);
+    const mac = (key, data) =>
+      cipher === 'aes'
+        ? CardCrypto.aesCmac(key, data).subarray(0, 8)
+        : CardCrypto.retailMac(key, data);
+    const publicKeyObject = (point) =>
+      Tlv.encode(
+        0x7f49,
+        Buffer.concat([
+          Tlv.encode(0x06, info.oid),
+          Tlv.encode(0x86, curve.encodePoint(point)),
+        ])
+      );
+
+    let nonce;
+    let mapKey;
+    let ephemeralKey;
+    let ephemeralPublic;
+    let chipPublic;
+    let encKey;
+    let macKey;
+    this.secureMessaging = null;
+    const mse = Buffer.concat([
+      Tlv.encode(0x80, info.oid),
+      Tlv.encode(0x83, [password.can !== undefined ? 0x02 : 0x01]),
+    ]);
+    return this.transmit({
+      cla: 0x00,
+      ins: ins.MSE,
+      p1: 0xc1,
+      p2: 0xa4,
+      data: Array.from(mse),
+    })
+      .then((response) => {
+        if (!response.isOk()) {
+          throw new Error(`MSE:Set AT failed '${response.getStatusCode()}'`);
+        }
+        return this.generalAuthenticate(0x80, null, false);
+      })
+      .then((dynamic) => {
+        const z = dynamic.find(0x80).value;
+        nonce = EllipticCurve.toBigInt(
+          cipher === 'aes'
+            ? CardCrypto.aesDecrypt(kPi, z)
+            : CardCrypto.tdesDecrypt(kPi, z)
+        );
+        mapKey = curve.randomScalar();
+        return this.generalAuthenticate(
+          0x81,
+          curve.encodePoint(curve.multiply(mapKey)),
+          false
+        );
+      })
+      .then((dynamic) => {
+        const mapPublic = curve.decodePoint(dynamic.find(0x82).value);
+        if (!curve.isOnCurve(mapPublic)) {
+          throw new Error('PACE mapping point is not on the curve');
+        }
+        const h = curve.multiply(mapKey, mapPublic);
+        const generator = curve.add(curve.multiply(nonce), h);
+        ephemeralKey = curve.randomScalar();
+        ephemeralPublic = curve.multiply(ephemeralKey, generator);
+        return this.generalAuthenticate(
+          0x83,
+          curve.encodePoint(ephemeralPublic),
+          false
+        );
+      })
+      .then((dynamic) => {
+        chipPublic = curve.decodePoint(dynamic.find(0x84).value);
+        if (!curve.isOnCurve(chipPublic)) {
+          throw new Error('PACE chip public key is not on the curve');
+        }
+        const shared = curve.encodeCoordinate(
+          curve.multiply(ephemeralKey, chipPublic).x
+        );
+        encKey = CardCrypto.kdf(shared, 1, cipher, keyLength);
+        macKey = CardCrypto.kdf(shared, 2, cipher, keyLength);
+        return this.generalAuthenticate(
+          0x85,
+          mac(macKey, publicKeyObject(chipPublic)),
+          true
+        );
+      })
+      .then((dynamic) => {
+        const token = dynamic.find(0x86).value;
+        if (!mac(macKey, publicKeyObject(ephemeralPublic)).equals(token)) {
+          throw new Error('PACE authentication token verification failed');
+        }
+        this.secureMessaging = new SecureMessaging({ cipher, encKey, macKey });
+        this.emit('access-control-established', { protocol: 'PACE' });
+      });
+  }
+
+  // PACE when EF.CardAccess offers it, BAC otherwise
+  open(password) {
+    const stopwatch = Stopwatch.start();
+    return this.readAtrInfo()
+      .then(() => this.readCardAccess())
+      .then((paceInfos) => {
+        if (paceInfos.length) {
+          return this.doPace(password, paceInfos[0]).then(() =>
+            this.select()
+          );
+        }
+        return this.select().then(() => this.doBac(password));
+      })
+      .then(() => {
+        logger.debug(`open, took ${stopwatch.elapsed()}ms`);
+        return this.limits;
+      });
+  }
+
+  readBinaryChunk(shortFileIdentifier, offset, length, first) {
+    if (first) {
+      return this.transmit({
+        cla: 0x00,
+        ins: ins.READ_BINARY,
+        p1: 0x80 | shortFileIdentifier,
+        p2: 0x00,
+        le: length,
+      }).then((response) => this.chunkData(response));
+    }
+    if (offset <= 0x7fff) {
+      return this.transmit({
+        cla: 0x00,
+        ins: ins.READ_BINARY,
+        p1: offset >> 8,
+        p2: offset & 0xff,
+        le: length,
+      }).then((response) => this.chunkData(response));
+    }
+    // odd INS with an offset data object for files beyond 32K
+    const offsetBytes = [];
+    for (let value = offset; value > 0; value = Math.floor(value / 256)) {
+      offsetBytes.unshift(value & 0xff);
+    }
+    return this.transmit({
+      cla: 0x00,
+      ins: ins.READ_BINARY_ODD,
+      p1: 0x00,
+      p2: 0x00,
+      data: Array.from(Tlv.encode(0x54, offsetBytes)),
+      le: Math.min(length + 4, this.chunkSize()),
+    }).then((response) => {
+      const data = this.chunkData(response);
+      const wrapped = Tlv.find(Tlv.parse(data), 0x53);
+      return wrapped ? wrapped.value : Buffer.alloc(0);
+    });
+  }
+
+  chunkData(response) {
+    const sw = response.getStatusCode();
+    if (sw !== '9000' && sw !== '6282') {
+      throw new Error(`READ BINARY failed '${sw}'`);
+    }
+    return Buffer.from(response.getDataOnly(), 'hex');
+  }
+
+  readStream(shortFileIdentifier) {
+    const chunkSize = this.chunkSize();
+    const stopwatch = Stopwatch.start();
+    let offset = 0;
+    let total = null;
+    let reads = 0;
+    const stream = new Readable({
+      read: () => {
+        const remaining = total === null ? chunkSize : total - offset;
+        this.readBinaryChunk(
+          shortFileIdentifier,
+          offset,
+          Math.min(chunkSize, remaining),
+          total === null
+        )
+          .then((data) => {
+            reads++;
+            if (total === null) {
+              const header = headerLength(data);
+              total = header.header + header.length;
+            }
+            if (!data.length && offset < total) {
+              throw new Error(`file ended at ${offset} of ${total} bytes`);
+            }
+            const end = Math.min(data.length, total - offset);
+            offset += end;
+            const done = offset >= total;
+            stream.push(data.subarray(0, end));
+            if (done) {
+              stream.push(null);
+              this.emit('file-read', {
+                shortFileIdentifier,
+                length: total,
+                reads,
+                chunkSize,
+                durationMs: stopwatch.elapsed(),
+              });
+            }
+          })
+          .catch((err) => stream.destroy(err));
+      },
+    });
+    return stream;
+  }
+
+  readFile(shortFileIdentifier) {
+    return new Promise((resolve, reject) => {
+      const chunks = [];
+      this.readStream(shortFileIdentifier)
+        .on('data', (chunk) => chunks.push(chunk))
+        .on('error', reject)
+        .on('end', () => resolve(Buffer.concat(chunks)));
+    });
+  }
+
+  readDataGroup(dataGroup) {
+    return this.readStream(dataGroup);
+  }
+
+  readEfCom() {
+    return this.readFile(sfi.COM).then((data) => {
+      const tagList = Tlv.find(Tlv.parse(data), 0x5c);
+      return tagList
+        ? Array.from(tagList.value)
+            .map((tag) => dataGroupTags[tag])
+            .filter((dg) => dg)
+        : [];
+    });
+  }
+
+  readDataGroups(dataGroups) {
+    return this.readEfCom().then((present) => {
+      const wanted = dataGroups.filter((dg) => present.indexOf(dg) >= 0);
+      const result = {};
+      return wanted
+        .reduce(
+          (previous, dg) =>
+            previous
+              .then(() => this.readFile(dg))
+              .then((data) => {
+                result[dg] = data;
+              }),
+          Promise.resolve()
+        )
+        .then(() => result);
+    });
+  }
+}
+
+EmrtdApplication.AID = AID;
+EmrtdApplication.sfi = sfi;
+EmrtdApplication.mrzInformation = mrzInformation;
+
+module.exports = EmrtdApplication;
@@ -0,0 +1,448 @@
+'use strict';
+
+import crypto from 'crypto';
+import CardCrypto from './CardCrypto';
+import CommandApdu from './CommandApdu';
+import Stopwatch from './Stopwatch';
+import Tlv from './Tlv';
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('EmvOda');
+
+// EMV Book 2 data formats of recovered data
+const formats = {
+  ISSUER_CERTIFICATE: 0x02,
+  SIGNED_STATIC_DATA: 0x03,
+  ICC_CERTIFICATE: 0x04,
+  SIGNED_DYNAMIC_DATA: 0x05,
+};
+
+const HASH_LENGTH = 20;
+
+// offset of the hash algorithm indicator per format, 01 (SHA-1) only
+const hashIndicator = {
+  [formats.ISSUER_CERTIFICATE]: 11,
+  [formats.SIGNED_STATIC_DATA]: 2,
+  [formats.ICC_CERTIFICATE]: 17,
+  [formats.SIGNED_DYNAMIC_DATA]: 2,
+};
+const SHA_1 = 0x01;
+
+const sha1 = (...parts) => {
+  const hash = crypto.createHash('sha1');
+  parts.forEach((part) => hash.update(part));
+  return hash.digest();
+};
+
+const required = (tags, tag) => {
+  const value = tags[tag];
+  if (!value) {
+    throw new Error(`tag ${tag} missing`);
+  }
+  return value;
+};
+
+/*
+Recovers the signed message of an EMV certificate or signature and checks
+its header, trailer, format and hash. `tail` is hashed after the recovered
+data, e.g. the key remainder and exponent, or the dynamic data.
+*/
+const recover = (publicKey, modulusLength, signed, format, tail) => {
+  if (signed.length !== modulusLength) {
+    throw new Error(
+      `signature of ${signed.length} bytes for a ${modulusLength} byte key`
+    );
+  }
+  const data = CardCrypto.rsaRecover(publicKey, signed);
+  if (data[0] !== 0x6a || data[data.length - 1] !== 0xbc) {
+    throw new Error('recovered data header or trailer wrong');
+  }
+  if (data[1] !== format) {
+    throw new Error(`recovered data format ${data[1]}, expected ${format}`);
+  }
+  const algorithm = data[hashIndicator[format]];
+  if (algorithm !== SHA_1) {
+    throw new Error(`hash algorithm indicator ${algorithm} not supported`);
+  }
+  const end = data.length - 1 - HASH_LENGTH;
+  const hash = sha1(data.subarray(1, end), ...tail);
+  if (!hash.equals(data.subarray(end, data.length - 1))) {
+    throw new Error('recovered data hash wrong');
+  }
+  return data;
+};
+
+// modulus from the leftmost digits in the certificate and the remainder
+const modulusOf = (data, offset, length, remainder) => {
+  const digits = data.subarray(offset, data.length - 1 - HASH_LENGTH);
+  return Buffer.concat([digits, remainder || Buffer.alloc(0)]).subarray(
+    0,
+    length
+  );
+};
+
+// MMYY, valid through the end of that month
+const isExpired = (expiry, now) => {
+  const text = Buffer.isBuffer(expiry) ? expiry.toString('hex') : expiry;
+  const month = parseInt(text.slice(0, 2), 10);
+  const year = 2000 + parseInt(text.slice(2, 4), 10);
+  return (
+    year < now.getUTCFullYear() ||
+    (year === now.getUTCFullYear() && month < now.getUTCMonth() + 1)
+  );
+};
+
+// PAN digits, without the F padding
+const panOf = (tags) =>
+  required(tags, '5a').toString('hex').replace(/f+$/, '');
+
+const collect = (nodes, tags) => {
+  const found = tags || {};
+  nodes.forEach((node) => {
+    if (node.children) {
+      collect(node.children, found);
+    } else {
+      const tag = node.tag.toString(16);
+      if (!found[tag]) found[tag] = node.value;
+    }
+  });
+  return found;
+};
+
+class LruCache {
+  constructor(size) {
+    this.size = size;
+    this.entries = new Map();
+  }
+
+  get(key) {
+    const value = this.entries.get(key);
+    if (value !== undefined) {
+      this.entries.delete(key);
+      this.entries.set(key, value);
+    }
+    return value;
+  }
+
+  set(key, value) {
+    this.entries.delete(key);
+    this.entries.set(key, value);
+    if (this.entries.size > this.size) {
+      this.entries.delete(this.entries.keys().next().value);
+    }
+  }
+}
+
+/*
+EMV offline data authentication (SDA, DDA, CDA) over data already read from
+the card. `tags` maps hex tags to values, e.g. from EmvOda.collect() over
+the parsed records; `staticData` is the static data to be authenticated,
+see EmvOda.staticData(). Recovered issuer public keys are cached by a hash
+of their certificate, so cards of the same issuer skip that RSA operation.
+*/
+class EmvOda {
+  constructor(options) {
+    const opts = options || {};
+    this.caKeys = opts.caKeys;
+    this.issuerKeys = new LruCache(opts.cacheSize || 256);
+    // the transaction date certificates are checked against
+    this.now = opts.now || (() => new Date());
+    this.stats = { issuerKeys: 0, cacheHits: 0, failures: 0 };
+  }
+
+  /*
+  { modulus, exponent, publicKey, issuerId, expiry, serial, cached }. The
+  CA key and the certificate must not have expired and the issuer
+  identifier must match the leftmost PAN digits, also for cached keys.
+  */
+  issuerKey(rid, tags) {
+    const key = this.recoverIssuerKey(rid, tags);
+    if (key.caExpiry && isExpired(key.caExpiry, this.now())) {
+      throw new Error(`CA key expired ${key.caExpiry}`);
+    }
+    if (isExpired(key.expiry, this.now())) {
+      throw new Error(`issuer certificate expired ${key.expiry}`);
+    }
+    const issuerId = key.issuerId.replace(/f+$/, '');
+    if (issuerId.length < 3 || !panOf(tags).startsWith(issuerId)) {
+      throw new Error(`issuer identifier ${key.issuerId} is not the PAN's`);
+    }
+    return key;
+  }
+
+  recoverIssuerKey(rid, tags) {
+    const ridBytes = Buffer.isBuffer(rid) ? rid : Buffer.from(rid, 'hex');
+    const certificate = required(tags, '90');
+    const remainder = tags['92'] || Buffer.alloc(0);
+    const exponent = required(tags, '9f32');
+    const index = required(tags, '8f')[0];
+    const cacheKey = sha1(
+      ridBytes,
+      Buffer.from([index]),
+      certificate,
+      remainder,
+      exponent
+    ).toString('hex');
+    const hit = this.issuerKeys.get(cacheKey);
+    if (hit) {
+      this.stats.cacheHits++;
+      return Object.assign({}, hit, { cached: true });
+    }
+    const ca = this.caKeys.get(ridBytes, index);
+    if (!ca) {
+      throw new Error(`no CA key ${ridBytes.toString('hex')} index ${index}`);
+    }
+    const data = recover(
+      ca.publicKey,
+      ca.modulus.length,
+      certificate,
+      formats.ISSUER_CERTIFICATE,
+      [remainder, exponent]
+    );
+    const modulus = modulusOf(data, 15, data[13], remainder);
+    const key = {
+      modulus,
+      exponent,
+      publicKey: CardCrypto.rsaPublicKey(modulus, exponent),
+      issuerId: data.subarray(2, 6).toString('hex'),
+      expiry: data.subarray(6, 8).toString('hex'),
+      serial: data.subarray(8, 11).toString('hex'),
+      caExpiry: ca.expiry,
+    };
+    this.stats.issuerKeys++;
+    this.issuerKeys.set(cacheKey, key);
+    return Object.assign({}, key, { cached: false });
+  }
+
+  // { modulus, exponent, publicKey, pan, expiry }
+  iccKey(issuerKey, tags, staticData) {
+    const remainder = tags['9f48'] || Buffer.alloc(0);
+    const exponent = required(tags, '9f47');
+    const data = recover(
+      issuerKey.publicKey,
+      issuerKey.modulus.length,
+      required(tags, '9f46'),
+      formats.ICC_CERTIFICATE,
+      [remainder, exponent, staticData]
+    );
+    const pan = data.subarray(2, 12).toString('hex').replace(/f+$/, '');
+    if (panOf(tags) !== pan) {
+      throw new Error('ICC certificate is for another PAN');
+    }
+    const expiry = data.subarray(12, 14).toString('hex');
+    if (isExpired(expiry, this.now())) {
+      throw new Error(`ICC certificate expired ${expiry}`);
+    }
+    const modulus = modulusOf(data, 21, data[19], remainder);
+    return {
+      modulus,
+      exponent,
+      publicKey: CardCrypto.rsaPublicKey(modulus, exponent),
+      pan,
+      expiry,
+    };
+  }
+
+  // each verify resolves with { ok, method, error, timings, ... }
+  run(method, steps) {
+    const stopwatch = Stopwatch.start();
+    const timings = {};
+    const time = (name, fn) => {
+      const step = Stopwatch.start();
+      return Promise.resolve()
+        .then(fn)
+        .then((value) => {
+          timings[name] = step.elapsed();
+          return value;
+        });
+    };
+    return steps(time)
+      .then((details) =>
+        Object.assign({ ok: true, method, error: null }, details)
+      )
+      .catch((err) => {
+        this.stats.failures++;
+        logger.debug(`${method} failed`, err.message);
+        return { ok: false, method, error: err.message };
+      })
+      .then((result) =>
+        Object.assign(result, {
+          timings,
+          durationMs: stopwatch.elapsed(),
+        })
+      );
+  }
+
+  verifySda(rid, tags, staticData) {
+    return this.run('sda', (time) =>
+      time('issuerKeyMs', () => this.issuerKey(rid, tags)).then(
+        (issuerKey) =>
+          time('verifyMs', () => {
+            const data = recover(
+              issuerKey.publicKey,
+              issuerKey.modulus.length,
+              required(tags, '93'),
+              formats.SIGNED_STATIC_DATA,
+              [staticData]
+            );
+            return {
+              issuerKeyCached: issuerKey.cached,
+              dataAuthenticationCode: data.subarray(3, 5).toString('hex'),
+            };
+          })
+      )
+    );
+  }
+
+  /*
+  INTERNAL AUTHENTICATE through the application with the DDOL data, by
+  default an unpredictable number, and checks the signed dynamic data.
+  */
+  verifyDda(application, rid, tags, staticData, ddolData) {
+    const challenge = ddolData || crypto.randomBytes(4);
+    return this.run('dda', (time) =>
+      time('issuerKeyMs', () => this.issuerKey(rid, tags))
+        .then((issuerKey) =>
+          time('iccKeyMs', () => this.iccKey(issuerKey, tags, staticData))
+            .then((iccKey) =>
+              time('internalAuthenticateMs', () =>
+                this.internalAuthenticate(application, challenge)
+              ).then((sdad) => ({ iccKey, sdad }))
+            )
+            .then(({ iccKey, sdad }) =>
+              time('verifyMs', () => {
+                const data = recover(
+                  iccKey.publicKey,
+                  iccKey.modulus.length,
+                  sdad,
+                  formats.SIGNED_DYNAMIC_DATA,
+                  [challenge]
+                );
+                const dynamic = data.subarray(4, 4 + data[3]);
+                return {
+                  issuerKeyCached: issuerKey.cached,
+                  iccDynamicNumber: dynamic
+                    .subarray(1, 1 + dynamic[0])
+                    .toString('hex'),
+                };
+              })
+            )
+        )
+    );
+  }
+
+  // the signed dynamic application data, response format 1 or 2
+  internalAuthenticate(application, ddolData) {
+    return application
+      .issueCommand(
+        new CommandApdu({
+          cla: 0x00,
+          ins: 0x88,
+          p1: 0x00,
+          p2: 0x00,
+          data: [...ddolData],
+          le: 0,
+        })
+      )
+      .then((response) => {
+        if (!response.isOk()) {
+          throw new Error(`INTERNAL AUTHENTICATE ${response.getStatusCode()}`);
+        }
+        const nodes = Tlv.parse(Buffer.from(response.getDataOnly(), 'hex'));
+        if (nodes[0] && nodes[0].tag === 0x80) {
+          return nodes[0].value;
+        }
+        const sdad = Tlv.find(nodes, 0x9f4b);
+        if (!sdad) {
+          throw new Error('no signed dynamic application data');
+        }
+        return sdad.value;
+      });
+  }
+
+  /*
+  CDA over a GENERATE AC response: `transactionData` is the PDOL data, the
+  CDOL data and the response's data objects other than 9F4B, in that order.
+  */
+  verifyCda(rid, tags, staticData, generateAc) {
+    return this.run('cda', (time) =>
+      time('issuerKeyMs', () => this.issuerKey(rid, tags))
+        .then((issuerKey) =>
+          time('iccKeyMs', () =>
+            Object.assign(this.iccKey(issuerKey, tags, staticData), {
+              issuerKeyCached: issuerKey.cached,
+            })
+          )
+        )
+        .then((iccKey) =>
+          time('verifyMs', () => {
+            const data = recover(
+              iccKey.publicKey,
+              iccKey.modulus.length,
+              generateAc.sdad,
+              formats.SIGNED_DYNAMIC_DATA,
+              [generateAc.unpredictableNumber]
+            );
+            const dynamic = data.subarray(4, 4 + data[3]);
+            const numberLength = dynamic[0];
+            const cid = dynamic[1 + numberLength];
+            const cryptogram = dynamic.subarray(
+              2 + numberLength,
+              10 + numberLength
+            );
+            const transactionHash = dynamic.subarray(
+              10 + numberLength,
+              30 + numberLength
+            );
+            if (generateAc.cid !== undefined && cid !== generateAc.cid) {
+              throw new Error('cryptogram information data differs');
+            }
+            if (!transactionHash.equals(sha1(generateAc.transactionData))) {
+              throw new Error('transaction data hash wrong');
+            }
+            return {
+              issuerKeyCached: iccKey.issuerKeyCached,
+              iccDynamicNumber: dynamic
+                .subarray(1, 1 + numberLength)
+                .toString('hex'),
+              cryptogram: cryptogram.toString('hex'),
+            };
+          })
+        )
+    );
+  }
+
+  getStats() {
+    return Object.assign({}, this.stats);
+  }
+
+  // primitive values of parsed records by hex tag, first occurrence wins
+  static collect(nodes) {
+    return collect(nodes);
+  }
+
+  /*
+  Static data to be authenticated from the records the AFL marks for
+  offline authentication, [{ sfi, data }] with data the record without
+  status word, followed by the values of the tags in the SDA tag list
+  (only 82, the AIP, is allowed).
+  */
+  static staticData(records, tags) {
+    const parts = records.map((record) => {
+      if (record.sfi > 10) return record.data;
+      const template = Tlv.parse(record.data)[0];
+      if (!template || template.tag !== 0x70) {
+        throw new Error(`record of SFI ${record.sfi} is not a template 70`);
+      }
+      return template.value;
+    });
+    if (tags && tags['9f4a']) {
+      const listed = tags['9f4a'].toString('hex');
+      if (listed === '82') parts.push(required(tags, '82'));
+    }
+    return Buffer.concat(parts);
+  }
+}
+
+EmvOda.formats = formats;
+
+module.exports = EmvOda;
@@ -0,0 +1,176 @@
+'use strict';
+
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('EventStream');
+
+const overflowPolicies = ['drop-oldest', 'drop-newest', 'error'];
+
+/*
+Async iterable over emitter events with a bounded buffer. An event replaces
+the latest one still waiting with the same coalescing key when both are of
+the same type, so repeats collapse while an insert followed by its remove
+is delivered as two events. Listeners are removed when iteration ends.
+*/
+class EventStream {
+  constructor(options) {
+    const opts = options || {};
+    this.highWaterMark = opts.highWaterMark || 64;
+    this.overflow = opts.overflow || 'drop-oldest';
+    if (overflowPolicies.indexOf(this.overflow) < 0) {
+      throw new Error(`unknown overflow policy '${this.overflow}'`);
+    }
+    this.coalesce = opts.coalesce !== false;
+    this.buffer = [];
+    this.waiting = {};
+    this.readers = [];
+    this.detachers = [];
+    this.error = null;
+    this.done = false;
+    this.stats = { received: 0, delivered: 0, coalesced: 0, dropped: 0 };
+  }
+
+  // listens for `type` on the emitter, returns a function removing it
+  attach(emitter, type, key) {
+    const listener = (event) =>
+      this.push(type, event, key ? key(event) : undefined);
+    emitter.on(type, listener);
+    const detach = () => {
+      emitter.removeListener(type, listener);
+      this.detachers = this.detachers.filter((d) => d !== detach);
+    };
+    this.detachers.push(detach);
+    return detach;
+  }
+
+  push(type, event, key) {
+    if (this.done) {
+      return;
+    }
+    this.stats.received++;
+    const entry = { value: Object.assign({ type }, event), key };
+    if (this.readers.length) {
+      this.stats.delivered++;
+      return this.readers.shift().resolve({ value: entry.value, done: false });
+    }
+    const waiting = key !== undefined && this.waiting[key];
+    if (this.coalesce && waiting && waiting.value.type === type) {
+      waiting.value = entry.value;
+      this.stats.coalesced++;
+      return;
+    }
+    if (this.buffer.length >= this.highWaterMark) {
+      this.stats.dropped++;
+      if (this.overflow === 'drop-newest') {
+        return;
+      }
+      if (this.overflow === 'error') {
+        logger.debug(`overflow after ${this.stats.received} events`);
+        this.error = new Error(`event buffer overflow (${this.highWaterMark})`);
+        this.close();
+        return;
+      }
+      this.forget(this.buffer.shift());
+    }
+    this.buffer.push(entry);
+    if (key !== undefined) {
+      this.waiting[key] = entry;
+    }
+  }
+
+  forget(entry) {
+    if (entry.key !== undefined && this.waiting[entry.key] === entry) {
+      delete this.waiting[entry.key];
+    }
+  }
+
+  next() {
+    if (this.buffer.length) {
+      const entry = this.buffer.shift();
+      this.forget(entry);
+      this.stats.delivered++;
+      return Promise.resolve({ value: entry.value, done: false });
+    }
+    if (this.error) {
+      const error = this.error;
+      this.error = null;
+      return Promise.reject(error);
+    }
+    if (this.done) {
+      return Promise.resolve({ value: undefined, done: true });
+    }
+    return new Promise((resolve, reject) => {
+      this.readers.push({ resolve, reject });
+    });
+  }
+
+  close() {
+    if (this.done) {
+      return;
+    }
+    this.done = true;
+    this.detachers.slice().forEach((detach) => detach());
+    const readers = this.readers;
+    this.readers = [];
+    readers.forEach((reader) => {
+      if (this.error) {
+        reader.reject(this.error);
+      } else {
+        reader.resolve({ value: undefined, done: true });
+      }
+    });
+  }
+
+  // called by for await when the loop exits early
+  return() {
+    this.buffer = [];
+    this.waiting = {};
+    this.close();
+    return Promise.resolve({ value: undefined, done: true });
+  }
+
+  [Symbol.asyncIterator]() {
+    return this;
+  }
+
+  // card events of one device, repeats of the same event waiting in the
+  // buffer collapse into the latest
+  static forDevice(device, options) {
+    const stream = new EventStream(options);
+    const key = () => `card:${device.name}`;
+    stream.attach(device, 'card-inserted', key);
+    stream.attach(device, 'card-removed', key);
+    return stream;
+  }
+
+  // device events, and card events of every device while it is attached
+  static forDevices(devices, options) {
+    const stream = new EventStream(options);
+    const deviceKey = (event) => `device:${event.device.name}`;
+    const cards = {};
+    const watch = (device) => {
+      const key = () => `card:${device.name}`;
+      cards[device.name] = [
+        stream.attach(device, 'card-inserted', key),
+        stream.attach(device, 'card-removed', key),
+      ];
+    };
+    const unwatch = (device) => {
+      (cards[device.name] || []).forEach((detach) => detach());
+      delete cards[device.name];
+    };
+    devices.listDevices().forEach(watch);
+    stream.attach(devices, 'device-activated', deviceKey);
+    stream.attach(devices, 'device-deactivated', deviceKey);
+    const activated = (event) => watch(event.device);
+    const deactivated = (event) => unwatch(event.device);
+    devices.on('device-activated', activated);
+    devices.on('device-deactivated', deactivated);
+    stream.detachers.push(() => {
+      devices.removeListener('device-activated', activated);
+      devices.removeListener('device-deactivated', deactivated);
+    });
+    return stream;
+  }
+}
+
+export default EventStream;
@@ -4,8 +4,8 @@ import { EventEmitter } from 'events';
 import hexify from 'hexify';
 import CommandApdu from './CommandApdu';
 import ResponseApdu from './ResponseApdu';
-import pino from 'pino';
-const logger = pino({ name: 'Iso7816Application' });
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('Iso7816Application');
 const ins = {
   APPEND_RECORD: 0xe2,
   ENVELOPE: 0xc2,
@@ -59,6 +59,16 @@ class Iso7816Application extends EventEmitter {
     });
   }
 
+  // raw exchange through card.transmit(), T=0 61xx/9Fxx and 6Cxx handled
+  // without ResponseApdus; a CommandApdu keeps its receive length
+  exchange(command) {
+    return new Promise((resolve, reject) =>
+      this.card.transmit(command, (err, response) =>
+        err ? reject(err) : resolve(response)
+      )
+    );
+  }
+
   selectFile(bytes, p1, p2) {
     logger.debug(`selectFile, file='${bytes}'`);
     const commandApdu = new CommandApdu({
@@ -0,0 +1,391 @@
+'use strict';
+
+import crypto from 'crypto';
+import CardCrypto from './CardCrypto';
+import Stopwatch from './Stopwatch';
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('KeyDiversifier');
+
+// GlobalPlatform SCP03 derivation constants
+const constants = {
+  CARD_CRYPTOGRAM: 0x00,
+  HOST_CRYPTOGRAM: 0x01,
+  S_ENC: 0x04,
+  S_MAC: 0x06,
+  S_RMAC: 0x07,
+};
+
+// EMV CPS static key derivation, ENC, MAC and DEK
+const cpsKeys = { enc: 0x01, mac: 0x02, dek: 0x03 };
+
+const digits = (value) =>
+  Buffer.isBuffer(value)
+    ? value.toString('hex').replace(/f+$/i, '')
+    : String(value);
+
+const packDigits = (text) =>
+  Buffer.from(text.length % 2 ? `0${text}` : text, 'hex');
+
+const invert = (block) => Buffer.from(block.map((b) => b ^ 0xff));
+
+// EMV Book 2 A1.4.1, rightmost 16 digits of PAN and PSN
+const optionA = (pan, psn) =>
+  packDigits(
+    `${digits(pan)}${digits(psn || '00')}`.slice(-16).padStart(16, '0')
+  );
+
+// EMV Book 2 A1.4.2, decimalized SHA-1 when the PAN exceeds 16 digits,
+// option A otherwise
+const optionB = (pan, psn) => {
+  if (digits(pan).length <= 16) {
+    return optionA(pan, psn);
+  }
+  const y = `${digits(pan)}${digits(psn || '00')}`;
+  const hash = crypto.createHash('sha1').update(packDigits(y)).digest('hex');
+  const decimal = hash.replace(/[a-f]/g, '');
+  const letters = hash
+    .replace(/[0-9]/g, '')
+    .replace(/[a-f]/g, (c) => String(parseInt(c, 16) - 10));
+  return packDigits(`${decimal}${letters}`.slice(0, 16));
+};
+
+/*
+A derivation is a list of rounds: each round hands blocks to encrypt under
+one key and receives them encrypted, so rounds of many derivations under
+the same key share one cipher call.
+*/
+const ecbRound = (cipher, key, input, done) => ({ cipher, key, input, done });
+
+const emvMasterKey = (request, x) => {
+  const block = x(request.pan, request.psn);
+  return ecbRound(
+    '3des',
+    request.key,
+    Buffer.concat([block, invert(block)]),
+    (z) => CardCrypto.adjustParity(z)
+  );
+};
+
+// EMV Book 2 A1.3, common session key from the ATC
+const emvSessionKey = (request) => {
+  const atc = Buffer.alloc(2);
+  atc.writeUInt16BE(request.atc, 0);
+  const aes = request.cipher === 'aes';
+  const size = aes ? 16 : 8;
+  const left = Buffer.alloc(size);
+  const right = Buffer.alloc(size);
+  atc.copy(left);
+  atc.copy(right);
+  left[2] = 0xf0;
+  right[2] = 0x0f;
+  if (aes && request.key.length === 16) {
+    return ecbRound('aes', request.key, left, (sk) => sk);
+  }
+  return ecbRound(
+    aes ? 'aes' : '3des',
+    request.key,
+    Buffer.concat([left, right]),
+    (sk) => (aes ? sk : CardCrypto.adjustParity(sk))
+  );
+};
+
+// EMV CPS: card static keys from the KMC and the key diversification data
+const cpsKey = (request) => {
+  const kdd = Buffer.from(request.kdd).subarray(-6);
+  const constant = cpsKeys[request.usage] || request.usage;
+  return ecbRound(
+    '3des',
+    request.key,
+    Buffer.concat([
+      kdd,
+      Buffer.from([0xf0, constant]),
+      kdd,
+      Buffer.from([0x0f, constant]),
+    ]),
+    (key) => key
+  );
+};
+
+/*
+NIST SP 800-108 counter mode with AES-CMAC, as in GlobalPlatform SCP03: an
+11 byte label of zeros, the derivation constant, a zero separator, the
+length in bits on two bytes, the counter and the context.
+*/
+const cmacKdf = (request) => {
+  const bits = request.length || request.key.length * 8;
+  const blocks = Math.ceil(bits / 128);
+  const messages = [];
+  for (let i = 1; i <= blocks; i++) {
+    const header = Buffer.alloc(16);
+    header[11] = request.constant;
+    header.writeUInt16BE(bits, 13);
+    header[15] = i;
+    messages.push(
+      Buffer.concat([header, Buffer.from(request.context || [])])
+    );
+  }
+  // first round: the zero block for the CMAC subkeys
+  return ecbRound('aes', request.key, Buffer.alloc(16), (l) => {
+    const masked = messages.map((m) => CardCrypto.cmacMessage(l, m));
+    const states = masked.map(() => Buffer.alloc(16));
+    const chain = (offset) =>
+      ecbRound(
+        'aes',
+        request.key,
+        Buffer.concat(
+          masked.map((m, i) =>
+            CardCrypto.xor(states[i], m.subarray(offset, offset + 16))
+          )
+        ),
+        (out) => {
+          states.forEach((s, i) => out.copy(s, 0, i * 16, i * 16 + 16));
+          if (offset + 16 < masked[0].length) return chain(offset + 16);
+          return Buffer.concat(states).subarray(0, bits / 8);
+        }
+      );
+    return chain(0);
+  });
+};
+
+const methods = {
+  'emv-a': (request) => emvMasterKey(request, optionA),
+  'emv-b': (request) => emvMasterKey(request, optionB),
+  'emv-csk': emvSessionKey,
+  'emv-cps': cpsKey,
+  cmac: cmacKdf,
+};
+
+const idOf = (identity) =>
+  typeof identity === 'string' ? identity : JSON.stringify(identity);
+
+const isRound = (value) =>
+  value && !Buffer.isBuffer(value) && value.done !== undefined;
+
+/*
+Derives per card keys from master keys: EMV ICC master keys (option A or
+B), EMV common session keys, EMV CPS static keys and the AES-CMAC KDF of
+GlobalPlatform SCP03. A batch encrypts the blocks of all its derivations
+under the same key in one cipher call. Fed with the cards seen at
+card-inserted, the precompute queue derives each card's keys while the
+application is still being selected, so they are ready when the secure
+channel opens.
+*/
+class KeyDiversifier {
+  constructor(options) {
+    const opts = options || {};
+    this.identify = opts.identify;
+    this.requests = opts.requests;
+    this.batchSize = opts.batchSize || 64;
+    this.cacheSize = opts.cacheSize || 1024;
+    this.cache = new Map();
+    this.queue = [];
+    this.pending = new Map();
+    this.cards = new WeakMap();
+    this.scheduled = false;
+    this.listeners = [];
+    this.stats = {
+      derived: 0,
+      batches: 0,
+      cipherCalls: 0,
+      hits: 0,
+      misses: 0,
+      batchMs: 0,
+    };
+  }
+
+  derive(request) {
+    return this.deriveBatch([request])[0];
+  }
+
+  // Array of requests to Array of keys, in order
+  deriveBatch(requests) {
+    const stopwatch = Stopwatch.start();
+    const rounds = requests.map((request) => {
+      const method = methods[request.method];
+      if (!method) {
+        throw new Error(`unknown derivation method '${request.method}'`);
+      }
+      return method(
+        Object.assign({}, request, { key: Buffer.from(request.key) })
+      );
+    });
+    const keys = new Array(requests.length);
+    let active = rounds.map((round, i) => i);
+    while (active.length) {
+      const groups = new Map();
+      active.forEach((i) => {
+        const round = rounds[i];
+        const id = `${round.cipher}:${round.key.toString('hex')}`;
+        if (!groups.has(id)) groups.set(id, []);
+        groups.get(id).push(i);
+      });
+      groups.forEach((members) => {
+        const { cipher, key } = rounds[members[0]];
+        const input = Buffer.concat(members.map((i) => rounds[i].input));
+        const output =
+          cipher === 'aes'
+            ? CardCrypto.aesEcb(key, input)
+            : CardCrypto.tdesEcb(key, input);
+        this.stats.cipherCalls++;
+        let offset = 0;
+        members.forEach((i) => {
+          const length = rounds[i].input.length;
+          const next = rounds[i].done(
+            output.subarray(offset, offset + length)
+          );
+          offset += length;
+          if (isRound(next)) {
+            rounds[i] = next;
+          } else {
+            keys[i] = Buffer.from(next);
+          }
+        });
+      });
+      active = active.filter((i) => keys[i] === undefined);
+    }
+    this.stats.derived += requests.length;
+    this.stats.batches++;
+    this.stats.batchMs += stopwatch.elapsed();
+    return keys;
+  }
+
+  /*
+  Resolves with the keys of a card identity, an Object of the names given
+  by `requests(identity)`: from the cache, from the queue, or queued now.
+  */
+  keys(identity) {
+    const id = idOf(identity);
+    const cached = this.cache.get(id);
+    if (cached) {
+      this.stats.hits++;
+      this.cache.delete(id);
+      this.cache.set(id, cached);
+      return Promise.resolve(cached);
+    }
+    if (this.pending.has(id)) {
+      this.stats.hits++;
+      return this.pending.get(id).promise;
+    }
+    this.stats.misses++;
+    return this.enqueue(identity);
+  }
+
+  // the keys of a card, identified once with `identify(card)`
+  keysForCard(card) {
+    if (!this.cards.has(card)) {
+      this.cards.set(
+        card,
+        Promise.resolve(this.identify(card)).then((identity) =>
+          this.keys(identity)
+        )
+      );
+    }
+    return this.cards.get(card);
+  }
+
+  // queues the derivation of an identity's keys, flushed in batches
+  enqueue(identity) {
+    const id = idOf(identity);
+    if (this.cache.has(id)) return Promise.resolve(this.cache.get(id));
+    if (this.pending.has(id)) return this.pending.get(id).promise;
+    const entry = { id, identity };
+    entry.promise = new Promise((resolve, reject) => {
+      entry.resolve = resolve;
+      entry.reject = reject;
+    });
+    this.pending.set(id, entry);
+    this.queue.push(entry);
+    this.schedule();
+    return entry.promise;
+  }
+
+  schedule() {
+    if (this.scheduled) return;
+    this.scheduled = true;
+    setImmediate(() => {
+      this.scheduled = false;
+      this.flush();
+    });
+  }
+
+  flush() {
+    const entries = this.queue.splice(0, this.batchSize);
+    if (this.queue.length) this.schedule();
+    const requests = [];
+    const failed = (entry, err) => {
+      this.pending.delete(entry.id);
+      entry.reject(err);
+    };
+    const ready = entries.filter((entry) => {
+      try {
+        const spec = this.requests(entry.identity);
+        entry.names = Object.keys(spec);
+        entry.names.forEach((name) => requests.push(spec[name]));
+        return true;
+      } catch (err) {
+        failed(entry, err);
+        return false;
+      }
+    });
+    let keys;
+    try {
+      keys = this.deriveBatch(requests);
+    } catch (err) {
+      logger.debug('batch failed', err.message);
+      ready.forEach((entry) => failed(entry, err));
+      return;
+    }
+    let i = 0;
+    ready.forEach((entry) => {
+      const derived = {};
+      entry.names.forEach((name) => {
+        derived[name] = keys[i++];
+      });
+      this.pending.delete(entry.id);
+      this.cache.set(entry.id, derived);
+      if (this.cache.size > this.cacheSize) {
+        this.cache.delete(this.cache.keys().next().value);
+      }
+      entry.resolve(derived);
+    });
+  }
+
+  // precomputes the keys of every card inserted in the devices' readers
+  watch(devices) {
+    const watchDevice = (device) => {
+      const inserted = (event) =>
+        this.keysForCard(event.card).catch((err) =>
+          logger.debug(`${device.name} not diversified`, err.message)
+        );
+      device.on('card-inserted', inserted);
+      this.listeners.push(() =>
+        device.removeListener('card-inserted', inserted)
+      );
+    };
+    const activated = (event) => watchDevice(event.device);
+    devices.on('device-activated', activated);
+    this.listeners.push(() =>
+      devices.removeListener('device-activated', activated)
+    );
+    devices.listDevices().forEach(watchDevice);
+    return this;
+  }
+
+  getStats() {
+    return Object.assign({}, this.stats, {
+      queued: this.queue.length,
+      cached: this.cache.size,
+    });
+  }
+
+  stop() {
+    this.listeners.forEach((remove) => remove());
+    this.listeners = [];
+  }
+}
+
+KeyDiversifier.constants = constants;
+KeyDiversifier.optionA = optionA;
+KeyDiversifier.optionB = optionB;
+
+module.exports = KeyDiversifier;
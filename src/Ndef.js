@@ -0,0 +1,196 @@
+'use strict';
+
+const TNF = {
+  EMPTY: 0x00,
+  WELL_KNOWN: 0x01,
+  MEDIA: 0x02,
+  ABSOLUTE_URI: 0x03,
+  EXTERNAL: 0x04,
+  UNKNOWN: 0x05,
+  UNCHANGED: 0x06,
+};
+
+const flags = {
+  MB: 0x80,
+  ME: 0x40,
+  CF: 0x20,
+  SR: 0x10,
+  IL: 0x08,
+};
+
+// NFC Forum URI record type definition, identifier codes 0x01 to 0x23
+const URI_PREFIXES = [
+  '',
+  'http://www.',
+  'https://www.',
+  'http://',
+  'https://',
+  'tel:',
+  'mailto:',
+  'ftp://anonymous:anonymous@',
+  'ftp://ftp.',
+  'ftps://',
+  'sftp://',
+  'smb://',
+  'nfs://',
+  'ftp://',
+  'dav://',
+  'news:',
+  'telnet://',
+  'imap:',
+  'rtsp://',
+  'urn:',
+  'pop:',
+  'sip:',
+  'sips:',
+  'tftp:',
+  'btspp://',
+  'btl2cap://',
+  'btgoep://',
+  'tcpobex://',
+  'irdaobex://',
+  'file://',
+  'urn:epc:id:',
+  'urn:epc:tag:',
+  'urn:epc:pat:',
+  'urn:epc:raw:',
+  'urn:epc:',
+  'urn:nfc:',
+];
+
+/*
+NFC Forum NDEF message. Parsed records hold views over the buffer they were
+read into: type, id and payload are not copied, except for chunked payloads,
+which are joined.
+*/
+class Ndef {
+  static parse(buffer, start, end) {
+    const records = [];
+    let offset = start || 0;
+    const limit = end === undefined ? buffer.length : end;
+    let chunks = null;
+    while (offset < limit) {
+      const header = buffer[offset++];
+      const typeLength = buffer[offset++];
+      let payloadLength;
+      if (header & flags.SR) {
+        payloadLength = buffer[offset++];
+      } else {
+        payloadLength = buffer.readUInt32BE(offset);
+        offset += 4;
+      }
+      const idLength = header & flags.IL ? buffer[offset++] : 0;
+      const type = buffer.subarray(offset, offset + typeLength);
+      offset += typeLength;
+      const id = buffer.subarray(offset, offset + idLength);
+      offset += idLength;
+      const payload = buffer.subarray(offset, offset + payloadLength);
+      offset += payloadLength;
+      if (offset > limit) {
+        throw new Error('NDEF record exceeds the message');
+      }
+      const tnf = header & 0x07;
+      if (chunks) {
+        chunks.payloads.push(payload);
+        if (!(header & flags.CF)) {
+          chunks.record.payload = Buffer.concat(chunks.payloads);
+          chunks = null;
+        }
+      } else {
+        const record = { tnf, type, id, payload };
+        records.push(record);
+        if (header & flags.CF) {
+          chunks = { record, payloads: [payload] };
+        }
+      }
+      if (header & flags.ME) {
+        break;
+      }
+    }
+    return records;
+  }
+
+  static encode(records) {
+    const parts = [];
+    records.forEach((record, i) => {
+      const type = Buffer.from(record.type || []);
+      const id = Buffer.from(record.id || []);
+      const payload = Buffer.from(record.payload || []);
+      const short = payload.length < 256;
+      let header = record.tnf === undefined ? TNF.WELL_KNOWN : record.tnf;
+      if (i === 0) header |= flags.MB;
+      if (i === records.length - 1) header |= flags.ME;
+      if (short) header |= flags.SR;
+      if (id.length) header |= flags.IL;
+      const head = [header, type.length];
+      if (short) {
+        head.push(payload.length);
+      } else {
+        head.push(
+          (payload.length >>> 24) & 0xff,
+          (payload.length >> 16) & 0xff,
+          (payload.length >> 8) & 0xff,
+          payload.length & 0xff
+        );
+      }
+      if (id.length) head.push(id.length);
+      parts.push(Buffer.from(head), type, id, payload);
+    });
+    return Buffer.concat(parts);
+  }
+
+  static textRecord(text, language) {
+    const lang = Buffer.from(language || 'en', 'ascii');
+    return {
+      tnf: TNF.WELL_KNOWN,
+      type: Buffer.from('T'),
+      payload: Buffer.concat([
+        Buffer.from([lang.length]),
+        lang,
+        Buffer.from(text, 'utf8'),
+      ]),
+    };
+  }
+
+  static uriRecord(uri) {
+    let code = 0;
+    URI_PREFIXES.forEach((prefix, i) => {
+      if (
+        i &&
+        uri.startsWith(prefix) &&
+        prefix.length > URI_PREFIXES[code].length
+      ) {
+        code = i;
+      }
+    });
+    return {
+      tnf: TNF.WELL_KNOWN,
+      type: Buffer.from('U'),
+      payload: Buffer.concat([
+        Buffer.from([code]),
+        Buffer.from(uri.substring(URI_PREFIXES[code].length), 'utf8'),
+      ]),
+    };
+  }
+
+  static decodeText(record) {
+    const status = record.payload[0];
+    const languageLength = status & 0x3f;
+    return {
+      language: record.payload.toString('ascii', 1, 1 + languageLength),
+      text: record.payload.toString(
+        status & 0x80 ? 'utf16le' : 'utf8',
+        1 + languageLength
+      ),
+    };
+  }
+
+  static decodeUri(record) {
+    const prefix = URI_PREFIXES[record.payload[0]] || '';
+    return prefix + record.payload.toString('utf8', 1);
+  }
+}
+
+Ndef.TNF = TNF;
+
+export default Ndef;
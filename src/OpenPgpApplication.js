@@ -0,0 +1,307 @@
+'use strict';
+
+import Atr from './Atr';
+import CommandApdu from './CommandApdu';
+import ResponseApdu from './ResponseApdu';
+import Iso7816Application from './Iso7816Application';
+import Stopwatch from './Stopwatch';
+import Tlv from './Tlv';
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('OpenPgpApplication');
+
+const AID = [0xd2, 0x76, 0x00, 0x01, 0x24, 0x01];
+
+const ins = {
+  GET_DATA: 0xca,
+  PSO: 0x2a,
+  VERIFY: 0x20,
+};
+
+const pw = {
+  PW1_SIGN: 0x81,
+  PW1: 0x82,
+  PW3: 0x83,
+};
+
+const tags = {
+  APPLICATION_RELATED_DATA: 0x6e,
+  HISTORICAL_BYTES: 0x5f52,
+  EXTENDED_LENGTH_INFO: 0x7f66,
+  EXTENDED_CAPABILITIES: 0xc0,
+  PW_STATUS_BYTES: 0xc4,
+};
+
+class OpenPgpApplication extends Iso7816Application {
+  constructor(card, options) {
+    super(card);
+    const opts = options || {};
+    this.capabilities = null;
+    this.verified = {};
+    // PW1 (81) is kept, to verify again before each PSO:CDS, only when
+    // asked for, and only until the card is removed
+    this.cachePin = !!opts.cachePin;
+    this.signingPin = null;
+    this.removedListener = null;
+  }
+
+  select() {
+    logger.debug(`select`);
+    this.verified = {};
+    return this.selectFile(AID);
+  }
+
+  readApplicationRelatedData(force) {
+    if (this.capabilities && !force) {
+      return Promise.resolve(this.capabilities);
+    }
+    return this.getData(0x00, tags.APPLICATION_RELATED_DATA).then(
+      (response) => {
+        if (!response.isOk()) {
+          throw new Error(
+            `GET DATA application related data failed '${response.getStatusCode()}'`
+          );
+        }
+        const nodes = Tlv.parse(Buffer.from(response.getDataOnly(), 'hex'));
+        this.capabilities = this.parseCapabilities(nodes);
+        logger.debug(`capabilities ${JSON.stringify(this.capabilities)}`);
+        return this.capabilities;
+      }
+    );
+  }
+
+  parseCapabilities(nodes) {
+    const historical = Tlv.find(nodes, tags.HISTORICAL_BYTES);
+    const historicalCapabilities = Atr.parseHistoricalBytes(
+      historical ? historical.value : Buffer.alloc(0)
+    );
+    const capabilities = {
+      extendedLength: historicalCapabilities.extendedLength,
+      commandChaining: historicalCapabilities.commandChaining,
+    };
+    capabilities.maxCommandLength = 255;
+    capabilities.maxResponseLength = 256;
+
+    const lengthInfo = Tlv.find(nodes, tags.EXTENDED_LENGTH_INFO);
+    if (lengthInfo && lengthInfo.children) {
+      const values = lengthInfo.children.filter((node) => node.tag === 0x02);
+      if (values.length === 2) {
+        capabilities.extendedLength = true;
+        capabilities.maxCommandLength = values[0].value.readUInt16BE(0);
+        capabilities.maxResponseLength = values[1].value.readUInt16BE(0);
+      }
+    }
+
+    const extended = Tlv.find(nodes, tags.EXTENDED_CAPABILITIES);
+    capabilities.extendedCapabilities = extended
+      ? extended.value.toString('hex')
+      : null;
+
+    const pwStatus = Tlv.find(nodes, tags.PW_STATUS_BYTES);
+    capabilities.pw1ValidForMultipleSignatures = pwStatus
+      ? pwStatus.value[0] === 0x01
+      : false;
+    return capabilities;
+  }
+
+  // PW1 (81) unless another reference is given, as signing needs it
+  verify(pin, reference) {
+    const ref = reference || pw.PW1_SIGN;
+    if (this.isVerified(ref)) {
+      logger.debug(`verify, PW '${ref.toString(16)}' already verified`);
+      return Promise.resolve(new ResponseApdu(Buffer.from([0x90, 0x00])));
+    }
+    const data = Buffer.isBuffer(pin) ? pin : Buffer.from(String(pin), 'utf8');
+    return this.issueCommand(
+      new CommandApdu({
+        cla: 0x00,
+        ins: ins.VERIFY,
+        p1: 0x00,
+        p2: ref,
+        data: Array.from(data),
+      })
+    ).then((response) => {
+      if (response.isOk()) {
+        this.verified[ref] = true;
+        if (ref === pw.PW1_SIGN && this.cachePin) {
+          this.keepPin(data);
+        }
+      } else {
+        delete this.verified[ref];
+        // never replay a PIN the card refused
+        if (ref === pw.PW1_SIGN) {
+          this.forgetPin();
+        }
+      }
+      return response;
+    });
+  }
+
+  keepPin(data) {
+    this.forgetPin();
+    this.signingPin = Buffer.from(data);
+    const device = this.card.device;
+    if (device && typeof device.on === 'function') {
+      this.removedListener = (event) => {
+        if (event.card === this.card) {
+          this.verified = {};
+          this.forgetPin();
+        }
+      };
+      device.on('card-removed', this.removedListener);
+    }
+  }
+
+  forgetPin() {
+    if (this.signingPin) {
+      this.signingPin.fill(0);
+      this.signingPin = null;
+    }
+    if (this.removedListener) {
+      this.card.device.removeListener('card-removed', this.removedListener);
+      this.removedListener = null;
+    }
+  }
+
+  isVerified(reference) {
+    return !!this.verified[reference];
+  }
+
+  ensureSigningVerified() {
+    if (this.isVerified(pw.PW1_SIGN)) {
+      return Promise.resolve();
+    }
+    if (!this.signingPin) {
+      return Promise.reject(
+        new Error('PW1 (81) has not been verified and no PIN is cached')
+      );
+    }
+    return this.verify(this.signingPin, pw.PW1_SIGN).then((response) => {
+      if (!response.isOk()) {
+        throw new Error(`VERIFY PW1 failed '${response.getStatusCode()}'`);
+      }
+    });
+  }
+
+  buildSignCommands(digestInfo) {
+    const data = Array.from(digestInfo);
+    const capabilities = this.capabilities || {};
+    const extended = capabilities.extendedLength;
+    const maxCommandLength = extended ? capabilities.maxCommandLength : 255;
+    const le = extended ? capabilities.maxResponseLength : 0;
+
+    if (data.length <= maxCommandLength) {
+      return [
+        new CommandApdu({
+          cla: 0x00,
+          ins: ins.PSO,
+          p1: 0x9e,
+          p2: 0x9a,
+          data,
+          le,
+          extended: extended && (data.length > 255 || le > 256),
+        }),
+      ];
+    }
+    if (!capabilities.commandChaining) {
+      throw new Error(
+        `digest info of ${data.length} bytes exceeds card limit of ${maxCommandLength}`
+      );
+    }
+    const commands = [];
+    for (let offset = 0; offset < data.length; offset += maxCommandLength) {
+      const last = offset + maxCommandLength >= data.length;
+      commands.push(
+        new CommandApdu({
+          cla: last ? 0x00 : 0x10,
+          ins: ins.PSO,
+          p1: 0x9e,
+          p2: 0x9a,
+          data: data.slice(offset, offset + maxCommandLength),
+          le: last ? le : 0,
+          extended,
+        })
+      );
+    }
+    return commands;
+  }
+
+  issueChain(commands) {
+    const last = commands[commands.length - 1];
+    return commands
+      .slice(0, -1)
+      .reduce(
+        (previous, command) =>
+          previous
+            .then(() => this.card.issueCommand(command))
+            .then((resp) => {
+              const response = new ResponseApdu(resp);
+              if (!response.isOk()) {
+                throw new Error(
+                  `command chaining failed '${response.getStatusCode()}'`
+                );
+              }
+            }),
+        Promise.resolve()
+      )
+      .then(() => this.issueCommand(last));
+  }
+
+  computeDigitalSignature(digestInfo, commands) {
+    const stopwatch = Stopwatch.start();
+    const chain = commands || this.buildSignCommands(digestInfo);
+    const attempt = (retry) =>
+      this.ensureSigningVerified()
+        .then(() => this.issueChain(chain))
+        .then((response) => {
+          // security status not satisfied, e.g. the card was reset
+          if (response.getStatusCode() === '6982' && retry) {
+            delete this.verified[pw.PW1_SIGN];
+            return attempt(false);
+          }
+          if (!response.isOk()) {
+            throw new Error(`PSO:CDS failed '${response.getStatusCode()}'`);
+          }
+          // PW1 (81) may only be valid for a single PSO:CDS
+          const capabilities = this.capabilities || {};
+          if (!capabilities.pw1ValidForMultipleSignatures) {
+            delete this.verified[pw.PW1_SIGN];
+          }
+          return response;
+        });
+    return attempt(true).then((response) => {
+      const result = {
+        signature: Buffer.from(response.getDataOnly(), 'hex'),
+        durationMs: stopwatch.elapsed(),
+      };
+      this.emit('signature-computed', result);
+      return result;
+    });
+  }
+
+  sign(digests) {
+    logger.debug(`sign, ${digests.length} digests`);
+    return this.readApplicationRelatedData().then(() => {
+      // build every command before the first exchange
+      const prepared = digests.map((digest) => this.buildSignCommands(digest));
+      const results = [];
+      return prepared
+        .reduce(
+          (previous, commands, index) =>
+            previous
+              .then(() =>
+                this.computeDigitalSignature(digests[index], commands)
+              )
+              .then((result) => {
+                results.push(result);
+              }),
+          Promise.resolve()
+        )
+        .then(() => results);
+    });
+  }
+}
+
+OpenPgpApplication.AID = AID;
+OpenPgpApplication.pw = pw;
+
+module.exports = OpenPgpApplication;
@@ -0,0 +1,224 @@
+'use strict';
+
+import { EventEmitter } from 'events';
+import ApduScript from './ApduScript';
+import CheckpointJournal from './CheckpointJournal';
+import Stopwatch from './Stopwatch';
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('Personalizer');
+
+// the contactless UID, else the CPLC from GET DATA 9F7F
+const defaultIdentify = (card) => {
+  if (card.uid) {
+    return Promise.resolve(card.uid.toString('hex'));
+  }
+  return new Promise((resolve, reject) => {
+    card.transmit(
+      Buffer.from([0x80, 0xca, 0x9f, 0x7f, 0x00]),
+      (err, response) => {
+        if (err) return reject(err);
+        if (response.readUInt16BE(response.length - 2) !== 0x9000) {
+          return reject(new Error('card has no UID or CPLC to identify it'));
+        }
+        resolve(response.subarray(0, response.length - 2).toString('hex'));
+      }
+    );
+  });
+};
+
+/*
+Runs a personalization script on every card inserted in any reader, all
+readers at once. Each confirmed step is appended to a checkpoint journal
+under the card's identity; a card that comes back after a crash or an
+early removal resumes after its last confirmed step. The prologue (select
+the application, open the secure channel) runs before every start or
+resume, as the session does not survive.
+*/
+class Personalizer extends EventEmitter {
+  constructor(devices, options) {
+    super();
+    const opts = options || {};
+    this.devices = devices;
+    this.plan = ApduScript.compile(opts.script);
+    this.prologue = opts.prologue ? ApduScript.compile(opts.prologue) : null;
+    this.journal =
+      opts.journal instanceof CheckpointJournal
+        ? opts.journal
+        : new CheckpointJournal(opts.journal, { sync: opts.sync });
+    this.identify = opts.identify || defaultIdentify;
+    this.variables = opts.variables || (() => ({}));
+    this.running = {};
+    this.listeners = [];
+    this.stopwatch = null;
+    this.stats = {
+      started: 0,
+      resumed: 0,
+      completed: 0,
+      failed: 0,
+      interrupted: 0,
+      skipped: 0,
+      commands: 0,
+    };
+  }
+
+  start() {
+    this.stopwatch = Stopwatch.start();
+    const watch = (device) => {
+      const inserted = (event) => this.personalize(device, event.card);
+      device.on('card-inserted', inserted);
+      this.listeners.push(() =>
+        device.removeListener('card-inserted', inserted)
+      );
+      if (device.card) this.personalize(device, device.card);
+    };
+    const activated = (event) => watch(event.device);
+    this.devices.on('device-activated', activated);
+    this.listeners.push(() =>
+      this.devices.removeListener('device-activated', activated)
+    );
+    this.devices.listDevices().forEach(watch);
+    return this;
+  }
+
+  /*
+  Resolves with the card's result, rejects only on journal errors. One run
+  per reader: a card inserted while the previous card's run has not settled
+  yet waits for it.
+  */
+  personalize(device, card) {
+    const current = this.running[device.name];
+    if (current && current.card === card) {
+      return current.run;
+    }
+    const previous = current ? current.run : Promise.resolve();
+    const entry = { card, run: null };
+    entry.run = previous
+      .then(() => this.run(device, card))
+      .then((result) => {
+        if (this.running[device.name] === entry) {
+          delete this.running[device.name];
+        }
+        return result;
+      });
+    this.running[device.name] = entry;
+    return entry.run;
+  }
+
+  run(device, card) {
+    const stopwatch = Stopwatch.start();
+    return this.identify(card)
+      .then((identity) => this.resume(card, identity, stopwatch))
+      .catch((err) => {
+        this.stats.interrupted++;
+        logger.debug(`${device.name} interrupted`, err.message);
+        const result = { device, error: err, durationMs: stopwatch.elapsed() };
+        this.emit('card-interrupted', result);
+        return result;
+      });
+  }
+
+  resume(card, identity, stopwatch) {
+    const checkpoint = this.journal.get(identity);
+    if (checkpoint && checkpoint.status !== 'running') {
+      this.stats.skipped++;
+      this.emit('card-skipped', { card, identity, status: checkpoint.status });
+      return { identity, status: checkpoint.status, skipped: true };
+    }
+    const from = checkpoint ? checkpoint.pc : 0;
+    const variables = checkpoint
+      ? checkpoint.variables
+      : this.variables(card, identity);
+    if (checkpoint) {
+      this.stats.resumed++;
+    } else {
+      this.stats.started++;
+      this.journal.append({
+        card: identity,
+        status: 'running',
+        pc: 0,
+        sw: null,
+        variables,
+      });
+    }
+    this.emit(checkpoint ? 'card-resumed' : 'card-started', {
+      card,
+      identity,
+      from,
+    });
+    const prologue = this.prologue
+      ? this.prologue.run(card, variables)
+      : Promise.resolve({ ok: true, variables: {} });
+    return prologue.then((opened) => {
+      if (opened.exceeded) {
+        throw new Error(`prologue repeat exceeded ${opened.exceeded.max}`);
+      }
+      if (!opened.ok) {
+        throw new Error(`prologue failed at step ${opened.failedStep}`);
+      }
+      // session values from the prologue are not journaled
+      const session = opened.variables;
+      return this.plan
+        .run(card, Object.assign({}, session, variables), {
+          from,
+          sw: checkpoint ? checkpoint.sw : undefined,
+          onStep: (pc, values, sw) => {
+            this.stats.commands++;
+            const kept = {};
+            Object.keys(values).forEach((name) => {
+              if (!(name in session) || name in variables) {
+                kept[name] = values[name];
+              }
+            });
+            this.journal.append({
+              card: identity,
+              status: 'running',
+              pc,
+              sw,
+              variables: kept,
+            });
+          },
+        })
+        .then((result) => {
+          const status = result.ok ? 'completed' : 'failed';
+          this.stats[status]++;
+          this.journal.append({
+            card: identity,
+            status,
+            failedStep: result.ok ? null : result.failedStep,
+            exceeded: result.exceeded || null,
+          });
+          const outcome = {
+            card,
+            identity,
+            status,
+            resumedFrom: from,
+            steps: result.steps.length,
+            durationMs: stopwatch.elapsed(),
+          };
+          this.emit(`card-${status}`, outcome);
+          return outcome;
+        });
+    });
+  }
+
+  getStats() {
+    const elapsedMs = this.stopwatch ? this.stopwatch.elapsed() : 0;
+    return Object.assign({}, this.stats, {
+      active: Object.keys(this.running).length,
+      elapsedMs,
+      cardsPerMinute: elapsedMs
+        ? (this.stats.completed * 60000) / elapsedMs
+        : 0,
+    });
+  }
+
+  stop() {
+    this.listeners.forEach((remove) => remove());
+    this.listeners = [];
+    return Promise.all(
+      Object.keys(this.running).map((name) => this.running[name].run)
+    ).then(() => this.journal.close());
+  }
+}
+
+module.exports = Personalizer;
@@ -0,0 +1,57 @@
+'use strict';
+
+import { EventEmitter } from 'events';
+import Card from './Card';
+import EventStream from './EventStream';
+import lazyLogger from './lazyLogger';
+
+const logger = lazyLogger('RemoteDevice');
+
+// a reader owned by a Broker, used like a Device
+class RemoteDevice extends EventEmitter {
+  constructor(devices, name) {
+    super();
+    logger.debug(`new RemoteDevice(${name})`);
+    this.devices = devices;
+    this.name = name;
+    this.card = null;
+  }
+
+  cardInserted(atr, protocol) {
+    this.card = new Card(this, atr, protocol);
+    this.emit('card-inserted', { device: this, card: this.card });
+  }
+
+  cardRemoved() {
+    const card = this.card;
+    this.card = null;
+    this.emit('card-removed', { name: this.name, card });
+  }
+
+  events(options) {
+    return EventStream.forDevice(this, options);
+  }
+
+  transmit(data, res_len, protocol, cb) {
+    this.devices.transmit(this.name, data, res_len, protocol, cb);
+  }
+
+  // until endTransaction(), the broker sends only this process's commands
+  beginTransaction() {
+    return this.devices.transaction(this.name, true);
+  }
+
+  endTransaction() {
+    return this.devices.transaction(this.name, false);
+  }
+
+  getName() {
+    return this.name;
+  }
+
+  toString() {
+    return `${this.getName()}`;
+  }
+}
+
+export default RemoteDevice;
@@ -0,0 +1,159 @@
+'use strict';
+
+import net from 'net';
+import { EventEmitter } from 'events';
+import RemoteDevice from './RemoteDevice';
+import {
+  defaultPath,
+  types,
+  encode,
+  FrameReader,
+} from './BrokerProtocol';
+import EventStream from './EventStream';
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('RemoteDevices');
+
+/*
+Devices served by a Broker in another process. Emits the same events as
+Devices, and its devices and cards are used the same way.
+*/
+class RemoteDevices extends EventEmitter {
+  constructor(options) {
+    super();
+    const opts = options || {};
+    this.path = opts.path || defaultPath();
+    logger.debug(`new RemoteDevices(${this.path})`);
+    this.devices = {};
+    this.pending = {};
+    this.nextId = 1;
+    this.reader = new FrameReader();
+
+    this.socket = net.createConnection(this.path);
+    this.socket.on('data', (chunk) => {
+      let messages;
+      try {
+        messages = this.reader.push(chunk);
+      } catch (error) {
+        this.emit('error', { error });
+        this.socket.destroy();
+        return;
+      }
+      messages.forEach((message) => this.dispatch(message));
+    });
+    this.socket.on('error', (error) => {
+      this.emit('error', { error });
+    });
+    this.socket.on('close', () => {
+      Object.keys(this.pending).forEach((id) => {
+        this.pending[id](new Error('broker connection closed'));
+      });
+      this.pending = {};
+      Object.keys(this.devices).forEach((name) => this.deactivated(name));
+    });
+  }
+
+  dispatch(message) {
+    const device = this.devices[message.name];
+    switch (message.type) {
+      case types.DEVICE_ACTIVATED: {
+        const activated = new RemoteDevice(this, message.name);
+        this.devices[message.name] = activated;
+        this.emit('device-activated', {
+          device: activated,
+          devices: this.listDevices(),
+        });
+        break;
+      }
+      case types.DEVICE_DEACTIVATED:
+        this.deactivated(message.name);
+        break;
+      case types.CARD_INSERTED:
+        if (device) device.cardInserted(message.atr, message.protocol);
+        break;
+      case types.CARD_REMOVED:
+        if (device) device.cardRemoved();
+        break;
+      case types.RESPONSE:
+      case types.ERROR: {
+        const callback = this.pending[message.id];
+        delete this.pending[message.id];
+        if (!callback) {
+          this.emit('error', { error: new Error(message.message) });
+        } else if (message.type === types.ERROR) {
+          callback(new Error(message.message));
+        } else {
+          callback(null, message.data);
+        }
+        break;
+      }
+    }
+  }
+
+  deactivated(name) {
+    const device = this.devices[name];
+    if (!device) {
+      return;
+    }
+    delete this.devices[name];
+    this.emit('device-deactivated', { device, devices: this.listDevices() });
+  }
+
+  request(type, fields, cb) {
+    const id = this.nextId;
+    this.nextId = this.nextId === 0xffffffff ? 1 : this.nextId + 1;
+    this.pending[id] = cb;
+    this.socket.write(encode(type, id, fields));
+  }
+
+  transmit(name, data, res_len, protocol, cb) {
+    this.request(
+      types.TRANSMIT,
+      { name, responseLength: res_len, protocol, data },
+      cb
+    );
+  }
+
+  transaction(name, begin) {
+    return new Promise((resolve, reject) =>
+      this.request(
+        begin ? types.BEGIN_TRANSACTION : types.END_TRANSACTION,
+        { name },
+        (err) => (err ? reject(err) : resolve())
+      )
+    );
+  }
+
+  onActivated() {
+    return new Promise((resolve) => {
+      this.once('device-activated', (event) => resolve(event));
+    });
+  }
+
+  onDeactivated() {
+    return new Promise((resolve) => {
+      this.once('device-deactivated', (event) => resolve(event));
+    });
+  }
+
+  events(options) {
+    return EventStream.forDevices(this, options);
+  }
+
+  listDevices() {
+    return Object.keys(this.devices).map((k) => this.devices[k]);
+  }
+
+  lookup(name) {
+    return this.devices[name];
+  }
+
+  close() {
+    this.socket.end();
+  }
+
+  toString() {
+    return `RemoteDevices('${this.listDevices()}')`;
+  }
+}
+
+module.exports = RemoteDevices;
@@ -0,0 +1,114 @@
+'use strict';
+
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('RetryPolicy');
+
+const codes = {
+  0x8010000a: 'SCARD_E_TIMEOUT',
+  0x8010000b: 'SCARD_E_SHARING_VIOLATION',
+  0x8010000c: 'SCARD_E_NO_SMARTCARD',
+  0x80100016: 'SCARD_E_NOT_TRANSACTED',
+  0x80100017: 'SCARD_E_READER_UNAVAILABLE',
+  0x8010001d: 'SCARD_E_NO_SERVICE',
+  0x8010002e: 'SCARD_E_NO_READERS_AVAILABLE',
+  0x80100067: 'SCARD_W_UNPOWERED_CARD',
+  0x80100068: 'SCARD_W_RESET_CARD',
+  0x80100069: 'SCARD_W_REMOVED_CARD',
+};
+
+// errors worth another attempt; an unpowered card needs a new handle first
+const defaultRules = {
+  SCARD_E_TIMEOUT: {},
+  SCARD_E_SHARING_VIOLATION: {},
+  SCARD_E_NOT_TRANSACTED: {},
+  SCARD_W_UNPOWERED_CARD: { reconnect: true },
+};
+
+// pcsclite puts the return code in the message, '... (0x8010000b)'
+const codeOf = (err) => {
+  const match = /\(0x([0-9a-f]{8})\)/i.exec(err.message || '');
+  if (!match) {
+    return null;
+  }
+  const code = parseInt(match[1], 16);
+  return codes[code] || `0x${match[1].toLowerCase()}`;
+};
+
+/*
+Decides whether and when a failed transmit is tried again. Errors are
+transient when a rule names their code, everything else is fatal. Delays
+grow exponentially with full jitter, and all attempts of one command stay
+within budgetMs.
+
+  new RetryPolicy({
+    maxAttempts: 5,
+    rules: { SCARD_E_TIMEOUT: { baseMs: 50 } },
+  })
+*/
+class RetryPolicy {
+  constructor(options) {
+    const opts = options || {};
+    this.maxAttempts = opts.maxAttempts || 3;
+    this.baseMs = opts.baseMs === undefined ? 10 : opts.baseMs;
+    this.maxDelayMs = opts.maxDelayMs || 250;
+    this.budgetMs = opts.budgetMs || 2000;
+    this.rules = Object.assign({}, defaultRules, opts.rules);
+    this.random = opts.random || Math.random;
+    this.stats = {
+      retries: 0,
+      recovered: 0,
+      exhausted: 0,
+      fatal: 0,
+      delayMs: 0,
+      byCode: {},
+    };
+  }
+
+  static from(options) {
+    if (!options || options instanceof RetryPolicy) return options;
+    return new RetryPolicy(options === true ? {} : options);
+  }
+
+  // { code, transient, rule }
+  classify(err) {
+    const code = codeOf(err);
+    const rule = code && this.rules[code];
+    return { code, transient: !!rule, rule: rule || null };
+  }
+
+  /*
+  Milliseconds to wait before the next attempt of a command whose
+  attempt-th try failed after elapsedMs, or -1 to give up.
+  */
+  delay(err, attempt, elapsedMs) {
+    const { code, transient, rule } = this.classify(err);
+    if (!transient) {
+      this.stats.fatal++;
+      return -1;
+    }
+    const maxAttempts = rule.maxAttempts || this.maxAttempts;
+    const base = rule.baseMs === undefined ? this.baseMs : rule.baseMs;
+    const maxDelayMs = rule.maxDelayMs || this.maxDelayMs;
+    const cap = Math.min(maxDelayMs, base * 2 ** attempt);
+    const delay = Math.floor(this.random() * cap);
+    if (attempt >= maxAttempts || elapsedMs + delay > this.budgetMs) {
+      logger.debug(`giving up on ${code} after ${attempt} attempts`);
+      this.stats.exhausted++;
+      return -1;
+    }
+    this.stats.retries++;
+    this.stats.delayMs += delay;
+    this.stats.byCode[code] = (this.stats.byCode[code] || 0) + 1;
+    return delay;
+  }
+
+  getStats() {
+    return Object.assign({}, this.stats, {
+      byCode: Object.assign({}, this.stats.byCode),
+    });
+  }
+}
+
+RetryPolicy.codeOf = codeOf;
+
+module.exports = RetryPolicy;
@@ -0,0 +1,168 @@
+'use strict';
+
+import CardCrypto from './CardCrypto';
+import Tlv from './Tlv';
+
+const increment = (counter) => {
+  for (let i = counter.length - 1; i >= 0; i--) {
+    counter[i] = (counter[i] + 1) & 0xff;
+    if (counter[i] !== 0) break;
+  }
+};
+
+const encodeLe = (le, extended) =>
+  extended ? [(le >> 8) & 0xff, le & 0xff] : [le & 0xff];
+
+/*
+ISO 7816-4 secure messaging as profiled by ICAO 9303-11, with either
+3DES (retail MAC, zero IV) or AES (CMAC, IV = E(KSenc, SSC)) session keys.
+*/
+class SecureMessaging {
+  constructor(options) {
+    this.cipher = options.cipher || '3des';
+    this.encKey = options.encKey;
+    this.macKey = options.macKey;
+    this.blockSize = this.cipher === 'aes' ? 16 : 8;
+    this.ssc = Buffer.from(options.ssc || Buffer.alloc(this.blockSize));
+  }
+
+  static parseCommand(bytes) {
+    const buffer = Buffer.from(bytes);
+    const command = {
+      cla: buffer[0],
+      ins: buffer[1],
+      p1: buffer[2],
+      p2: buffer[3],
+    };
+    const body = buffer.subarray(4);
+    if (body.length === 0) {
+      return command;
+    }
+    if (body.length === 1) {
+      command.le = body[0] || 256;
+    } else if (body[0] === 0x00 && body.length >= 3) {
+      command.extended = true;
+      if (body.length === 3) {
+        command.le = body.readUInt16BE(1) || 65536;
+      } else {
+        const lc = body.readUInt16BE(1);
+        command.data = body.subarray(3, 3 + lc);
+        if (body.length > 3 + lc) {
+          command.le = body.readUInt16BE(3 + lc) || 65536;
+        }
+      }
+    } else {
+      const lc = body[0];
+      command.data = body.subarray(1, 1 + lc);
+      if (body.length > 1 + lc) {
+        command.le = body[1 + lc] || 256;
+      }
+    }
+    return command;
+  }
+
+  encrypt(data) {
+    if (this.cipher === 'aes') {
+      const iv = CardCrypto.aesEcb(this.encKey, this.ssc);
+      return CardCrypto.aesEncrypt(this.encKey, data, iv);
+    }
+    return CardCrypto.tdesEncrypt(this.encKey, data);
+  }
+
+  decrypt(data) {
+    if (this.cipher === 'aes') {
+      const iv = CardCrypto.aesEcb(this.encKey, this.ssc);
+      return CardCrypto.aesDecrypt(this.encKey, data, iv);
+    }
+    return CardCrypto.tdesDecrypt(this.encKey, data);
+  }
+
+  // padded with ISO 9797-1 method 2 for both ciphers, as ICAO 9303-11 asks
+  mac(data) {
+    if (this.cipher === 'aes') {
+      const padded = CardCrypto.pad(data, 16);
+      return CardCrypto.aesCmac(this.macKey, padded).subarray(0, 8);
+    }
+    return CardCrypto.retailMac(this.macKey, data);
+  }
+
+  wrap(command) {
+    const odd = (command.ins & 0x01) === 0x01;
+    const cla = (command.cla & 0xf0) | 0x0c;
+    const header = Buffer.from([cla, command.ins, command.p1, command.p2]);
+    const extended =
+      command.extended ||
+      command.le > 256 ||
+      (command.data && command.data.length > 223);
+
+    increment(this.ssc);
+    let dataObject = Buffer.alloc(0);
+    if (command.data && command.data.length) {
+      const encrypted = this.encrypt(
+        CardCrypto.pad(command.data, this.blockSize)
+      );
+      dataObject = odd
+        ? Tlv.encode(0x85, encrypted)
+        : Tlv.encode(0x87, Buffer.concat([Buffer.from([0x01]), encrypted]));
+    }
+    const leObject =
+      command.le !== undefined
+        ? Tlv.encode(0x97, encodeLe(command.le, extended))
+        : Buffer.alloc(0);
+
+    const mac = this.mac(
+      Buffer.concat([
+        this.ssc,
+        CardCrypto.pad(header, this.blockSize),
+        dataObject,
+        leObject,
+      ])
+    );
+    const body = Buffer.concat([dataObject, leObject, Tlv.encode(0x8e, mac)]);
+    const lc = extended
+      ? [0x00, (body.length >> 8) & 0xff, body.length & 0xff]
+      : [body.length];
+    return {
+      bytes: Buffer.concat([
+        header,
+        Buffer.from(lc),
+        body,
+        Buffer.from(extended ? [0x00, 0x00] : [0x00]),
+      ]),
+      extended,
+    };
+  }
+
+  unwrap(response) {
+    const buffer = Buffer.from(response);
+    const sw = buffer.subarray(buffer.length - 2);
+    const nodes = Tlv.parse(buffer.subarray(0, buffer.length - 2));
+    const macObject = nodes.find((node) => node.tag === 0x8e);
+    if (!macObject) {
+      // plain status words, the card has left secure messaging
+      return buffer;
+    }
+    increment(this.ssc);
+    const covered = [];
+    let encrypted = null;
+    let statusWords = sw;
+    nodes.forEach((node) => {
+      if (node.tag === 0x87 || node.tag === 0x85 || node.tag === 0x99) {
+        covered.push(node.raw);
+      }
+      if (node.tag === 0x87) encrypted = node.value.subarray(1);
+      if (node.tag === 0x85) encrypted = node.value;
+      if (node.tag === 0x99) statusWords = node.value;
+    });
+    const expected = this.mac(Buffer.concat([this.ssc].concat(covered)));
+    if (!expected.equals(macObject.value)) {
+      throw new Error('secure messaging MAC verification failed');
+    }
+    const data = encrypted
+      ? CardCrypto.unpad(this.decrypt(encrypted))
+      : Buffer.alloc(0);
+    return Buffer.concat([data, statusWords]);
+  }
+}
+
+export default SecureMessaging;
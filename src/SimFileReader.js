@@ -0,0 +1,313 @@
+'use strict';
+
+import { Readable } from 'stream';
+import Iso7816Application from './Iso7816Application';
+import Stopwatch from './Stopwatch';
+import Tlv from './Tlv';
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('SimFileReader');
+
+const ins = {
+  READ_RECORD: 0xb2,
+  SEARCH_RECORD: 0xa2,
+  SELECT_FILE: 0xa4,
+};
+
+// 3GPP TS 23.038 default alphabet
+const GSM_ALPHABET =
+  '@£$¥èéùìòÇ\nØø\rÅåΔ_ΦΓΛΩΠΨΣΘΞ\u001bÆæßÉ' +
+  ' !"#¤%&\'()*+,-./0123456789:;<=>?' +
+  '¡ABCDEFGHIJKLMNOPQRSTUVWXYZÄÖÑÜ§' +
+  '¿abcdefghijklmnopqrstuvwxyzäöñüà';
+
+const BCD_DIGITS = '0123456789*#pwe';
+
+const decodeAlpha = (bytes) => {
+  if (bytes[0] === 0x80) {
+    let text = '';
+    for (let i = 1; i + 1 < bytes.length; i += 2) {
+      const code = bytes.readUInt16BE(i);
+      if (code === 0xffff) break;
+      text += String.fromCharCode(code);
+    }
+    return text;
+  }
+  let text = '';
+  for (let i = 0; i < bytes.length && bytes[i] !== 0xff; i++) {
+    text += GSM_ALPHABET[bytes[i] & 0x7f];
+  }
+  return text;
+};
+
+const decodeBcd = (bytes) => {
+  let digits = '';
+  for (let i = 0; i < bytes.length; i++) {
+    const low = bytes[i] & 0x0f;
+    const high = bytes[i] >> 4;
+    if (low === 0x0f) break;
+    digits += BCD_DIGITS[low];
+    if (high === 0x0f) break;
+    digits += BCD_DIGITS[high];
+  }
+  return digits;
+};
+
+// 3GPP TS 31.102 EF_ADN, EF_FDN, EF_SDN ...
+const decodeAdn = (data) => {
+  const alphaLength = data.length - 14;
+  const number = data.subarray(alphaLength);
+  const numberLength = number[0] === 0xff ? 0 : number[0];
+  const digits = decodeBcd(number.subarray(2, 1 + numberLength));
+  return {
+    name: decodeAlpha(data.subarray(0, alphaLength)),
+    number: numberLength && number[1] === 0x91 ? '+' + digits : digits,
+    ton: number[1],
+  };
+};
+
+// 3GPP TS 31.102 EF_SMS
+const decodeSms = (data) => ({
+  status: data[0],
+  pdu: data.subarray(1),
+});
+
+const decoders = {
+  adn: decodeAdn,
+  sms: decodeSms,
+};
+
+const parseFcp = (data) => {
+  const fcp = Tlv.find(Tlv.parse(data), 0x62);
+  if (!fcp) return null;
+  const descriptor = fcp.find(0x82);
+  const size = fcp.find(0x80);
+  const sfi = fcp.find(0x88);
+  const info = {
+    structure: descriptor ? descriptor.value[0] & 0x07 : undefined,
+    size: size ? size.value.readUIntBE(0, size.value.length) : undefined,
+    sfi: sfi && sfi.value.length ? sfi.value[0] >> 3 : undefined,
+  };
+  if (descriptor && descriptor.value.length >= 5) {
+    info.recordLength = descriptor.value.readUInt16BE(2);
+    info.recordCount = descriptor.value[4];
+  }
+  return info;
+};
+
+// GSM 11.11 response to SELECT
+const parseGsmResponse = (data) => {
+  const info = {
+    size: data.readUInt16BE(2),
+    structure: data[13] === 0x01 ? 0x02 : data[13] === 0x03 ? 0x06 : 0x01,
+  };
+  if (data.length > 14 && data[14]) {
+    info.recordLength = data[14];
+    info.recordCount = Math.floor(info.size / data[14]);
+  }
+  return info;
+};
+
+/*
+Bulk reader for linear fixed files on UICC (CLA 00) and GSM SIM (CLA A0).
+File information is read once per path, records are read in absolute mode
+with the exact record length as Le.
+*/
+class SimFileReader extends Iso7816Application {
+  constructor(card, options) {
+    super(card);
+    this.options = options || {};
+    this.cla = this.options.cla === undefined ? 0x00 : this.options.cla;
+    this.fileInfo = {};
+    this.searchSupported = this.options.searchRecord !== false;
+  }
+
+  isGsm() {
+    return this.cla === 0xa0;
+  }
+
+  status(response) {
+    return response.readUInt16BE(response.length - 2);
+  }
+
+  selectPath(path, withFcp) {
+    const fids = path.map((fid) => [(fid >> 8) & 0xff, fid & 0xff]);
+    if (this.isGsm()) {
+      // GSM has no path selection, select each level
+      return fids.reduce(
+        (previous, fid) =>
+          previous.then(() =>
+            this.exchange([this.cla, ins.SELECT_FILE, 0x00, 0x00, 2, ...fid])
+          ),
+        Promise.resolve()
+      );
+    }
+    // paths are relative to the MF
+    const bytes = [].concat(
+      ...fids.filter((fid, i) => i > 0 || fid[0] !== 0x3f)
+    );
+    return this.exchange(
+      [0x00, ins.SELECT_FILE, 0x08, withFcp ? 0x04 : 0x0c, bytes.length]
+        .concat(bytes)
+        .concat(withFcp ? [0x00] : [])
+    );
+  }
+
+  getFileInfo(path) {
+    const key = path.map((fid) => fid.toString(16)).join('/');
+    if (this.fileInfo[key]) {
+      return Promise.resolve(this.fileInfo[key]);
+    }
+    return this.selectPath(path, true).then((response) => {
+      const sw = this.status(response);
+      if (sw !== 0x9000 && (sw & 0xff00) !== 0x9100) {
+        throw new Error(`SELECT '${key}' failed '${sw.toString(16)}'`);
+      }
+      const data = response.subarray(0, response.length - 2);
+      const info = this.isGsm() ? parseGsmResponse(data) : parseFcp(data);
+      if (!info || !info.recordLength) {
+        throw new Error(`'${key}' is not a record file`);
+      }
+      info.path = path;
+      info.selected = true;
+      logger.debug(`getFileInfo ${key} ${JSON.stringify(info)}`);
+      this.fileInfo[key] = info;
+      return info;
+    });
+  }
+
+  // the file is selected on first use; with an SFI, READ RECORD needs no SELECT
+  prepare(info) {
+    if (info.selected || info.sfi) {
+      info.selected = false;
+      return Promise.resolve();
+    }
+    return this.selectPath(info.path, false);
+  }
+
+  recordP2(info) {
+    return info.sfi && !this.isGsm() ? (info.sfi << 3) | 0x04 : 0x04;
+  }
+
+  findEmptyRecords(info, fill) {
+    if (!this.searchSupported || this.isGsm()) {
+      return Promise.resolve(null);
+    }
+    const pattern = Buffer.alloc(info.recordLength, fill);
+    const command = Buffer.concat([
+      Buffer.from([this.cla, ins.SEARCH_RECORD, 0x01, this.recordP2(info)]),
+      Buffer.from([pattern.length]),
+      pattern,
+      Buffer.from([0x00]),
+    ]);
+    return this.exchange(command).then((response) => {
+      const sw = this.status(response);
+      if (sw === 0x6a83) {
+        return [];
+      }
+      if (sw !== 0x9000 && (sw & 0xff00) !== 0x9100) {
+        logger.debug(`SEARCH RECORD not supported '${sw.toString(16)}'`);
+        this.searchSupported = false;
+        return null;
+      }
+      return Array.from(response.subarray(0, response.length - 2));
+    });
+  }
+
+  readRecord(info, record) {
+    return this.exchange([
+      this.cla,
+      ins.READ_RECORD,
+      record,
+      this.recordP2(info),
+      info.recordLength,
+    ]).then((response) => {
+      const sw = this.status(response);
+      if (sw !== 0x9000 && (sw & 0xff00) !== 0x9100) {
+        throw new Error(`READ RECORD ${record} failed '${sw.toString(16)}'`);
+      }
+      return response.subarray(0, response.length - 2);
+    });
+  }
+
+  readRecords(path, options) {
+    const opts = options || {};
+    const fill = opts.fillPattern === undefined ? 0xff : opts.fillPattern;
+    const decode =
+      typeof opts.decoder === 'function'
+        ? opts.decoder
+        : decoders[opts.decoder] || ((data) => data);
+    const isEmpty =
+      opts.isEmpty || ((data) => data.every((byte) => byte === fill));
+    const stopwatch = Stopwatch.start();
+    let records = null;
+    let info;
+    const state = { reads: 0 };
+    const stream = new Readable({
+      objectMode: true,
+      read: () => {
+        const start = records
+          ? Promise.resolve()
+          : this.getFileInfo(path)
+              .then((fileInfo) => {
+                info = fileInfo;
+                return this.prepare(info);
+              })
+              .then(() => this.findEmptyRecords(info, fill))
+              .then((empty) => {
+                records = [];
+                for (let r = 1; r <= info.recordCount; r++) {
+                  if (!empty || empty.indexOf(r) < 0) records.push(r);
+                }
+              });
+        start
+          .then(() => this.nextEntry(info, records, isEmpty, decode, state))
+          .then((entry) => {
+            if (entry) {
+              stream.push(entry);
+            } else {
+              this.emit('records-read', {
+                path,
+                recordCount: info.recordCount,
+                reads: state.reads,
+                durationMs: stopwatch.elapsed(),
+              });
+              stream.push(null);
+            }
+          })
+          .catch((err) => stream.destroy(err));
+      },
+    });
+    return stream;
+  }
+
+  nextEntry(info, records, isEmpty, decode, state) {
+    const next = () => {
+      if (!records.length) {
+        return null;
+      }
+      const record = records.shift();
+      state.reads++;
+      return this.readRecord(info, record).then((data) => {
+        if (isEmpty(data)) {
+          return next();
+        }
+        return { record, data, entry: decode(data) };
+      });
+    };
+    return next();
+  }
+
+  readAllRecords(path, options) {
+    return new Promise((resolve, reject) => {
+      const entries = [];
+      this.readRecords(path, options)
+        .on('data', (entry) => entries.push(entry))
+        .on('error', reject)
+        .on('end', () => resolve(entries));
+    });
+  }
+}
+
+SimFileReader.decoders = decoders;
+
+module.exports = SimFileReader;
@@ -0,0 +1,23 @@
+'use strict';
+
+class Stopwatch {
+  constructor() {
+    this.started = process.hrtime.bigint();
+  }
+
+  static start() {
+    return new Stopwatch();
+  }
+
+  elapsed() {
+    return Number(process.hrtime.bigint() - this.started) / 1e6;
+  }
+
+  restart() {
+    const elapsed = this.elapsed();
+    this.started = process.hrtime.bigint();
+    return elapsed;
+  }
+}
+
+export default Stopwatch;
@@ -0,0 +1,283 @@
+'use strict';
+
+import { EventEmitter } from 'events';
+import Stopwatch from './Stopwatch';
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('StorageCard');
+
+const ins = {
+  GENERAL_AUTHENTICATE: 0x86,
+  LOAD_KEYS: 0x82,
+  READ_BINARY: 0xb0,
+  UPDATE_BINARY: 0xd6,
+};
+
+const KEY_A = 0x60;
+const KEY_B = 0x61;
+
+const DEFAULT_KEY = Buffer.from('ffffffffffff', 'hex');
+
+// largest working multi-block read, learned per reader
+const readerLimits = {};
+
+const statusWord = (response) =>
+  response.readUInt16BE(response.length - 2);
+
+/*
+PC/SC part 3 storage card access (MIFARE Classic, Ultralight, NTAG ...)
+through the reader's pseudo-APDUs.
+*/
+class StorageCard extends EventEmitter {
+  constructor(card, options) {
+    super();
+    const opts = options || {};
+    this.card = card;
+    this.blockSize = opts.blockSize || 16;
+    this.mifareClassic = opts.mifareClassic !== false && this.blockSize === 16;
+    this.keys = opts.keys || (() => ({ keyType: KEY_A, key: DEFAULT_KEY }));
+    this.readerName = card.device && card.device.name;
+    this.maxBlocksPerRead = Math.min(
+      256 / this.blockSize,
+      opts.maxBlocksPerRead ||
+        readerLimits[this.readerName] ||
+        (this.mifareClassic ? 4 : 16)
+    );
+    this.maxBlocksPerWrite = opts.maxBlocksPerWrite || 1;
+    this.loadedKeys = {};
+    this.authenticated = null;
+    this.stats = {
+      blocksRead: 0,
+      blocksWritten: 0,
+      commands: 0,
+      authentications: 0,
+      authenticationsSkipped: 0,
+      keyLoads: 0,
+      keyLoadsSkipped: 0,
+      busyMs: 0,
+    };
+  }
+
+  transmit(bytes) {
+    this.stats.commands++;
+    return this.card.issueCommand(Buffer.from(bytes));
+  }
+
+  sectorOf(block) {
+    if (!this.mifareClassic) return 0;
+    return block < 128 ? block >> 2 : 32 + ((block - 128) >> 4);
+  }
+
+  lastBlockOfSector(sector) {
+    return sector < 32 ? sector * 4 + 3 : 128 + (sector - 32) * 16 + 15;
+  }
+
+  loadKey(slot, key) {
+    const hex = Buffer.from(key).toString('hex');
+    if (this.loadedKeys[slot] === hex) {
+      this.stats.keyLoadsSkipped++;
+      return Promise.resolve();
+    }
+    logger.debug(`loadKey, slot=${slot}`);
+    this.stats.keyLoads++;
+    return this.transmit(
+      [0xff, ins.LOAD_KEYS, 0x00, slot, 0x06].concat(Array.from(key))
+    ).then((response) => {
+      if (statusWord(response) !== 0x9000) {
+        delete this.loadedKeys[slot];
+        throw new Error(`LOAD KEYS failed '${response.toString('hex')}'`);
+      }
+      this.loadedKeys[slot] = hex;
+      // a different key in the slot voids the current authentication
+      if (this.authenticated && this.authenticated.slot === slot) {
+        this.authenticated = null;
+      }
+    });
+  }
+
+  authenticate(block, keyType, slot) {
+    const sector = this.sectorOf(block);
+    const current = this.authenticated;
+    if (
+      current &&
+      current.sector === sector &&
+      current.keyType === keyType &&
+      current.slot === slot
+    ) {
+      this.stats.authenticationsSkipped++;
+      return Promise.resolve();
+    }
+    logger.debug(`authenticate, sector=${sector}`);
+    this.stats.authentications++;
+    this.authenticated = null;
+    return this.transmit([
+      0xff,
+      ins.GENERAL_AUTHENTICATE,
+      0x00,
+      0x00,
+      0x05,
+      0x01,
+      (block >> 8) & 0xff,
+      block & 0xff,
+      keyType,
+      slot,
+    ]).then((response) => {
+      if (statusWord(response) !== 0x9000) {
+        throw new Error(`authentication of block ${block} failed`);
+      }
+      this.authenticated = { sector, keyType, slot };
+    });
+  }
+
+  ensureAuthenticated(block) {
+    if (!this.mifareClassic) {
+      return Promise.resolve();
+    }
+    const sector = this.sectorOf(block);
+    const access = this.keys(sector);
+    const slot = access.slot || 0;
+    return this.loadKey(slot, access.key || DEFAULT_KEY).then(() =>
+      this.authenticate(block, access.keyType || KEY_A, slot)
+    );
+  }
+
+  // blocks [start, end) split so no command crosses a sector or the limit
+  plan(start, count, limit) {
+    const commands = [];
+    let block = start;
+    const end = start + count;
+    while (block < end) {
+      let n = Math.min(limit, end - block);
+      if (this.mifareClassic) {
+        const last = this.lastBlockOfSector(this.sectorOf(block));
+        n = Math.min(n, last - block + 1);
+      }
+      commands.push({ block, count: n });
+      block += n;
+    }
+    return commands;
+  }
+
+  readCommand(block, count) {
+    return this.ensureAuthenticated(block)
+      .then(() =>
+        this.transmit([
+          0xff,
+          ins.READ_BINARY,
+          (block >> 8) & 0xff,
+          block & 0xff,
+          (count * this.blockSize) & 0xff,
+        ])
+      )
+      .then((response) => {
+        const expected = count * this.blockSize;
+        const ok = statusWord(response) === 0x9000;
+        if (!ok || response.length - 2 < expected) {
+          // a failed command ends the MIFARE authentication
+          this.authenticated = null;
+          if (count > 1) {
+            return null;
+          }
+          throw new Error(
+            `READ BINARY block ${block} failed '${response.toString('hex')}'`
+          );
+        }
+        return response.subarray(0, expected);
+      });
+  }
+
+  readBlocks(start, count) {
+    const stopwatch = Stopwatch.start();
+    const chunks = [];
+    const end = start + count;
+    const read = (commands) => {
+      if (!commands.length) {
+        return Promise.resolve();
+      }
+      const command = commands[0];
+      return this.readCommand(command.block, command.count).then((data) => {
+        if (!data) {
+          // the reader refused the multi-block read, try half as many
+          this.maxBlocksPerRead = Math.max(1, command.count >> 1);
+          logger.debug(`maxBlocksPerRead now ${this.maxBlocksPerRead}`);
+          const block = command.block;
+          return read(this.plan(block, end - block, this.maxBlocksPerRead));
+        }
+        readerLimits[this.readerName] = this.maxBlocksPerRead;
+        chunks.push(data);
+        this.stats.blocksRead += command.count;
+        return read(commands.slice(1));
+      });
+    };
+    return read(this.plan(start, count, this.maxBlocksPerRead)).then(() => {
+      this.stats.busyMs += stopwatch.elapsed();
+      const data = Buffer.concat(chunks);
+      this.emit('blocks-read', {
+        start,
+        count,
+        durationMs: stopwatch.elapsed(),
+      });
+      return data;
+    });
+  }
+
+  writeBlocks(start, data) {
+    const stopwatch = Stopwatch.start();
+    if (data.length % this.blockSize !== 0) {
+      return Promise.reject(
+        new Error(`data must be a multiple of ${this.blockSize} bytes`)
+      );
+    }
+    const commands = this.plan(
+      start,
+      data.length / this.blockSize,
+      this.maxBlocksPerWrite
+    );
+    return commands
+      .reduce(
+        (previous, command) =>
+          previous
+            .then(() => this.ensureAuthenticated(command.block))
+            .then(() => {
+              const offset = (command.block - start) * this.blockSize;
+              const length = command.count * this.blockSize;
+              return this.transmit(
+                [
+                  0xff,
+                  ins.UPDATE_BINARY,
+                  (command.block >> 8) & 0xff,
+                  command.block & 0xff,
+                  length,
+                ].concat(Array.from(data.subarray(offset, offset + length)))
+              );
+            })
+            .then((response) => {
+              if (statusWord(response) !== 0x9000) {
+                this.authenticated = null;
+                const sw = response.toString('hex');
+                throw new Error(
+                  `UPDATE BINARY block ${command.block} failed '${sw}'`
+                );
+              }
+              this.stats.blocksWritten += command.count;
+            }),
+        Promise.resolve()
+      )
+      .then(() => {
+        this.stats.busyMs += stopwatch.elapsed();
+      });
+  }
+
+  getStats() {
+    const seconds = this.stats.busyMs / 1000;
+    const blocks = this.stats.blocksRead + this.stats.blocksWritten;
+    return Object.assign({}, this.stats, {
+      maxBlocksPerRead: this.maxBlocksPerRead,
+      blocksPerSecond: seconds > 0 ? blocks / seconds : 0,
+    });
+  }
+}
+
+StorageCard.KEY_A = KEY_A;
+StorageCard.KEY_B = KEY_B;
+
+module.exports = StorageCard;
@@ -0,0 +1,111 @@
+'use strict';
+
+import { EventEmitter } from 'events';
+
+const sw = (value) => Buffer.from([value >> 8, value & 0xff]);
+
+/*
+Stands in for a Device with a MIFARE Classic style or page based tag on
+the reader, answering the PC/SC part 3 pseudo-APDUs. Use it with
+`new Card(simulator, simulator.atr, 2)`.
+*/
+class StorageCardSimulator extends EventEmitter {
+  constructor(options) {
+    super();
+    const opts = options || {};
+    this.name = opts.name || 'Simulated Reader';
+    this.blockSize = opts.blockSize || 16;
+    this.blockCount = opts.blockCount || 64;
+    this.mifareClassic = opts.mifareClassic !== false && this.blockSize === 16;
+    this.maxBlocksPerRead = opts.maxBlocksPerRead || 1;
+    this.latencyMs = opts.latencyMs || 0;
+    this.uid = Buffer.from(opts.uid || [0x04, 0xa2, 0x4b, 0x1a]);
+    this.atr = Buffer.from(
+      opts.atr || '3b8f8001804f0ca000000306030001000000006a',
+      'hex'
+    );
+    this.memory = Buffer.alloc(this.blockCount * this.blockSize);
+    if (opts.memory) Buffer.from(opts.memory).copy(this.memory);
+    this.sectorKey = Buffer.from(opts.key || 'ffffffffffff', 'hex');
+    this.keySlots = {};
+    this.authenticatedSector = null;
+    this.commands = 0;
+  }
+
+  sectorOf(block) {
+    return block < 128 ? block >> 2 : 32 + ((block - 128) >> 4);
+  }
+
+  handle(command) {
+    this.commands++;
+    if (command[0] !== 0xff) return sw(0x6e00);
+    const block = command.readUInt16BE(2);
+    switch (command[1]) {
+      case 0xca:
+        return Buffer.concat([this.uid, sw(0x9000)]);
+      case 0x82:
+        this.keySlots[command[3]] = Buffer.from(command.subarray(5, 11));
+        return sw(0x9000);
+      case 0x86: {
+        const target = command.readUInt16BE(6);
+        const key = this.keySlots[command[9]];
+        if (!key || !key.equals(this.sectorKey)) {
+          this.authenticatedSector = null;
+          return sw(0x6300);
+        }
+        this.authenticatedSector = this.sectorOf(target);
+        return sw(0x9000);
+      }
+      case 0xb0: {
+        const length = command[4] || 256;
+        const count = Math.ceil(length / this.blockSize);
+        if (!this.allowed(block, count) || count > this.maxBlocksPerRead) {
+          this.authenticatedSector = null;
+          return sw(count > this.maxBlocksPerRead ? 0x6700 : 0x6982);
+        }
+        const offset = block * this.blockSize;
+        return Buffer.concat([
+          this.memory.subarray(offset, offset + length),
+          sw(0x9000),
+        ]);
+      }
+      case 0xd6: {
+        const data = command.subarray(5, 5 + command[4]);
+        const count = Math.ceil(data.length / this.blockSize);
+        if (!this.allowed(block, count)) {
+          this.authenticatedSector = null;
+          return sw(0x6982);
+        }
+        data.copy(this.memory, block * this.blockSize);
+        return sw(0x9000);
+      }
+      default:
+        return sw(0x6d00);
+    }
+  }
+
+  allowed(block, count) {
+    if (block + count > this.blockCount) return false;
+    if (!this.mifareClassic) return true;
+    const sector = this.sectorOf(block);
+    return (
+      this.authenticatedSector === sector &&
+      this.sectorOf(block + count - 1) === sector
+    );
+  }
+
+  transmit(data, res_len, protocol, cb) {
+    const response = this.handle(Buffer.from(data));
+    setTimeout(() => cb(null, response), this.latencyMs);
+  }
+
+  getName() {
+    return this.name;
+  }
+
+  toString() {
+    return `${this.getName()}`;
+  }
+}
+
+export default StorageCardSimulator;
@@ -0,0 +1,245 @@
+'use strict';
+
+import { Worker } from 'worker_threads';
+import CardCrypto from './CardCrypto';
+import Stopwatch from './Stopwatch';
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('StoreData');
+
+// GlobalPlatform STORE DATA P1
+const p1 = {
+  LAST_BLOCK: 0x80,
+  ENCRYPTED: 0x60,
+  DGI_FORMAT: 0x08,
+};
+
+const INS_STORE_DATA = 0xe2;
+
+// tag on two bytes, length on one, or FF and two for 255 and more
+const encodeDgi = (dgi, data) => {
+  const value = Buffer.from(data);
+  const header =
+    value.length < 0xff
+      ? [(dgi >> 8) & 0xff, dgi & 0xff, value.length]
+      : [(dgi >> 8) & 0xff, dgi & 0xff, 0xff, value.length >> 8, value.length];
+  return Buffer.concat([Buffer.from(header), value]);
+};
+
+const WORKER = `
+const { parentPort, workerData } = require('worker_threads');
+const StoreData = require(workerData.module);
+const storeData = new StoreData(workerData.options);
+parentPort.on('message', ({ id, dgis }) => {
+  try {
+    parentPort.postMessage({ id, commands: storeData.prepare(dgis) });
+  } catch (err) {
+    parentPort.postMessage({ id, error: err.message });
+  }
+});
+`;
+
+/*
+Personalization with GlobalPlatform STORE DATA in DGI format. prepare()
+encodes the DGIs, encrypts the sensitive ones with the DEK, packs them into
+numbered blocks, splitting only DGIs larger than a block, and flags the last
+one; it does not depend on the card, so the next card's commands can be
+prepared, with precompute() on a worker thread, while the current card is
+written. Secure messaging, which chains
+over the session, is applied by `wrap` when the commands are sent.
+*/
+class StoreData {
+  constructor(options) {
+    const opts = options || {};
+    this.options = opts;
+    this.cla = opts.cla === undefined ? 0x80 : opts.cla;
+    this.maxBlock = opts.maxBlock || 0xef;
+    this.sensitive = new Set(opts.sensitive || []);
+    this.dek = opts.dek ? Buffer.from(opts.dek) : null;
+    this.cipher = opts.cipher || '3des';
+    this.wrap = opts.wrap || null;
+    this.worker = null;
+    this.jobs = {};
+    this.nextJob = 1;
+    this.stats = { cards: 0, commands: 0, bytes: 0, busyMs: 0 };
+  }
+
+  // ECB under the DEK, padded with 80 00.. only when not block aligned
+  encrypt(value) {
+    if (!this.dek) {
+      throw new Error('sensitive DGI without a DEK');
+    }
+    const aes = this.cipher === 'aes';
+    const size = aes ? 16 : 8;
+    const padded = value.length % size ? CardCrypto.pad(value, size) : value;
+    return aes
+      ? CardCrypto.aesEcb(this.dek, padded)
+      : CardCrypto.tdesEcb(this.dek, padded);
+  }
+
+  // [{ dgi, data }] to STORE DATA commands without secure messaging
+  prepare(dgis) {
+    const blocks = [];
+    let current = null;
+    const flush = () => {
+      if (current && current.parts.length) blocks.push(current);
+      current = null;
+    };
+    dgis.forEach(({ dgi, data }) => {
+      const encrypted = this.sensitive.has(dgi);
+      const value = encrypted ? this.encrypt(Buffer.from(data)) : data;
+      let encoded = encodeDgi(dgi, value);
+      if (current && current.encrypted !== encrypted) flush();
+      // a DGI that fits in a block is not split over two
+      if (
+        current &&
+        encoded.length <= this.maxBlock &&
+        current.length + encoded.length > this.maxBlock
+      ) {
+        flush();
+      }
+      while (encoded.length) {
+        if (!current) current = { encrypted, parts: [], length: 0 };
+        const room = this.maxBlock - current.length;
+        const part = encoded.subarray(0, room);
+        current.parts.push(part);
+        current.length += part.length;
+        encoded = encoded.subarray(part.length);
+        if (current.length === this.maxBlock) flush();
+      }
+    });
+    flush();
+    if (blocks.length > 0x100) {
+      throw new Error(`${blocks.length} blocks, at most 256 can be numbered`);
+    }
+    return blocks.map((block, i) => {
+      const last = i === blocks.length - 1;
+      const data = Buffer.concat(block.parts);
+      const flags =
+        p1.DGI_FORMAT |
+        (block.encrypted ? p1.ENCRYPTED : 0) |
+        (last ? p1.LAST_BLOCK : 0);
+      return Buffer.concat([
+        Buffer.from([this.cla, INS_STORE_DATA, flags, i, data.length]),
+        data,
+      ]);
+    });
+  }
+
+  // resolves with prepare(dgis), computed on a worker thread when the
+  // worker option is set
+  precompute(dgis) {
+    const stopwatch = Stopwatch.start();
+    if (!this.options.worker) {
+      return new Promise((resolve, reject) =>
+        setImmediate(() => {
+          try {
+            resolve(this.prepared(this.prepare(dgis), stopwatch));
+          } catch (err) {
+            reject(err);
+          }
+        })
+      );
+    }
+    const worker = this.startWorker();
+    const id = this.nextJob++;
+    worker.ref();
+    return new Promise((resolve, reject) => {
+      this.jobs[id] = { resolve, reject, stopwatch };
+      worker.postMessage({
+        id,
+        dgis: dgis.map(({ dgi, data }) => ({ dgi, data: Buffer.from(data) })),
+      });
+    });
+  }
+
+  prepared(commands, stopwatch) {
+    commands.precomputeMs = stopwatch.elapsed();
+    return commands;
+  }
+
+  startWorker() {
+    if (this.worker) {
+      return this.worker;
+    }
+    const options = Object.assign({}, this.options, {
+      worker: false,
+      wrap: null,
+    });
+    this.worker = new Worker(WORKER, {
+      eval: true,
+      workerData: { module: __filename, options },
+    });
+    this.worker.on('message', ({ id, commands, error }) => {
+      const job = this.jobs[id];
+      delete this.jobs[id];
+      if (!Object.keys(this.jobs).length) this.worker.unref();
+      if (error) return job.reject(new Error(error));
+      const buffers = commands.map((command) => Buffer.from(command));
+      job.resolve(this.prepared(buffers, job.stopwatch));
+    });
+    this.worker.on('error', (err) => {
+      logger.debug(`worker failed`, err);
+      Object.keys(this.jobs).forEach((id) => this.jobs[id].reject(err));
+      this.jobs = {};
+      this.worker = null;
+    });
+    return this.worker;
+  }
+
+  /*
+  Sends prepared commands, wrapped for secure messaging if configured, in
+  one batch that stops at the first failure. Resolves with the card's
+  throughput.
+  */
+  send(card, commands) {
+    const stopwatch = Stopwatch.start();
+    const wrapped = this.wrap ? commands.map((c) => this.wrap(c)) : commands;
+    const failed = (response) =>
+      response.readUInt16BE(response.length - 2) !== 0x9000;
+    return card
+      .issueBatch(wrapped, (i, response) => !failed(response))
+      .then((results) => {
+        const last = results[results.length - 1];
+        if (last && failed(last.response)) {
+          const sw = last.response.subarray(-2).toString('hex');
+          throw new Error(
+            `STORE DATA block ${results.length - 1} failed '${sw}'`
+          );
+        }
+        const durationMs = stopwatch.elapsed();
+        const bytes = wrapped.reduce((sum, c) => sum + c.length, 0);
+        this.stats.cards++;
+        this.stats.commands += wrapped.length;
+        this.stats.bytes += bytes;
+        this.stats.busyMs += durationMs;
+        return {
+          commands: wrapped.length,
+          bytes,
+          durationMs,
+          precomputeMs: commands.precomputeMs || 0,
+          commandsPerSecond: (wrapped.length * 1000) / durationMs,
+          bytesPerSecond: (bytes * 1000) / durationMs,
+        };
+      });
+  }
+
+  personalize(card, dgis) {
+    return this.send(card, this.prepare(dgis));
+  }
+
+  getStats() {
+    return Object.assign({}, this.stats);
+  }
+
+  close() {
+    if (this.worker) {
+      this.worker.terminate();
+      this.worker = null;
+    }
+  }
+}
+
+StoreData.encodeDgi = encodeDgi;
+StoreData.p1 = p1;
+
+module.exports = StoreData;
@@ -0,0 +1,92 @@
+'use strict';
+
+import { isMainThread } from 'worker_threads';
+import hexify from 'hexify';
+import ResponseApdu from './ResponseApdu';
+import SyncTransmit from './SyncTransmit';
+
+const { layout, states } = SyncTransmit;
+
+/*
+Worker side of a SyncTransmit: transmitSync() blocks the thread until the
+response is back, so a worker can run straight-line APDU code without
+callbacks or promises. Blocking is not allowed on the main thread.
+
+  const card = new SyncCard(workerData.channel);
+  const response = card.transmitSync([0x00, 0xb0, 0x00, 0x00, 0x10]);
+*/
+class SyncCard {
+  constructor(channel, options) {
+    if (isMainThread) {
+      throw new Error('SyncCard blocks, use it in a worker thread');
+    }
+    const opts = options || {};
+    this.timeoutMs = opts.timeoutMs || 30000;
+    this.port = channel.port;
+    this.header = new Int32Array(channel.buffer, 0, layout.HEADER_BYTES >> 2);
+    this.data = Buffer.from(channel.buffer, layout.HEADER_BYTES);
+    this.closed = false;
+    this.closedBy = null;
+  }
+
+  transmitSync(commandApdu) {
+    if (Atomics.load(this.header, layout.STATE) === states.CLOSED) {
+      this.closed = true;
+    }
+    if (this.closed) {
+      throw new Error(this.closedBy || 'card closed');
+    }
+    let buffer;
+    if (Buffer.isBuffer(commandApdu)) {
+      buffer = commandApdu;
+    } else if (Array.isArray(commandApdu)) {
+      buffer = Buffer.from(commandApdu);
+    } else if (typeof commandApdu === 'string') {
+      buffer = Buffer.from(hexify.toByteArray(commandApdu));
+    } else {
+      buffer = commandApdu.toBuffer();
+    }
+    if (buffer.length > this.data.length) {
+      throw new Error(`command of ${buffer.length} bytes too long`);
+    }
+    buffer.copy(this.data, 0);
+    Atomics.store(this.header, layout.LENGTH, buffer.length);
+    Atomics.store(this.header, layout.STATE, states.REQUEST);
+    if (Atomics.load(this.header, layout.NOTIFIED)) {
+      Atomics.notify(this.header, layout.STATE);
+    } else {
+      this.port.postMessage(0);
+    }
+    const woken = Atomics.wait(
+      this.header,
+      layout.STATE,
+      states.REQUEST,
+      this.timeoutMs
+    );
+    if (woken === 'timed-out') {
+      // the host may still answer, into the buffer a next command would
+      // use: the channel cannot be trusted any more
+      this.closed = true;
+      this.closedBy = `card unusable, no response within ${this.timeoutMs}ms`;
+      throw new Error(`no response within ${this.timeoutMs}ms`);
+    }
+    const state = Atomics.load(this.header, layout.STATE);
+    const length = Atomics.load(this.header, layout.LENGTH);
+    Atomics.store(this.header, layout.STATE, states.IDLE);
+    if (state === states.CLOSED) {
+      this.closed = true;
+      throw new Error('card closed');
+    }
+    if (state === states.FAILED) {
+      throw new Error(this.data.toString('utf8', 0, length));
+    }
+    return new ResponseApdu(Buffer.from(this.data.subarray(0, length)));
+  }
+
+  close() {
+    this.closed = true;
+    this.port.close();
+  }
+}
+
+module.exports = SyncCard;
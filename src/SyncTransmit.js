@@ -0,0 +1,108 @@
+'use strict';
+
+import { MessageChannel } from 'worker_threads';
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('SyncTransmit');
+
+// Int32 header of the shared buffer, the APDU bytes follow it
+const layout = {
+  STATE: 0,
+  LENGTH: 1,
+  // set when the host waits on STATE instead of on port messages
+  NOTIFIED: 2,
+  HEADER_BYTES: 16,
+};
+
+const states = {
+  IDLE: 0,
+  REQUEST: 1,
+  DONE: 2,
+  FAILED: 3,
+  CLOSED: 4,
+};
+
+/*
+Lends a card to a worker thread for blocking exchanges. The worker writes a
+command into the shared buffer and sleeps in Atomics.wait; this side sends
+it with card.transmit() and wakes the worker with the response. Hand
+`channel()` to the worker and build a SyncCard from it there.
+*/
+class SyncTransmit {
+  constructor(card, options) {
+    const opts = options || {};
+    this.card = card;
+    this.capacity = opts.capacity || 0x10000 + 2;
+    this.buffer = new SharedArrayBuffer(layout.HEADER_BYTES + this.capacity);
+    this.header = new Int32Array(this.buffer, 0, layout.HEADER_BYTES >> 2);
+    this.data = Buffer.from(this.buffer, layout.HEADER_BYTES, this.capacity);
+    const { port1, port2 } = new MessageChannel();
+    this.port = port1;
+    this.workerPort = port2;
+    // where available the worker's notify wakes us, no message per command
+    this.notified = typeof Atomics.waitAsync === 'function';
+    if (this.notified) {
+      Atomics.store(this.header, layout.NOTIFIED, 1);
+      this.watch();
+    } else {
+      this.port.on('message', () => this.serve());
+    }
+  }
+
+  // { buffer, port } for workerData, with the port in the transfer list
+  channel() {
+    return { buffer: this.buffer, port: this.workerPort };
+  }
+
+  watch() {
+    const state = Atomics.load(this.header, layout.STATE);
+    if (state === states.CLOSED) {
+      return;
+    }
+    if (state === states.REQUEST) {
+      return this.serve();
+    }
+    const wait = Atomics.waitAsync(this.header, layout.STATE, state);
+    if (wait.async) {
+      wait.value.then(() => this.watch());
+    } else {
+      this.watch();
+    }
+  }
+
+  serve() {
+    const length = Atomics.load(this.header, layout.LENGTH);
+    const command = Buffer.from(this.data.subarray(0, length));
+    this.card.transmit(command, (err, response) => {
+      if (!err && response.length > this.capacity) {
+        err = new Error(`response of ${response.length} bytes too long`);
+      }
+      if (err) {
+        logger.debug(`transmit failed`, err);
+        const written = this.data.write(err.message, 0, 'utf8');
+        this.complete(states.FAILED, written);
+      } else {
+        response.copy(this.data, 0);
+        this.complete(states.DONE, response.length);
+      }
+      if (this.notified) {
+        this.watch();
+      }
+    });
+  }
+
+  complete(state, length) {
+    Atomics.store(this.header, layout.LENGTH, length);
+    Atomics.store(this.header, layout.STATE, state);
+    Atomics.notify(this.header, layout.STATE);
+  }
+
+  close() {
+    this.complete(states.CLOSED, 0);
+    this.port.close();
+  }
+}
+
+SyncTransmit.layout = layout;
+SyncTransmit.states = states;
+
+module.exports = SyncTransmit;
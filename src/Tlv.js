@@ -0,0 +1,135 @@
+'use strict';
+
+const isConstructed = (tag) => {
+  let first = tag;
+  while (first > 0xff) {
+    first = first >>> 8;
+  }
+  return (first & 0x20) === 0x20;
+};
+
+const readTag = (buffer, offset) => {
+  let tag = buffer[offset++];
+  if ((tag & 0x1f) === 0x1f) {
+    let next;
+    do {
+      next = buffer[offset++];
+      tag = tag * 256 + next;
+    } while (next & 0x80 && offset < buffer.length);
+  }
+  return { tag, offset };
+};
+
+const readLength = (buffer, offset) => {
+  let length = buffer[offset++];
+  if (length & 0x80) {
+    const count = length & 0x7f;
+    length = 0;
+    for (let i = 0; i < count; i++) {
+      length = length * 256 + buffer[offset++];
+    }
+  }
+  return { length, offset };
+};
+
+const encodeTag = (tag) => {
+  const bytes = [];
+  do {
+    bytes.unshift(tag & 0xff);
+    tag = Math.floor(tag / 256);
+  } while (tag > 0);
+  return bytes;
+};
+
+const encodeLength = (length) => {
+  if (length < 0x80) return [length];
+  const bytes = [];
+  while (length > 0) {
+    bytes.unshift(length & 0xff);
+    length = Math.floor(length / 256);
+  }
+  return [0x80 | bytes.length].concat(bytes);
+};
+
+/*
+BER-TLV as used by ISO 7816-4 / EMV. Values are views over the source buffer,
+constructed objects are parsed recursively into `children`.
+*/
+class Tlv {
+  constructor(tag, value, children, raw) {
+    this.tag = tag;
+    this.value = value;
+    this.children = children;
+    this.raw = raw;
+  }
+
+  static parse(buffer, start, end) {
+    if (!Buffer.isBuffer(buffer)) {
+      buffer = Buffer.from(buffer);
+    }
+    let offset = start || 0;
+    const limit = end === undefined ? buffer.length : end;
+    const nodes = [];
+    while (offset < limit) {
+      // padding between objects (EMV allows 00 and FF)
+      if (buffer[offset] === 0x00 || buffer[offset] === 0xff) {
+        offset++;
+        continue;
+      }
+      const begin = offset;
+      const t = readTag(buffer, offset);
+      const l = readLength(buffer, t.offset);
+      const valueEnd = Math.min(l.offset + l.length, limit);
+      const value = buffer.subarray(l.offset, valueEnd);
+      const children = isConstructed(t.tag)
+        ? Tlv.parse(buffer, l.offset, valueEnd)
+        : undefined;
+      const raw = buffer.subarray(begin, valueEnd);
+      nodes.push(new Tlv(t.tag, value, children, raw));
+      offset = valueEnd;
+    }
+    return nodes;
+  }
+
+  static find(nodes, tag) {
+    for (const node of nodes) {
+      if (node.tag === tag) return node;
+      if (node.children) {
+        const found = Tlv.find(node.children, tag);
+        if (found) return found;
+      }
+    }
+    return undefined;
+  }
+
+  static findAll(nodes, tag, found) {
+    found = found || [];
+    for (const node of nodes) {
+      if (node.tag === tag) found.push(node);
+      if (node.children) Tlv.findAll(node.children, tag, found);
+    }
+    return found;
+  }
+
+  static encode(tag, value) {
+    const body = Buffer.isBuffer(value) ? value : Buffer.from(value || []);
+    return Buffer.concat([
+      Buffer.from(encodeTag(tag).concat(encodeLength(body.length))),
+      body,
+    ]);
+  }
+
+  static encodeLength(length) {
+    return Buffer.from(encodeLength(length));
+  }
+
+  find(tag) {
+    return this.children ? Tlv.find(this.children, tag) : undefined;
+  }
+
+  toString() {
+    return `Tlv(${this.tag.toString(16)}:${this.value.toString('hex')})`;
+  }
+}
+
+export default Tlv;
@@ -0,0 +1,261 @@
+'use strict';
+
+import { EventEmitter } from 'events';
+import Ndef from './Ndef';
+import StorageCard from './StorageCard';
+import Stopwatch from './Stopwatch';
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('Type2Tag');
+
+const PAGE_SIZE = 4;
+const DATA_AREA = 16;
+// every Type 2 tag has at least 16 pages
+const MIN_PAGES = 16;
+
+const tlv = {
+  NULL: 0x00,
+  LOCK_CONTROL: 0x01,
+  MEMORY_CONTROL: 0x02,
+  NDEF_MESSAGE: 0x03,
+  PROPRIETARY: 0xfd,
+  TERMINATOR: 0xfe,
+};
+
+const encodeNdefTlv = (message) => {
+  const head =
+    message.length < 0xff
+      ? [tlv.NDEF_MESSAGE, message.length]
+      : [tlv.NDEF_MESSAGE, 0xff, message.length >> 8, message.length & 0xff];
+  return Buffer.concat([
+    Buffer.from(head),
+    message,
+    Buffer.from([tlv.TERMINATOR]),
+  ]);
+};
+
+/*
+NDEF on NFC Forum Type 2 tags (MIFARE Ultralight, NTAG ...). Pages are read
+several at a time through StorageCard, the capability container and the
+start of the data area come back in the first command.
+*/
+class Type2Tag extends EventEmitter {
+  constructor(card, options) {
+    super();
+    const opts = options || {};
+    this.storage = new StorageCard(card, {
+      blockSize: PAGE_SIZE,
+      mifareClassic: false,
+      maxBlocksPerRead: opts.maxPagesPerRead,
+    });
+    this.memory = Buffer.alloc(0);
+    this.capabilities = null;
+  }
+
+  // the tag memory from page 0, read on demand up to at least `length`
+  // bytes, a full command's worth of pages at a time
+  ensure(length) {
+    if (this.memory.length >= length) {
+      return Promise.resolve(this.memory);
+    }
+    const have = this.memory.length / PAGE_SIZE;
+    const total = this.capabilities
+      ? (DATA_AREA + this.capabilities.size) / PAGE_SIZE
+      : MIN_PAGES;
+    const needed = Math.ceil(length / PAGE_SIZE) - have;
+    const pages = Math.max(
+      needed,
+      Math.min(this.storage.maxBlocksPerRead, total - have)
+    );
+    return this.storage.readBlocks(have, pages).then((data) => {
+      this.memory = Buffer.concat([this.memory, data]);
+      return this.memory;
+    });
+  }
+
+  readCapabilities() {
+    if (this.capabilities) {
+      return Promise.resolve(this.capabilities);
+    }
+    return this.ensure(DATA_AREA).then((memory) => {
+      const cc = memory.subarray(12, 16);
+      if (cc[0] !== 0xe1) {
+        const hex = cc.toString('hex');
+        throw new Error(`no NDEF capability container '${hex}'`);
+      }
+      this.capabilities = {
+        version: cc[1],
+        size: cc[2] * 8,
+        readAccess: cc[3] >> 4,
+        writeAccess: cc[3] & 0x0f,
+      };
+      logger.debug(`capabilities ${JSON.stringify(this.capabilities)}`);
+      return this.capabilities;
+    });
+  }
+
+  /*
+  Walks the TLVs of the data area: ndef is the offset, header length and
+  length of the NDEF message TLV, free the offset a new one can go at, the
+  terminator or the NULL TLVs just before it. Lock and Memory Control TLVs
+  ahead of it are left in place.
+  */
+  scanTlvs() {
+    const end = DATA_AREA + this.capabilities.size;
+    const next = (offset, nulls) => {
+      if (offset >= end) {
+        return Promise.resolve({ ndef: null, free: nulls || offset });
+      }
+      return this.ensure(Math.min(offset + 4, end)).then((memory) => {
+        const tag = memory[offset];
+        if (tag === tlv.NULL) {
+          return next(offset + 1, nulls || offset);
+        }
+        if (tag === tlv.TERMINATOR) {
+          return { ndef: null, free: nulls || offset };
+        }
+        const wide = memory[offset + 1] === 0xff;
+        const length = wide
+          ? memory.readUInt16BE(offset + 2)
+          : memory[offset + 1];
+        const header = wide ? 4 : 2;
+        if (tag === tlv.NDEF_MESSAGE) {
+          return { ndef: { offset, header, length }, free: offset };
+        }
+        return next(offset + header + length, null);
+      });
+    };
+    return next(DATA_AREA, null);
+  }
+
+  // offset, header length and length of the NDEF message TLV
+  findNdefTlv() {
+    return this.scanTlvs().then((found) => found.ndef);
+  }
+
+  readNdef() {
+    const stopwatch = Stopwatch.start();
+    const commands = this.storage.stats.commands;
+    return this.readCapabilities()
+      .then((cc) => {
+        if (cc.readAccess !== 0x00) {
+          throw new Error(`NDEF is not readable '${cc.readAccess}'`);
+        }
+        return this.findNdefTlv();
+      })
+      .then((found) => {
+        if (!found) {
+          return [];
+        }
+        const start = found.offset + found.header;
+        return this.ensure(start + found.length).then((memory) => {
+          this.emit('ndef-read', {
+            length: found.length,
+            reads: this.storage.stats.commands - commands,
+            durationMs: stopwatch.elapsed(),
+          });
+          return Ndef.parse(memory, start, start + found.length);
+        });
+      });
+  }
+
+  /*
+  A reader never sees a mix of the old and new message: the TLV length is
+  zeroed first, then the other pages are written in order and the length
+  goes last. Pages already holding the right bytes are skipped.
+  */
+  writeNdef(records) {
+    const stopwatch = Stopwatch.start();
+    const message = Buffer.isBuffer(records) ? records : Ndef.encode(records);
+    const encoded = encodeNdefTlv(message);
+    let offset;
+    return this.readCapabilities()
+      .then((cc) => {
+        if (cc.writeAccess !== 0x00) {
+          throw new Error(`NDEF is read only '${cc.writeAccess}'`);
+        }
+        return this.scanTlvs();
+      })
+      .then((found) => {
+        offset = found.free;
+        const end = DATA_AREA + this.capabilities.size;
+        if (offset + encoded.length - 1 > end) {
+          throw new Error(`NDEF message of ${message.length} bytes too long`);
+        }
+        const firstPage = Math.floor(offset / PAGE_SIZE);
+        const lastPage = Math.ceil(
+          Math.min(offset + encoded.length, end) / PAGE_SIZE
+        );
+        const pages = Buffer.alloc((lastPage - firstPage) * PAGE_SIZE);
+        this.memory.copy(pages, 0, firstPage * PAGE_SIZE, offset);
+        encoded.copy(pages, offset - firstPage * PAGE_SIZE);
+        const header = encoded[1] === 0xff ? 4 : 2;
+        // the same pages with a TLV of length 0
+        const emptied = Buffer.from(pages);
+        const lengthEnd = offset - firstPage * PAGE_SIZE + header;
+        emptied.fill(0, lengthEnd - (header === 4 ? 2 : 1), lengthEnd);
+        const pageOf = (buffer, page) =>
+          buffer.subarray(
+            (page - firstPage) * PAGE_SIZE,
+            (page - firstPage + 1) * PAGE_SIZE
+          );
+        const onTag = (page) =>
+          this.memory.subarray(page * PAGE_SIZE, (page + 1) * PAGE_SIZE);
+        const differs = (page, data) =>
+          onTag(page).length !== PAGE_SIZE || !onTag(page).equals(data);
+        const holdsLength = (page) => page * PAGE_SIZE < offset + header;
+        const body = [];
+        const lengths = [];
+        for (let page = firstPage; page < lastPage; page++) {
+          const data = pageOf(pages, page);
+          if (holdsLength(page)) {
+            lengths.push(page);
+          } else if (differs(page, data)) {
+            body.push({ page, data });
+          }
+        }
+        const writes = [];
+        if (body.length || lengths.length > 1) {
+          lengths.forEach((page) => {
+            if (differs(page, pageOf(emptied, page))) {
+              writes.push({ page, data: pageOf(emptied, page) });
+            }
+          });
+        }
+        writes.push(...body);
+        lengths.forEach((page) =>
+          writes.push({ page, data: pageOf(pages, page) })
+        );
+        const touched = {};
+        return writes
+          .reduce(
+            (previous, write) =>
+              previous.then(() => {
+                touched[write.page] = true;
+                return this.storage.writeBlocks(write.page, write.data);
+              }),
+            Promise.resolve()
+          )
+          .then(() => {
+            // keep the cache in step with the tag
+            const written = firstPage * PAGE_SIZE + pages.length;
+            if (this.memory.length < written) {
+              this.memory = Buffer.concat([
+                this.memory,
+                Buffer.alloc(written - this.memory.length),
+              ]);
+            }
+            pages.copy(this.memory, firstPage * PAGE_SIZE);
+            this.emit('ndef-written', {
+              length: message.length,
+              updates: writes.length,
+              skipped: lastPage - firstPage - Object.keys(touched).length,
+              durationMs: stopwatch.elapsed(),
+            });
+          });
+      });
+  }
+}
+
+Type2Tag.encodeNdefTlv = encodeNdefTlv;
+
+module.exports = Type2Tag;
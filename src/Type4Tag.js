@@ -0,0 +1,330 @@
+'use strict';
+
+import CommandApdu from './CommandApdu';
+import Iso7816Application from './Iso7816Application';
+import Ndef from './Ndef';
+import Stopwatch from './Stopwatch';
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('Type4Tag');
+
+// NFC Forum Type 4 Tag NDEF application, version 2.0 and later
+const AID = [0xd2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01];
+const CC_FILE = 0xe103;
+
+const ins = {
+  READ_BINARY: 0xb0,
+  SELECT_FILE: 0xa4,
+  UPDATE_BINARY: 0xd6,
+};
+
+const SHORT_LE = 0x100;
+const SHORT_LC = 0xff;
+const MAX_OFFSET = 0x7fff;
+
+const statusWord = (response) =>
+  response.readUInt16BE(response.length - 2);
+
+const parseCapabilityContainer = (data) => {
+  if (data.length < 15) {
+    const hex = data.toString('hex');
+    throw new Error(`capability container too short '${hex}'`);
+  }
+  // NDEF file control TLV, 04 for 2 byte sizes, 06 (ENDEF) for 4 byte sizes
+  const tag = data[7];
+  const wide = tag === 0x06;
+  if (wide && data.length < 17) {
+    const hex = data.toString('hex');
+    throw new Error(`capability container too short for ENDEF '${hex}'`);
+  }
+  const value = data.subarray(9);
+  return {
+    version: data[2],
+    maxLe: data.readUInt16BE(3),
+    maxLc: data.readUInt16BE(5),
+    fileId: value.readUInt16BE(0),
+    maxSize: wide ? value.readUInt32BE(2) : value.readUInt16BE(2),
+    readAccess: value[wide ? 6 : 4],
+    writeAccess: value[wide ? 7 : 5],
+    lengthBytes: wide ? 4 : 2,
+  };
+};
+
+/*
+Reads and writes the NDEF file of a Type 4 tag. Each READ BINARY and UPDATE
+BINARY is sized by MLe and MLc from the capability container, the first
+read returns NLEN together with the start of the message.
+*/
+class Type4Tag extends Iso7816Application {
+  constructor(card, options) {
+    super(card);
+    this.options = options || {};
+    this.extendedLength = !!this.options.extendedLength;
+    this.capabilities = null;
+    this.ndefSelected = false;
+  }
+
+  select(bytes, p1, p2) {
+    const data = Buffer.from(bytes);
+    const command = [0x00, ins.SELECT_FILE, p1, p2, data.length].concat(
+      Array.from(data)
+    );
+    return this.exchange(p1 === 0x04 ? command.concat([0x00]) : command).then(
+      (response) => {
+        const sw = statusWord(response);
+        if (sw !== 0x9000) {
+          const file = data.toString('hex');
+          throw new Error(`SELECT '${file}' failed '${sw.toString(16)}'`);
+        }
+        return response;
+      }
+    );
+  }
+
+  selectElementaryFile(fid) {
+    return this.select([(fid >> 8) & 0xff, fid & 0xff], 0x00, 0x0c);
+  }
+
+  // largest READ BINARY and UPDATE BINARY the tag and the link allow
+  readLimit() {
+    const limit = this.extendedLength ? 0xffff : SHORT_LE;
+    return Math.min(this.capabilities.maxLe, limit);
+  }
+
+  writeLimit() {
+    const limit = this.extendedLength ? 0xffff : SHORT_LC;
+    return Math.min(this.capabilities.maxLc, limit);
+  }
+
+  readBinary(offset, length) {
+    if (offset > MAX_OFFSET) {
+      return Promise.reject(new Error(`offset ${offset} out of range`));
+    }
+    const p1 = (offset >> 8) & 0xff;
+    const p2 = offset & 0xff;
+    let read;
+    if (length > SHORT_LE) {
+      read = this.card.issueCommand(
+        new CommandApdu({
+          cla: 0x00,
+          ins: ins.READ_BINARY,
+          p1,
+          p2,
+          le: length & 0xffff,
+          extended: true,
+        })
+      );
+    } else {
+      read = this.exchange([0x00, ins.READ_BINARY, p1, p2, length & 0xff]);
+    }
+    return read.then((response) => {
+      const sw = statusWord(response);
+      if (sw !== 0x9000 && sw !== 0x6282) {
+        throw new Error(`READ BINARY ${offset} failed '${sw.toString(16)}'`);
+      }
+      return response.subarray(0, response.length - 2);
+    });
+  }
+
+  updateBinary(offset, data) {
+    if (offset > MAX_OFFSET) {
+      return Promise.reject(new Error(`offset ${offset} out of range`));
+    }
+    const p1 = (offset >> 8) & 0xff;
+    const p2 = offset & 0xff;
+    let command;
+    if (data.length > SHORT_LC) {
+      command = new CommandApdu({
+        cla: 0x00,
+        ins: ins.UPDATE_BINARY,
+        p1,
+        p2,
+        data,
+        extended: true,
+      });
+    } else {
+      command = Buffer.concat([
+        Buffer.from([0x00, ins.UPDATE_BINARY, p1, p2, data.length]),
+        data,
+      ]);
+    }
+    return this.card.issueCommand(command).then((response) => {
+      const sw = statusWord(response);
+      if (sw !== 0x9000) {
+        throw new Error(`UPDATE BINARY ${offset} failed '${sw.toString(16)}'`);
+      }
+    });
+  }
+
+  readCapabilities() {
+    if (this.capabilities) {
+      return Promise.resolve(this.capabilities);
+    }
+    return this.select(AID, 0x04, 0x00)
+      .then(() => this.selectElementaryFile(CC_FILE))
+      .then(() => this.readCapabilityContainer())
+      .then((data) => {
+        this.capabilities = parseCapabilityContainer(data);
+        logger.debug(`capabilities ${JSON.stringify(this.capabilities)}`);
+        this.ndefSelected = false;
+        return this.capabilities;
+      });
+  }
+
+  // the 15 bytes of a 2.0 CC, then the rest up to CCLEN (17 with ENDEF)
+  readCapabilityContainer() {
+    const read = (offset, length) =>
+      this.exchange([
+        0x00,
+        ins.READ_BINARY,
+        (offset >> 8) & 0x7f,
+        offset & 0xff,
+        length,
+      ]).then((response) => {
+        const sw = statusWord(response);
+        if (sw !== 0x9000) {
+          throw new Error(`READ BINARY CC failed '${sw.toString(16)}'`);
+        }
+        return response.subarray(0, response.length - 2);
+      });
+    return read(0, 0x0f).then((head) => {
+      const length = head.length >= 2 ? head.readUInt16BE(0) : 0;
+      if (length <= head.length) {
+        return head;
+      }
+      const rest = Math.min(length - head.length, 0xff);
+      return read(head.length, rest).then((tail) =>
+        Buffer.concat([head, tail])
+      );
+    });
+  }
+
+  selectNdef() {
+    if (this.ndefSelected) {
+      return Promise.resolve();
+    }
+    return this.selectElementaryFile(this.capabilities.fileId).then(() => {
+      this.ndefSelected = true;
+    });
+  }
+
+  readNdef() {
+    const stopwatch = Stopwatch.start();
+    let reads = 0;
+    let cc;
+    let message;
+    let size;
+    let filled;
+    const readRest = () => {
+      if (filled >= size) {
+        return Promise.resolve();
+      }
+      const length = Math.min(this.readLimit(), size - filled);
+      reads++;
+      return this.readBinary(filled, length).then((data) => {
+        if (!data.length) {
+          throw new Error(`NDEF file ends at ${filled} of ${size}`);
+        }
+        data.copy(message, filled);
+        filled += data.length;
+        return readRest();
+      });
+    };
+    return this.readCapabilities()
+      .then((capabilities) => {
+        cc = capabilities;
+        if (cc.readAccess !== 0x00) {
+          throw new Error(`NDEF file is not readable '${cc.readAccess}'`);
+        }
+        return this.selectNdef();
+      })
+      .then(() => {
+        reads++;
+        return this.readBinary(0, Math.min(this.readLimit(), cc.maxSize));
+      })
+      .then((first) => {
+        const nlen = first.readUIntBE(0, cc.lengthBytes);
+        size = Math.min(cc.lengthBytes + nlen, cc.maxSize);
+        if (first.length >= size) {
+          message = first;
+          filled = size;
+        } else {
+          message = Buffer.alloc(size);
+          filled = first.copy(message, 0);
+        }
+        return readRest();
+      })
+      .then(() => {
+        this.emit('ndef-read', {
+          length: size - cc.lengthBytes,
+          reads,
+          durationMs: stopwatch.elapsed(),
+        });
+        return Ndef.parse(message, cc.lengthBytes, size);
+      });
+  }
+
+  // NLEN is zeroed by the first UPDATE BINARY and set by the last one; a
+  // message that fits in one command is written with its NLEN at once
+  writeNdef(records) {
+    const stopwatch = Stopwatch.start();
+    const message = Buffer.isBuffer(records) ? records : Ndef.encode(records);
+    let cc;
+    let updates = 0;
+    return this.readCapabilities()
+      .then((capabilities) => {
+        cc = capabilities;
+        if (cc.writeAccess !== 0x00) {
+          throw new Error(`NDEF file is read only '${cc.writeAccess}'`);
+        }
+        if (cc.lengthBytes + message.length > cc.maxSize) {
+          throw new Error(
+            `NDEF message of ${message.length} bytes exceeds ${cc.maxSize}`
+          );
+        }
+        return this.selectNdef();
+      })
+      .then(() => {
+        const nlen = Buffer.alloc(cc.lengthBytes);
+        nlen.writeUIntBE(message.length, 0, cc.lengthBytes);
+        const file = Buffer.concat([nlen, message]);
+        const limit = this.writeLimit();
+        if (file.length <= limit) {
+          updates++;
+          return this.updateBinary(0, file);
+        }
+        file.fill(0, 0, cc.lengthBytes);
+        const writes = [];
+        for (let offset = 0; offset < file.length; offset += limit) {
+          writes.push(offset);
+        }
+        return writes
+          .reduce(
+            (previous, offset) =>
+              previous.then(() => {
+                updates++;
+                return this.updateBinary(
+                  offset,
+                  file.subarray(offset, offset + limit)
+                );
+              }),
+            Promise.resolve()
+          )
+          .then(() => {
+            updates++;
+            return this.updateBinary(0, nlen);
+          });
+      })
+      .then(() => {
+        this.emit('ndef-written', {
+          length: message.length,
+          updates,
+          durationMs: stopwatch.elapsed(),
+        });
+      });
+  }
+}
+
+Type4Tag.AID = AID;
+Type4Tag.parseCapabilityContainer = parseCapabilityContainer;
+
+module.exports = Type4Tag;
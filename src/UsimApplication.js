@@ -0,0 +1,144 @@
+'use strict';
+
+import Iso7816Application from './Iso7816Application';
+import Stopwatch from './Stopwatch';
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('UsimApplication');
+
+// right-truncated USIM AID (3GPP RID and application code)
+const USIM_AID = [0xa0, 0x00, 0x00, 0x00, 0x87, 0x10, 0x02];
+
+const ins = {
+  AUTHENTICATE: 0x88,
+  SELECT_FILE: 0xa4,
+};
+
+const AUTHENTICATE_3G = 0x81;
+
+const parseAuthenticate = (data) => {
+  const tag = data[0];
+  if (tag === 0xdc) {
+    return { status: 'sync-failure', auts: data.subarray(2, 2 + data[1]) };
+  }
+  if (tag !== 0xdb) {
+    return { status: 'error', data };
+  }
+  const fields = [];
+  let offset = 1;
+  while (offset < data.length) {
+    const length = data[offset];
+    fields.push(data.subarray(offset + 1, offset + 1 + length));
+    offset += 1 + length;
+  }
+  return {
+    status: 'success',
+    res: fields[0],
+    ck: fields[1],
+    ik: fields[2],
+    kc: fields[3],
+  };
+};
+
+class UsimApplication extends Iso7816Application {
+  constructor(card, options) {
+    super(card);
+    this.options = options || {};
+    this.aid = this.options.aid || USIM_AID;
+    this.selected = false;
+    this.stats = { authentications: 0, failures: 0, totalMs: 0 };
+  }
+
+  selectAdf() {
+    if (this.selected) {
+      return Promise.resolve();
+    }
+    logger.debug(`selectAdf`);
+    const aid = Buffer.from(this.aid);
+    const command = Buffer.concat([
+      Buffer.from([0x00, ins.SELECT_FILE, 0x04, 0x0c, aid.length]),
+      aid,
+    ]);
+    return this.exchange(command).then((response) => {
+      const sw1 = response[response.length - 2];
+      if (sw1 !== 0x90 && sw1 !== 0x91) {
+        throw new Error(
+          `SELECT ADF.USIM failed '${response.subarray(-2).toString('hex')}'`
+        );
+      }
+      this.selected = true;
+      this.emit('application-selected', { application: aid.toString('hex') });
+    });
+  }
+
+  buildAuthenticate(rand, autn) {
+    const command = Buffer.alloc(5 + 2 + rand.length + 1 + autn.length + 1);
+    command[0] = 0x00;
+    command[1] = ins.AUTHENTICATE;
+    command[2] = 0x00;
+    command[3] = AUTHENTICATE_3G;
+    command[4] = 2 + rand.length + autn.length;
+    command[5] = rand.length;
+    Buffer.from(rand).copy(command, 6);
+    command[6 + rand.length] = autn.length;
+    Buffer.from(autn).copy(command, 7 + rand.length);
+    command[command.length - 1] = 0x00;
+    return command;
+  }
+
+  runAuthenticate(command, retry) {
+    const stopwatch = Stopwatch.start();
+    return this.selectAdf()
+      .then(() => this.exchange(command))
+      .then((response) => {
+        const sw = response.readUInt16BE(response.length - 2);
+        // the ADF is no longer selected, e.g. another application reset it
+        if ((sw === 0x6986 || sw === 0x6a82) && retry) {
+          this.selected = false;
+          return this.runAuthenticate(command, false);
+        }
+        let result;
+        if (sw === 0x9000 || (sw & 0xff00) === 0x9100) {
+          result = parseAuthenticate(response.subarray(0, response.length - 2));
+        } else if (sw === 0x9862) {
+          result = { status: 'mac-failure' };
+        } else {
+          result = { status: 'error', sw: sw.toString(16) };
+        }
+        result.durationMs = stopwatch.elapsed();
+        this.stats.authentications++;
+        this.stats.totalMs += result.durationMs;
+        if (result.status !== 'success') {
+          this.stats.failures++;
+        }
+        return result;
+      });
+  }
+
+  authenticate(rand, autn) {
+    return this.runAuthenticate(this.buildAuthenticate(rand, autn), true);
+  }
+
+  // commands are built up front, the ADF is selected at most once
+  authenticateBatch(requests) {
+    const commands = requests.map((request) =>
+      this.buildAuthenticate(request.rand, request.autn)
+    );
+    const results = [];
+    return commands
+      .reduce(
+        (previous, command) =>
+          previous
+            .then(() => this.runAuthenticate(command, true))
+            .then((result) => {
+              results.push(result);
+            }),
+        Promise.resolve()
+      )
+      .then(() => results);
+  }
+}
+
+UsimApplication.AID = USIM_AID;
+UsimApplication.parseAuthenticate = parseAuthenticate;
+
+module.exports = UsimApplication;
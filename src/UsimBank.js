@@ -0,0 +1,142 @@
+'use strict';
+
+import { EventEmitter } from 'events';
+import Stopwatch from './Stopwatch';
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('UsimBank');
+
+const rate = (count, stopwatch) => {
+  const seconds = stopwatch ? stopwatch.elapsed() / 1000 : 0;
+  return seconds > 0 ? count / seconds : 0;
+};
+
+/*
+Queues AUTHENTICATE requests per SIM and serves the SIMs round robin.
+A SIM's turn runs up to `batchSize` queued requests back to back, at most
+`maxConcurrent` SIMs are exchanging at the same time.
+*/
+class UsimBank extends EventEmitter {
+  constructor(options) {
+    super();
+    const opts = options || {};
+    this.batchSize = opts.batchSize || 8;
+    this.maxConcurrent = opts.maxConcurrent || Infinity;
+    this.sims = {};
+    this.ready = [];
+    this.active = 0;
+    this.completed = 0;
+    this.stopwatch = null;
+  }
+
+  // an id already in the bank is refused, replacing it would orphan the
+  // requests queued for it; remove() it first
+  add(id, usim) {
+    if (this.sims[id]) {
+      throw new Error(`SIM '${id}' already added`);
+    }
+    logger.debug(`add ${id}`);
+    this.sims[id] = {
+      id,
+      usim,
+      queue: [],
+      busy: false,
+      completed: 0,
+      failures: 0,
+      totalMs: 0,
+      stopwatch: null,
+    };
+  }
+
+  remove(id) {
+    const sim = this.sims[id];
+    if (!sim) return;
+    delete this.sims[id];
+    this.ready = this.ready.filter((entry) => entry !== sim);
+    sim.queue.forEach((request) =>
+      request.reject(new Error(`SIM '${id}' removed`))
+    );
+    sim.queue = [];
+  }
+
+  authenticate(id, rand, autn) {
+    const sim = this.sims[id];
+    if (!sim) {
+      return Promise.reject(new Error(`unknown SIM '${id}'`));
+    }
+    if (!this.stopwatch) this.stopwatch = Stopwatch.start();
+    if (!sim.stopwatch) sim.stopwatch = Stopwatch.start();
+    return new Promise((resolve, reject) => {
+      sim.queue.push({ rand, autn, resolve, reject });
+      if (!sim.busy && this.ready.indexOf(sim) < 0) {
+        this.ready.push(sim);
+      }
+      this.schedule();
+    });
+  }
+
+  schedule() {
+    while (this.active < this.maxConcurrent && this.ready.length) {
+      this.runTurn(this.ready.shift());
+    }
+  }
+
+  runTurn(sim) {
+    sim.busy = true;
+    this.active++;
+    const batch = sim.queue.splice(0, this.batchSize);
+    const next = (index) => {
+      if (index >= batch.length) {
+        return Promise.resolve();
+      }
+      const request = batch[index];
+      return sim.usim
+        .authenticate(request.rand, request.autn)
+        .then(
+          (result) => {
+            sim.completed++;
+            sim.totalMs += result.durationMs;
+            if (result.status !== 'success') sim.failures++;
+            this.completed++;
+            request.resolve(result);
+          },
+          (err) => {
+            sim.failures++;
+            request.reject(err);
+          }
+        )
+        .then(() => next(index + 1));
+    };
+    next(0).then(() => {
+      sim.busy = false;
+      this.active--;
+      // back of the line, so other SIMs with work go first
+      if (sim.queue.length && this.sims[sim.id] === sim) {
+        this.ready.push(sim);
+      }
+      this.emit('turn-completed', { id: sim.id, count: batch.length });
+      this.schedule();
+    });
+  }
+
+  getStats() {
+    const sims = {};
+    Object.keys(this.sims).forEach((id) => {
+      const sim = this.sims[id];
+      sims[id] = {
+        authentications: sim.completed,
+        failures: sim.failures,
+        pending: sim.queue.length,
+        averageMs: sim.completed ? sim.totalMs / sim.completed : 0,
+        perSecond: rate(sim.completed, sim.stopwatch),
+      };
+    });
+    return {
+      authentications: this.completed,
+      perSecond: rate(this.completed, this.stopwatch),
+      active: this.active,
+      sims,
+    };
+  }
+}
+
+module.exports = UsimBank;
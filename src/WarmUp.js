@@ -0,0 +1,78 @@
+'use strict';
+
+import ApduScript from './ApduScript';
+import lazyLogger from './lazyLogger';
+const logger = lazyLogger('WarmUp');
+
+// hex prefix of the ATR, x matches any nibble
+const prefixMatcher = (pattern) => {
+  const text = pattern.replace(/\s/g, '').toLowerCase();
+  return (hex) => {
+    if (hex.length < text.length) return false;
+    for (let i = 0; i < text.length; i++) {
+      if (text[i] !== 'x' && text[i] !== hex[i]) return false;
+    }
+    return true;
+  };
+};
+
+/*
+Per ATR profile scripts run on a new card before card-inserted is emitted,
+typically SELECT of the main application and reads of identifying data.
+Profiles are tried in order, the first match wins.
+
+  { name: 'piv', atr: '3bf81300008131fe15', script: [ ...ApduScript steps ] }
+  { name: 'other', match: (atr) => ..., script: [...] }
+*/
+class WarmUp {
+  constructor(profiles) {
+    this.profiles = profiles.map((profile) => {
+      let test;
+      if (profile.match) {
+        test = profile.match;
+      } else if (profile.atr instanceof RegExp) {
+        test = (hex) => profile.atr.test(hex);
+      } else if (profile.atr) {
+        test = prefixMatcher(profile.atr);
+      } else {
+        test = () => true;
+      }
+      return {
+        name: profile.name,
+        test,
+        plan: ApduScript.compile(profile.script),
+      };
+    });
+  }
+
+  static from(profiles) {
+    if (!profiles || profiles instanceof WarmUp) return profiles;
+    return new WarmUp(profiles);
+  }
+
+  profileFor(atr) {
+    const hex = Buffer.from(atr).toString('hex');
+    for (let i = 0; i < this.profiles.length; i++) {
+      if (this.profiles[i].test(hex)) return this.profiles[i];
+    }
+    return null;
+  }
+
+  // resolves with null when no profile matches
+  run(card) {
+    const profile = this.profileFor(Buffer.from(card.getAtr(), 'hex'));
+    if (!profile) {
+      return Promise.resolve(null);
+    }
+    logger.debug(`warm up '${profile.name}'`);
+    return profile.plan.run(card).then((result) => ({
+      profile: profile.name,
+      ok: result.ok,
+      data: result.variables,
+      steps: result.steps,
+      durationMs: result.durationMs,
+    }));
+  }
+}
+
+module.exports = WarmUp;
@@ -1,17 +1,51 @@
 'use strict';
 
-import Iso7816Application from './Iso7816Application';
-import CommandApdu from './CommandApdu';
-import ResponseApdu from './ResponseApdu';
-import Devices from './Devices';
-import Device from './Device';
-import Card from './Card';
-
-module.exports = {
-  Iso7816Application,
-  CommandApdu,
-  ResponseApdu,
-  Devices,
-  Device,
-  Card,
+// modules are loaded on first access, requiring the package does no work
+const modules = {
+  Iso7816Application: () => require('./Iso7816Application'),
+  CommandApdu: () => require('./CommandApdu'),
+  ResponseApdu: () => require('./ResponseApdu'),
+  Devices: () => require('./Devices'),
+  Device: () => require('./Device'),
+  DeviceRegistry: () => require('./DeviceRegistry'),
+  Card: () => require('./Card'),
+  RetryPolicy: () => require('./RetryPolicy'),
+  SyncTransmit: () => require('./SyncTransmit'),
+  SyncCard: () => require('./SyncCard'),
+  OpenPgpApplication: () => require('./OpenPgpApplication'),
+  EmrtdApplication: () => require('./EmrtdApplication'),
+  SecureMessaging: () => require('./SecureMessaging'),
+  UsimApplication: () => require('./UsimApplication'),
+  UsimBank: () => require('./UsimBank'),
+  SimFileReader: () => require('./SimFileReader'),
+  StorageCard: () => require('./StorageCard'),
+  StorageCardSimulator: () => require('./StorageCardSimulator'),
+  Type2Tag: () => require('./Type2Tag'),
+  Type4Tag: () => require('./Type4Tag'),
+  DiffWriter: () => require('./DiffWriter'),
+  StoreData: () => require('./StoreData'),
+  Personalizer: () => require('./Personalizer'),
+  CheckpointJournal: () => require('./CheckpointJournal'),
+  KeyDiversifier: () => require('./KeyDiversifier'),
+  Ndef: () => require('./Ndef'),
+  Broker: () => require('./Broker'),
+  RemoteDevices: () => require('./RemoteDevices'),
+  ApduBatch: () => require('./ApduBatch'),
+  ApduScript: () => require('./ApduScript'),
+  WarmUp: () => require('./WarmUp'),
+  AidDiscovery: () => require('./AidDiscovery'),
+  EmvOda: () => require('./EmvOda'),
+  CaKeyStore: () => require('./CaKeyStore'),
+  Atr: () => require('./Atr'),
+  Tlv: () => require('./Tlv'),
 };
+
+Object.keys(modules).forEach((name) => {
+  Object.defineProperty(module.exports, name, {
+    enumerable: true,
+    get: () => {
+      const loaded = modules[name]();
+      return loaded && loaded.__esModule ? loaded.default : loaded;
+    },
+  });
+});
@@ -0,0 +1,22 @@
+'use strict';
+
+// pino is loaded, and the logger built, on the first call
+const lazyLogger = (name) => {
+  let logger = null;
+  const get = () => {
+    if (!logger) {
+      logger = require('pino')({ name });
+    }
+    return logger;
+  };
+  return {
+    trace: (...args) => get().trace(...args),
+    debug: (...args) => get().debug(...args),
+    info: (...args) => get().info(...args),
+    warn: (...args) => get().warn(...args),
+    error: (...args) => get().error(...args),
+    fatal: (...args) => get().fatal(...args),
+  };
+};
+
+export default lazyLogger;
@@ -0,0 +1,183 @@
+'use strict';
+
+const test = require('node:test');
+const assert = require('assert');
+const { AidDiscovery, Card, Tlv } = require('../lib/index');
+
+const sw = (value) => Buffer.from([value >> 8, value & 0xff]);
+const ok = (data) => Buffer.concat([data, sw(0x9000)]);
+const NOT_FOUND = sw(0x6a82);
+
+const entry = (aid, label) =>
+  Tlv.encode(
+    0x61,
+    Buffer.concat([
+      Tlv.encode(0x4f, Buffer.from(aid, 'hex')),
+      Tlv.encode(0x50, Buffer.from(label)),
+    ])
+  );
+
+const fci = (aid, label) =>
+  Tlv.encode(
+    0x6f,
+    Buffer.concat([
+      Tlv.encode(0x84, Buffer.from(aid, 'hex')),
+      Tlv.encode(0xa5, Tlv.encode(0x50, Buffer.from(label))),
+    ])
+  );
+
+/*
+A device with the given applications, { aid, label }, and optionally a
+PPSE and EF.DIR records. SELECT by a partial AID takes the first match,
+next occurrence the one after the current selection.
+*/
+const fakeDevice = (applications, options) => {
+  const opts = options || {};
+  const device = {
+    name: 'Fake Reader',
+    sent: [],
+    current: -1,
+    respond(command) {
+      const [, ins, p1, p2] = command;
+      if (ins === 0xb2) {
+        const records = (p2 >> 3 === 0x1e && opts.efDir) || [];
+        return p1 <= records.length ? ok(records[p1 - 1]) : sw(0x6a83);
+      }
+      const name = command.subarray(5, 5 + command[4]);
+      if (name.toString() === '2PAY.SYS.DDF01' && opts.ppse) {
+        return ok(Tlv.encode(0x6f, Tlv.encode(0xbf0c, opts.ppse)));
+      }
+      const prefix = name.toString('hex');
+      const start = p2 === 0x02 ? this.current + 1 : 0;
+      for (let i = start; i < applications.length; i++) {
+        if (applications[i].aid.startsWith(prefix)) {
+          this.current = i;
+          return ok(fci(applications[i].aid, applications[i].label));
+        }
+      }
+      return NOT_FOUND;
+    },
+    transmit(data, resLen, protocol, cb) {
+      this.sent.push(data.subarray(0, 4).toString('hex'));
+      const response = this.respond(data);
+      setImmediate(() => cb(null, response));
+    },
+  };
+  return device;
+};
+
+const cardIn = (device, atr) =>
+  new Card(device, Buffer.from(atr || '3b00', 'hex'), 2);
+
+const aids = (result) => result.applications.map((a) => a.aid);
+
+test('the PPSE is read first', async () => {
+  const device = fakeDevice([], {
+    ppse: Buffer.concat([
+      entry('a0000000031010', 'VISA'),
+      entry('a0000000041010', 'MC'),
+    ]),
+  });
+  const result = await new AidDiscovery().discover(cardIn(device));
+  assert.strictEqual(result.source, 'ppse');
+  assert.deepStrictEqual(result.applications[1], {
+    aid: 'a0000000041010',
+    label: 'MC',
+    priority: null,
+    source: 'ppse',
+  });
+  assert.strictEqual(result.commands, 1);
+});
+
+test('EF.DIR is read when there is no PPSE or PSE', async () => {
+  const device = fakeDevice([], {
+    efDir: [
+      entry('a000000308000010000100', 'PIV'),
+      entry('d27600012401', 'OpenPGP'),
+    ],
+  });
+  const result = await new AidDiscovery().discover(cardIn(device));
+  assert.strictEqual(result.source, 'ef.dir');
+  assert.deepStrictEqual(aids(result), [
+    'a000000308000010000100',
+    'd27600012401',
+  ]);
+  // PPSE, PSE, then records 1 and 2 and the one past the end
+  assert.deepStrictEqual(device.sent, [
+    '00a40400',
+    '00a40400',
+    '00b201f4',
+    '00b202f4',
+    '00b203f4',
+  ]);
+  assert.strictEqual(result.commands, 5);
+});
+
+const cards = [
+  { aid: 'a0000000031010', label: 'VISA CREDIT' },
+  { aid: 'a0000000032010', label: 'VISA ELECTRON' },
+  { aid: 'a0000000041010', label: 'MASTERCARD' },
+];
+
+test('candidates are selected in one batch until the stop', async () => {
+  const candidates = ['a0000000999999', 'a0000000032010', 'a0000000041010'];
+  const first = fakeDevice(cards);
+  const discovery = new AidDiscovery({
+    candidates,
+    directories: false,
+    stop: 'first',
+  });
+  const result = await discovery.discover(cardIn(first));
+  assert.strictEqual(result.source, 'select');
+  assert.deepStrictEqual(aids(result), ['a0000000032010']);
+  assert.strictEqual(result.commands, 2);
+  assert.strictEqual(first.sent.length, 2);
+
+  const all = fakeDevice(cards);
+  const every = new AidDiscovery({ candidates, directories: false });
+  const found = await every.discover(cardIn(all));
+  assert.deepStrictEqual(aids(found), ['a0000000032010', 'a0000000041010']);
+  assert.strictEqual(found.applications[1].label, 'MASTERCARD');
+  assert.strictEqual(found.commands, 3);
+});
+
+test('a partial AID is reselected before its next occurrences', async () => {
+  const device = fakeDevice(cards);
+  const discovery = new AidDiscovery({
+    candidates: [{ aid: 'a000000003', partial: true }, 'a0000000041010'],
+    directories: false,
+  });
+  const result = await discovery.discover(cardIn(device));
+  assert.deepStrictEqual(aids(result), [
+    'a0000000031010',
+    'a0000000041010',
+    'a0000000032010',
+  ]);
+  assert.deepStrictEqual(device.sent, [
+    '00a40400',
+    '00a40400',
+    // the batch left the Mastercard AID selected
+    '00a40400',
+    '00a40402',
+    '00a40402',
+  ]);
+  assert.strictEqual(result.commands, 5);
+});
+
+test('results are cached per ATR', async () => {
+  const discovery = new AidDiscovery({
+    candidates: ['a0000000041010'],
+    directories: false,
+  });
+  const device = fakeDevice(cards);
+  await discovery.discover(cardIn(device));
+  const again = await discovery.discover(cardIn(device));
+  assert.strictEqual(again.cached, true);
+  assert.strictEqual(again.commands, 0);
+  assert.deepStrictEqual(aids(again), ['a0000000041010']);
+  assert.strictEqual(device.sent.length, 1);
+  const other = await discovery.discover(cardIn(device, '3b01'));
+  assert.strictEqual(other.cached, false);
+  discovery.clearCache();
+  assert.strictEqual((await discovery.discover(cardIn(device))).cached, false);
+});
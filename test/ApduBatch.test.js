@@ -0,0 +1,67 @@
+'use strict';
+
+const test = require('node:test');
+const assert = require('assert');
+const { ApduBatch } = require('../lib/index');
+
+const hex = (text) => Buffer.from(text.replace(/ /g, ''), 'hex');
+
+test('commands round trip with the receive length of their Le', () => {
+  const encoded = ApduBatch.encodeCommands([
+    '00A4040007A0000000041010',
+    hex('00B0000000 0800'),
+    hex('00D6000000 0003 010203'),
+    hex('0088000000 0002 0102 0100'),
+  ]);
+  const commands = ApduBatch.decodeCommands(encoded);
+  assert.deepStrictEqual(
+    commands.map((c) => c.toString()),
+    [
+      '00a4040007a0000000041010',
+      '00b00000000800',
+      '00d60000000003010203',
+      '0088000000000201020100',
+    ]
+  );
+  assert.deepStrictEqual(
+    commands.map((c) => c.getResponseLength()),
+    [0x102, 0x802, 0x102, 0x102]
+  );
+});
+
+test('malformed command batches throw', () => {
+  const encoded = ApduBatch.encodeCommands(['00A4040000', '00B0000010']);
+  assert.throws(
+    () => ApduBatch.decodeCommands(encoded.subarray(0, encoded.length - 1)),
+    /malformed APDU batch, length 5 of command 1/
+  );
+  assert.throws(
+    () => ApduBatch.decodeCommands(Buffer.concat([encoded, hex('00')])),
+    /1 bytes left/
+  );
+  const count = Buffer.from(encoded);
+  count.writeUInt32BE(0xffffffff, 2);
+  assert.throws(() => ApduBatch.decodeCommands(count), /commands in/);
+});
+
+test('results round trip and malformed ones throw', () => {
+  const encoded = ApduBatch.encodeResults([
+    { response: hex('6F009000'), durationMs: 1.5 },
+    { response: hex('6A82'), durationMs: 2 },
+  ]);
+  const results = ApduBatch.decodeResults(encoded);
+  assert.strictEqual(results.length, 2);
+  assert.deepStrictEqual(results.data(0), hex('6F00'));
+  assert.strictEqual(results.statusWord(1), 0x6a82);
+  assert.strictEqual(results.durationMs(0), 1.5);
+  assert.strictEqual(results.firstFailure(), 1);
+  assert.throws(() => results.response(2), /no result 2/);
+
+  assert.throws(
+    () => ApduBatch.decodeResults(encoded.subarray(0, encoded.length - 1)),
+    /malformed APDU batch/
+  );
+  const offsets = Buffer.from(encoded);
+  offsets.writeUInt32BE(0x1000, 10);
+  assert.throws(() => ApduBatch.decodeResults(offsets), /offset 4096/);
+});
@@ -0,0 +1,97 @@
+'use strict';
+
+const test = require('node:test');
+const assert = require('assert');
+const { ApduScript } = require('../lib/index');
+
+// answers each command with the next status word of the list
+const card = (statusWords) => {
+  const sent = [];
+  const answer = (command) => {
+    sent.push(command.toString('hex'));
+    return Buffer.from(statusWords.shift() || '9000', 'hex');
+  };
+  return {
+    sent,
+    transmit: (command, callback) => callback(null, answer(command)),
+    issueBatch: (commands, check) => {
+      const results = [];
+      for (let i = 0; i < commands.length; i++) {
+        const response = answer(commands[i]);
+        results.push({ response, durationMs: 0 });
+        if (check(i, response) === false) break;
+      }
+      return Promise.resolve(results);
+    },
+  };
+};
+
+const script = [
+  { apdu: '00A4040000' },
+  { apdu: '00B2010C00' },
+  { apdu: '00B2020C00' },
+];
+
+test('failedStep indexes steps whether batched or interpreted', () => {
+  const plan = ApduScript.compile(script);
+  assert.strictEqual(plan.batchable, true);
+  return Promise.all([
+    plan.run(card(['9000', '6A83'])),
+    plan.run(card(['9000', '6A83']), {}, { from: 0 }),
+  ]).then(([batched, stepped]) => {
+    [batched, stepped].forEach((result) => {
+      assert.strictEqual(result.ok, false);
+      assert.strictEqual(result.failedStep, 1);
+      assert.strictEqual(result.steps[1].sw, 0x6a83);
+      assert.strictEqual(result.exceeded, undefined);
+    });
+  });
+});
+
+test('a repeat past its max is its own outcome', () => {
+  const plan = ApduScript.compile([
+    {
+      name: 'records',
+      repeat: [{ apdu: '00B2{record}0C00', expect: ['9000', '6A83'] }],
+      counter: { var: 'record' },
+      until: { sw: '6A83' },
+      max: 3,
+    },
+  ]);
+  const reader = card([]);
+  return plan.run(reader).then((result) => {
+    assert.strictEqual(result.ok, false);
+    assert.strictEqual(result.failedStep, undefined);
+    assert.deepStrictEqual(result.exceeded, { name: 'records', max: 3 });
+    assert.deepStrictEqual(reader.sent, [
+      '00b2010c00',
+      '00b2020c00',
+      '00b2030c00',
+      '00b2040c00',
+    ]);
+  });
+});
+
+test('an unrolled loop body keeps no names, nested ones included', () => {
+  const loop = {
+    loop: { var: 'sfi', from: 1, to: 2 },
+    steps: [
+      {
+        name: 'file',
+        repeat: [{ name: 'read', apdu: '00B0{sfi}0000', expect: null }],
+        until: { sw: '9000' },
+      },
+    ],
+  };
+  assert.throws(
+    () => ApduScript.compile([loop, { if: { sw: '6A82' }, goto: 'read' }]),
+    /unknown step 'read'/
+  );
+  return ApduScript.run(card([]), [loop]).then((result) => {
+    assert.strictEqual(result.ok, true);
+    assert.deepStrictEqual(
+      result.steps.map((step) => step.name),
+      [undefined, undefined]
+    );
+  });
+});
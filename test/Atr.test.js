@@ -0,0 +1,52 @@
+'use strict';
+
+const test = require('node:test');
+const assert = require('assert');
+const { Atr } = require('../lib/index');
+
+test('contact ATR with compact-TLV historical bytes', () => {
+  // OpenPGP card 2.0
+  const atr = Atr.parse('3BDA18FF81B1FE751F030031C573C001400090000C');
+  assert.deepStrictEqual(atr.protocols, [1, 15]);
+  assert.deepStrictEqual(atr.interfaceBytes, [
+    { index: 1, ta: 0x18, tc: 0xff, td: 0x81 },
+    { index: 2, td: 0xb1 },
+    { index: 3, ta: 0xfe, tb: 0x75, td: 0x1f },
+    { index: 4, ta: 0x03 },
+  ]);
+  assert.strictEqual(
+    atr.historicalBytes.toString('hex'),
+    '0031c573c00140009000'
+  );
+  const capabilities = atr.getCapabilities();
+  assert.strictEqual(capabilities.categoryIndicator, 0x00);
+  assert.strictEqual(capabilities.extendedLength, true);
+  assert.strictEqual(capabilities.commandChaining, false);
+  assert.strictEqual(capabilities.objects[3].toString('hex'), 'c5');
+  assert.strictEqual(atr.isContactless(), false);
+  assert.strictEqual(atr.getContactlessInfo(), null);
+});
+
+test('PC/SC part 3 ATRs of contactless storage cards', () => {
+  const classic = Atr.parse('3B8F8001804F0CA000000306030001000000006A');
+  assert.deepStrictEqual(classic.protocols, [0, 1]);
+  assert.strictEqual(classic.isContactless(), true);
+  assert.deepStrictEqual(classic.getContactlessInfo(), {
+    standard: 'ISO 14443 A, part 3',
+    name: 'MIFARE Classic 1K',
+    code: 0x0001,
+    storage: true,
+  });
+  const ultralight = Atr.parse('3B8F8001804F0CA0000003060300030000000068');
+  assert.strictEqual(ultralight.getContactlessInfo().name, 'MIFARE Ultralight');
+});
+
+test('ISO 14443-4 cards are contactless but not storage cards', () => {
+  const atr = Atr.parse('3B8880010000000000718100F9');
+  assert.strictEqual(atr.isContactless(), true);
+  assert.deepStrictEqual(atr.getContactlessInfo(), {
+    standard: 'ISO 14443-4',
+    name: 'ISO 14443-4',
+    storage: false,
+  });
+});
@@ -0,0 +1,90 @@
+'use strict';
+
+const test = require('node:test');
+const assert = require('assert');
+const { EventEmitter } = require('events');
+const { Broker } = require('../lib/index');
+const { types, encode, FrameReader } = require('../lib/BrokerProtocol');
+
+const setup = () => {
+  const sent = [];
+  const device = Object.assign(new EventEmitter(), {
+    name: 'reader',
+    card: {},
+    transmit: (data, resLen, protocol, cb) => {
+      sent.push(resLen);
+      cb(null, Buffer.from([0x90, 0x00]));
+    },
+  });
+  const devices = Object.assign(new EventEmitter(), {
+    listDevices: () => [device],
+    lookup: (name) => (name === 'reader' ? device : undefined),
+  });
+  const broker = new Broker({ devices, path: '/nonexistent' });
+  const reader = new FrameReader();
+  const replies = [];
+  const client = {
+    id: 1,
+    socket: { write: (frame) => replies.push(...reader.push(frame)) },
+  };
+  broker.clients[client.id] = client;
+  return { broker, client, sent, replies };
+};
+
+const transmit = (id, name, responseLength) =>
+  new FrameReader().push(
+    encode(types.TRANSMIT, id, {
+      name,
+      responseLength,
+      protocol: 2,
+      data: Buffer.from([0x00, 0xb0, 0x00, 0x00, 0x00]),
+    })
+  )[0];
+
+test('a receive length is clamped to an extended response', () => {
+  const { broker, client, sent, replies } = setup();
+  broker.enqueue(client, transmit(1, 'reader', 0xffffffff));
+  broker.enqueue(client, transmit(2, 'reader', 0x102));
+  assert.deepStrictEqual(sent, [0x10002, 0x102]);
+  assert.deepStrictEqual(
+    replies.map((r) => r.type),
+    [types.RESPONSE, types.RESPONSE]
+  );
+});
+
+test('requests for an unknown reader are refused without a queue', () => {
+  const { broker, client, sent, replies } = setup();
+  broker.enqueue(client, transmit(7, 'made up', 0x102));
+  assert.strictEqual(replies[0].type, types.ERROR);
+  assert.strictEqual(replies[0].id, 7);
+  assert.strictEqual(replies[0].message, "no device 'made up'");
+  assert.deepStrictEqual(Object.keys(broker.queues), []);
+  assert.deepStrictEqual(sent, []);
+});
+
+test('a deactivated reader takes no request until its command returns', () => {
+  const { broker, client, replies } = setup();
+  const device = broker.devices.lookup('reader');
+  const pending = [];
+  device.transmit = (data, resLen, protocol, cb) => pending.push(cb);
+  broker.enqueue(client, transmit(1, 'reader', 0x102));
+  broker.enqueue(client, transmit(2, 'reader', 0x102));
+  broker.devices.emit('device-deactivated', { device });
+  broker.enqueue(client, transmit(3, 'reader', 0x102));
+  const answers = () => replies.filter((r) => r.id);
+  assert.deepStrictEqual(
+    answers().map((r) => [r.id, r.message]),
+    [
+      [2, 'device deactivated'],
+      [3, 'device deactivated'],
+    ]
+  );
+  assert.strictEqual(pending.length, 1);
+  pending[0](null, Buffer.from([0x90, 0x00]));
+  assert.strictEqual(answers()[2].id, 1);
+  assert.strictEqual(answers()[2].type, types.RESPONSE);
+  assert.deepStrictEqual(Object.keys(broker.queues), []);
+  // a reader coming back under the same name gets a fresh queue
+  broker.enqueue(client, transmit(4, 'reader', 0x102));
+  assert.strictEqual(pending.length, 2);
+});
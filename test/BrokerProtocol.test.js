@@ -0,0 +1,72 @@
+'use strict';
+
+const test = require('node:test');
+const assert = require('assert');
+const {
+  MAX_FRAME,
+  types,
+  encode,
+  decode,
+  FrameReader,
+} = require('../lib/BrokerProtocol');
+
+const TRANSMIT =
+  '00000016' + // length
+  '20' + // type
+  '00000007' + // id
+  '000152' + // name
+  '00000102' + // responseLength
+  '00000002' + // protocol
+  '0000000200a4'; // data
+
+test('a transmit request encodes to known bytes', () => {
+  const frame = encode(types.TRANSMIT, 7, {
+    name: 'R',
+    responseLength: 258,
+    protocol: 2,
+    data: [0x00, 0xa4],
+  });
+  assert.strictEqual(frame.toString('hex'), TRANSMIT);
+  const message = decode(frame);
+  assert.strictEqual(message.type, types.TRANSMIT);
+  assert.strictEqual(message.id, 7);
+  assert.strictEqual(message.name, 'R');
+  assert.strictEqual(message.responseLength, 258);
+  assert.strictEqual(message.protocol, 2);
+  assert.strictEqual(message.data.toString('hex'), '00a4');
+});
+
+test('frames split across chunks are reassembled', () => {
+  const event = encode(types.CARD_REMOVED, 0, { name: 'Reader 0' });
+  const stream = Buffer.concat([Buffer.from(TRANSMIT, 'hex'), event]);
+  const reader = new FrameReader();
+  assert.deepStrictEqual(reader.push(stream.subarray(0, 3)), []);
+  assert.deepStrictEqual(reader.push(stream.subarray(3, 20)), []);
+  const messages = reader.push(stream.subarray(20));
+  assert.deepStrictEqual(
+    messages.map((message) => message.type),
+    [types.TRANSMIT, types.CARD_REMOVED]
+  );
+  assert.strictEqual(messages[1].name, 'Reader 0');
+  assert.strictEqual(reader.pending.length, 0);
+});
+
+test('oversize and undersize lengths are rejected', () => {
+  const length = Buffer.alloc(4);
+  length.writeUInt32BE(MAX_FRAME + 1, 0);
+  assert.throws(() => new FrameReader().push(length), /malformed frame/);
+  const reader = new FrameReader();
+  assert.throws(() => reader.push(Buffer.from('00000004', 'hex')), /length 4/);
+  assert.strictEqual(reader.pending.length, 0);
+});
+
+test('fields past the end of the frame are rejected', () => {
+  const frame = Buffer.from(TRANSMIT, 'hex');
+  frame.writeUInt32BE(3, 20);
+  assert.throws(() => decode(frame), /'data' past the end/);
+  assert.throws(
+    () => decode(Buffer.from('000000052200000001', 'hex')),
+    /'message' past the end/
+  );
+  assert.throws(() => decode(Buffer.alloc(5)), /malformed frame, 5 bytes/);
+});
@@ -0,0 +1,102 @@
+'use strict';
+
+const test = require('node:test');
+const assert = require('assert');
+const {
+  Card,
+  CommandApdu,
+  Iso7816Application,
+  RetryPolicy,
+} = require('../lib/index');
+
+// a device answering from a list of responses, keeping what was sent
+const device = (responses) => {
+  const sent = [];
+  return {
+    sent,
+    options: {},
+    transmit: (data, resLen, protocol, cb) => {
+      sent.push({ command: data.toString('hex'), resLen });
+      process.nextTick(() => cb(null, Buffer.from(responses.shift(), 'hex')));
+    },
+  };
+};
+
+const transmit = (card, command) =>
+  new Promise((resolve, reject) =>
+    card.transmit(command, (err, response) =>
+      err ? reject(err) : resolve(response.toString('hex'))
+    )
+  );
+
+test('61xx and 9Fxx are answered with GET RESPONSE', () => {
+  const reader = device(['6104', '01029f02', '03049000']);
+  const card = new Card(reader, Buffer.from('3b00', 'hex'), 1);
+  return transmit(card, Buffer.from('a0f2000016', 'hex')).then((response) => {
+    assert.strictEqual(response, '010203049000');
+    assert.deepStrictEqual(
+      reader.sent.map((s) => s.command),
+      ['a0f2000016', 'a0c0000004', 'a0c0000002']
+    );
+  });
+});
+
+test('6Cxx resends the command with the right Le', () => {
+  const reader = device(['6c08', '01020304050607089000']);
+  const card = new Card(reader, Buffer.from('3b00', 'hex'), 1);
+  return transmit(card, '00b0000000').then((response) => {
+    assert.strictEqual(response, '01020304050607089000');
+    assert.strictEqual(reader.sent[1].command, '00b0000008');
+  });
+});
+
+test('exchange keeps the receive length of an extended command', () => {
+  const reader = device(['9000']);
+  const card = new Card(reader, Buffer.from('3b00', 'hex'), 1);
+  const command = new CommandApdu({
+    bytes: [0x00, 0xb0, 0x00, 0x00, 0x00, 0x08, 0x00],
+    extended: true,
+  });
+  return new Iso7816Application(card).exchange(command).then(() => {
+    assert.strictEqual(reader.sent[0].resLen, 0x802);
+  });
+});
+
+test('a card that keeps resetting is recovered at most 3 times', () => {
+  let reconnects = 0;
+  const reader = {
+    options: {},
+    transmit: (data, resLen, protocol, cb) =>
+      process.nextTick(() => cb(new Error('card was reset (0x80100068)'))),
+    reconnect: (cb) => {
+      reconnects++;
+      process.nextTick(() => cb(null, 1));
+    },
+    recovered: () => {},
+  };
+  const card = new Card(reader, Buffer.from('3b00', 'hex'), 1);
+  return assert
+    .rejects(transmit(card, '00b0000000'), /card was reset/)
+    .then(() => assert.strictEqual(reconnects, 3));
+});
+
+test('a retry completes when the policy is cleared meanwhile', () => {
+  const errors = [new Error('timeout (0x8010000a)')];
+  const reader = device(['9000']);
+  const send = reader.transmit;
+  reader.transmit = (data, resLen, protocol, cb) =>
+    errors.length
+      ? process.nextTick(() => cb(errors.shift()))
+      : send(data, resLen, protocol, cb);
+  const card = new Card(reader, Buffer.from('3b00', 'hex'), 1);
+  const policy = new RetryPolicy({ baseMs: 10, random: () => 0.5 });
+  card.setRetryPolicy(policy);
+  const sent = transmit(card, '00b0000000');
+  // after the first attempt failed, before the retry
+  setImmediate(() => card.setRetryPolicy(null));
+  return sent.then((response) => {
+    assert.strictEqual(response, '9000');
+    assert.strictEqual(policy.stats.retries, 1);
+    assert.strictEqual(policy.stats.recovered, 1);
+  });
+});
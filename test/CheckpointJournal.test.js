@@ -0,0 +1,62 @@
+'use strict';
+
+const test = require('node:test');
+const assert = require('assert');
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+const CheckpointJournal = require('../lib/CheckpointJournal');
+
+const journalPath = (t) => {
+  const directory = fs.mkdtempSync(path.join(os.tmpdir(), 'journal-'));
+  t.after(() => fs.rmSync(directory, { recursive: true, force: true }));
+  return path.join(directory, 'journal');
+};
+
+test('reopening replays the latest state of each card', (t) => {
+  const file = journalPath(t);
+  const journal = new CheckpointJournal(file, { sync: false });
+  journal.append({ card: 'A', status: 'started', pc: 0 });
+  journal.append({ card: 'B', status: 'started', pc: 0 });
+  journal.append({ card: 'A', pc: 3, sw: Buffer.from('9000', 'hex') });
+  journal.close();
+  assert.strictEqual(
+    fs.readFileSync(file, 'utf8').split('\n')[2],
+    '{"card":"A","pc":3,"sw":{"hex":"9000"}}'
+  );
+
+  const reopened = new CheckpointJournal(file);
+  assert.strictEqual(reopened.entries, 3);
+  assert.deepStrictEqual(reopened.get('A'), {
+    card: 'A',
+    status: 'started',
+    pc: 3,
+    sw: Buffer.from('9000', 'hex'),
+  });
+  assert.strictEqual(reopened.get('B').pc, 0);
+  assert.strictEqual(reopened.get('C'), null);
+  reopened.close();
+});
+
+test('a torn last line is cut off and appending resumes after it', (t) => {
+  const file = journalPath(t);
+  fs.writeFileSync(file, '{"card":"A","pc":1}\n{"card":"A","pc"');
+  const journal = new CheckpointJournal(file);
+  assert.strictEqual(journal.entries, 1);
+  assert.strictEqual(journal.get('A').pc, 1);
+  journal.append({ card: 'A', pc: 2 });
+  journal.close();
+  assert.strictEqual(
+    fs.readFileSync(file, 'utf8'),
+    '{"card":"A","pc":1}\n{"card":"A","pc":2}\n'
+  );
+});
+
+test('any other unreadable line is an error', (t) => {
+  const file = journalPath(t);
+  fs.writeFileSync(file, '{"card":"A","pc":1}\n{"card":\n{"card":"A"}\n');
+  assert.throws(
+    () => new CheckpointJournal(file),
+    /unreadable entry '\{"card":'/
+  );
+});
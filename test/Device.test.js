@@ -0,0 +1,165 @@
+'use strict';
+
+const test = require('node:test');
+const assert = require('assert');
+const { EventEmitter } = require('events');
+const { Device } = require('../lib/index');
+
+const EMPTY = 0x10;
+const PRESENT = 0x20;
+const ATR = Buffer.from('3b8f8001804f0ca000000306030001000000006a', 'hex');
+const OTHER = Buffer.from('3b8880010000000000718100f9', 'hex');
+
+// a pcsclite reader whose connects complete when the test says so
+const fakeReader = () => {
+  const reader = Object.assign(new EventEmitter(), {
+    name: 'Fake Reader 00 00',
+    state: 0,
+    SCARD_STATE_EMPTY: EMPTY,
+    SCARD_STATE_PRESENT: PRESENT,
+    SCARD_LEAVE_CARD: 0,
+    connects: [],
+    disconnects: 0,
+    connect: (options, cb) => reader.connects.push(cb),
+    disconnect: (disposition, cb) => {
+      reader.disconnects++;
+      process.nextTick(() => cb(null));
+    },
+    close: () => {},
+    // like pcsclite, the state is updated after the event
+    status: (state, atr) => {
+      reader.emit('status', { state, atr });
+      reader.state = state;
+    },
+    insert: (atr) => reader.status(PRESENT, atr || ATR),
+    remove: () => reader.status(EMPTY),
+    connected: () => reader.connects.shift()(null, 2),
+  });
+  return reader;
+};
+
+const record = (device) => {
+  const events = [];
+  device.on('card-inserted', ({ card }) => events.push(`in ${card.atr}`));
+  device.on('card-removed', ({ card }) => events.push(`out ${card.atr}`));
+  return events;
+};
+
+const tick = () => new Promise((resolve) => setImmediate(resolve));
+const sleep = (ms) => new Promise((resolve) => setTimeout(resolve, ms));
+
+test('a card is connected when inserted, released when removed', async () => {
+  const reader = fakeReader();
+  const device = new Device(reader);
+  const events = record(device);
+  reader.insert();
+  assert.strictEqual(device.state, 'connecting');
+  reader.connected();
+  assert.strictEqual(device.state, 'connected');
+  assert.strictEqual(device.card.atr, ATR.toString('hex'));
+  reader.remove();
+  assert.strictEqual(device.state, 'removing');
+  await tick();
+  assert.strictEqual(device.state, 'empty');
+  assert.strictEqual(device.card, null);
+  const hex = ATR.toString('hex');
+  assert.deepStrictEqual(events, [`in ${hex}`, `out ${hex}`]);
+  const metrics = device.getMetrics();
+  assert.strictEqual(metrics.state, 'empty');
+  assert.strictEqual(metrics.statusChanges, 2);
+  assert.strictEqual(metrics.connects, 1);
+  assert.strictEqual(metrics.insertions, 1);
+  assert.strictEqual(metrics.removals, 1);
+  assert.deepStrictEqual(metrics.transitions, {
+    'empty->present': 1,
+    'present->connecting': 1,
+    'connecting->connected': 1,
+    'connected->removing': 1,
+    'removing->empty': 1,
+  });
+});
+
+test('a card removed while connecting is dropped', async () => {
+  const reader = fakeReader();
+  const device = new Device(reader);
+  const events = record(device);
+  reader.insert();
+  reader.remove();
+  assert.strictEqual(device.state, 'connecting');
+  reader.connected();
+  assert.strictEqual(device.state, 'removing');
+  await tick();
+  assert.strictEqual(device.state, 'empty');
+  assert.deepStrictEqual(events, []);
+  assert.strictEqual(reader.disconnects, 1);
+  const metrics = device.getMetrics();
+  assert.strictEqual(metrics.coalesced, 1);
+  assert.strictEqual(metrics.wastedConnects, 1);
+  assert.strictEqual(metrics.insertions, 0);
+  assert.strictEqual(metrics.transitions['connecting->removing'], 1);
+});
+
+test('the same card put back while connecting gets a new connect', async () => {
+  const reader = fakeReader();
+  const device = new Device(reader);
+  const events = record(device);
+  reader.insert();
+  reader.remove();
+  reader.insert();
+  reader.connected();
+  assert.strictEqual(device.card, null);
+  await tick();
+  // the stale handle is released and the card connected again
+  assert.strictEqual(device.state, 'connecting');
+  reader.connected();
+  assert.strictEqual(device.state, 'connected');
+  assert.deepStrictEqual(events, [`in ${ATR.toString('hex')}`]);
+  const metrics = device.getMetrics();
+  assert.strictEqual(metrics.connects, 2);
+  assert.strictEqual(metrics.wastedConnects, 1);
+  assert.strictEqual(metrics.coalesced, 2);
+  assert.strictEqual(metrics.insertions, 1);
+});
+
+test('a card swapped while connected is removed, the other added', async () => {
+  const reader = fakeReader();
+  const device = new Device(reader);
+  const events = record(device);
+  reader.insert();
+  reader.connected();
+  reader.remove();
+  reader.insert(OTHER);
+  assert.strictEqual(device.state, 'removing');
+  await tick();
+  reader.connected();
+  assert.strictEqual(device.card.atr, OTHER.toString('hex'));
+  assert.deepStrictEqual(events, [
+    `in ${ATR.toString('hex')}`,
+    `out ${ATR.toString('hex')}`,
+    `in ${OTHER.toString('hex')}`,
+  ]);
+});
+
+test('a bounce inside debounceMs never connects', async () => {
+  const reader = fakeReader();
+  const device = new Device(reader, { debounceMs: 20 });
+  reader.insert();
+  assert.strictEqual(device.state, 'present');
+  reader.remove();
+  assert.strictEqual(device.state, 'empty');
+  await sleep(40);
+  assert.strictEqual(reader.connects.length, 0);
+  reader.insert();
+  await sleep(40);
+  assert.strictEqual(device.state, 'connecting');
+  reader.connected();
+  const metrics = device.getMetrics();
+  assert.strictEqual(metrics.connects, 1);
+  assert.strictEqual(metrics.wastedConnects, 0);
+  assert.deepStrictEqual(metrics.transitions, {
+    'empty->present': 2,
+    'present->empty': 1,
+    'present->connecting': 1,
+    'connecting->connected': 1,
+  });
+});
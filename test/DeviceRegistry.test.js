@@ -0,0 +1,120 @@
+'use strict';
+
+const test = require('node:test');
+const assert = require('assert');
+const { EventEmitter } = require('events');
+const DeviceRegistry = require('../lib/DeviceRegistry');
+
+const fakeDevices = (initial) =>
+  Object.assign(new EventEmitter(), {
+    list: initial || [],
+    listDevices() {
+      return this.list;
+    },
+  });
+
+const fakeDevice = (name) =>
+  Object.assign(new EventEmitter(), { name, card: null, busy: false });
+
+const fakeCard = (atr, tag) => ({ tag: tag || null, getAtr: () => atr });
+
+const insert = (device, card) => {
+  device.card = card;
+  device.emit('card-inserted', { device, card });
+};
+
+const remove = (device) => {
+  const card = device.card;
+  device.card = null;
+  device.emit('card-removed', { name: device.name, card });
+};
+
+const names = (set) => Array.from(set, (device) => device.name).sort();
+
+test('devices are indexed by reader type, profile and presence', () => {
+  const a = fakeDevice('ACS ACR122U 00 00');
+  const devices = fakeDevices([a]);
+  const registry = new DeviceRegistry(devices);
+  const b = fakeDevice('ACS ACR122U 01 00');
+  const c = fakeDevice('Gemalto PC Twin Reader 00 00');
+  devices.emit('device-activated', { device: b });
+  devices.emit('device-activated', { device: c });
+
+  assert.strictEqual(registry.count({}), 3);
+  assert.deepStrictEqual(names(registry.select({ type: 'ACS ACR122U' })), [
+    'ACS ACR122U 00 00',
+    'ACS ACR122U 01 00',
+  ]);
+  assert.strictEqual(registry.count({ present: false }), 3);
+  assert.strictEqual(registry.count({ idle: true }), 0);
+
+  insert(a, fakeCard('3b00', { name: 'MIFARE Classic 1K' }));
+  insert(c, fakeCard('3b8f'));
+  assert.strictEqual(registry.first({ profile: 'MIFARE Classic 1K' }), a);
+  assert.strictEqual(registry.first({ profile: '3b8f', present: true }), c);
+  assert.deepStrictEqual(
+    names(registry.select({ type: 'ACS ACR122U', present: false })),
+    ['ACS ACR122U 01 00']
+  );
+  assert.strictEqual(registry.count({ present: true, idle: true }), 2);
+
+  remove(a);
+  assert.strictEqual(registry.count({ profile: 'MIFARE Classic 1K' }), 0);
+  assert.strictEqual(registry.count({ present: false }), 2);
+
+  devices.emit('device-deactivated', { device: c });
+  assert.strictEqual(registry.count({}), 2);
+  assert.strictEqual(registry.count({ profile: '3b8f' }), 0);
+  // a removed device is no longer watched
+  insert(c, fakeCard('3b8f'));
+  assert.strictEqual(registry.count({ present: true }), 0);
+});
+
+test('busy and idle move a device between the idle sets', () => {
+  const device = fakeDevice('Reader 0');
+  const registry = new DeviceRegistry(fakeDevices([device]));
+  const idle = registry.select({ idle: true });
+  insert(device, fakeCard('3b00'));
+  assert.ok(idle.has(device));
+  device.busy = true;
+  device.emit('busy', { device });
+  assert.ok(!idle.has(device));
+  assert.strictEqual(registry.first({ idle: false }), device);
+  device.busy = false;
+  device.emit('idle', { device });
+  assert.ok(idle.has(device));
+  assert.strictEqual(registry.count({ idle: false }), 0);
+});
+
+test('subscribers hear devices entering and leaving their set', () => {
+  const device = fakeDevice('Reader 0');
+  const registry = new DeviceRegistry(fakeDevices([device]));
+  const heard = [];
+  const unsubscribe = registry.subscribe(
+    { profile: 'piv', idle: true },
+    ({ device: d, added }) => heard.push(`${d.name} ${added}`)
+  );
+  insert(device, { warmUp: { profile: 'piv' }, getAtr: () => '3b00' });
+  device.busy = true;
+  device.emit('busy', { device });
+  device.busy = false;
+  device.emit('idle', { device });
+  assert.deepStrictEqual(heard, [
+    'Reader 0 true',
+    'Reader 0 false',
+    'Reader 0 true',
+  ]);
+  unsubscribe();
+  remove(device);
+  assert.strictEqual(heard.length, 3);
+  assert.deepStrictEqual(registry.subscribers, {});
+});
+
+test('close stops the indexing', () => {
+  const devices = fakeDevices();
+  const registry = new DeviceRegistry(devices);
+  registry.close();
+  devices.emit('device-activated', { device: fakeDevice('Reader 0') });
+  assert.strictEqual(registry.count({}), 0);
+  assert.strictEqual(devices.listenerCount('device-activated'), 0);
+});
@@ -0,0 +1,36 @@
+'use strict';
+
+const test = require('node:test');
+const assert = require('assert');
+const { EventEmitter } = require('events');
+const { Devices, Device } = require('../lib/index');
+
+const reader = (name) =>
+  Object.assign(new EventEmitter(), { name, close: () => {} });
+
+test('close() reports only the devices it closed', () => {
+  const devices = new Devices({ autoStart: false });
+  ['a', 'b'].forEach((name) => {
+    devices.devices[name] = new Device(reader(name), devices.options);
+    devices.endHandlers[name] = () => {};
+  });
+  return devices.devices.a
+    .close()
+    .then(() => devices.close())
+    .then((report) => {
+      assert.deepStrictEqual(report.readers.map((r) => r.name), ['b']);
+      assert.strictEqual(report.drained, true);
+      assert.strictEqual(report.abandoned, 0);
+      assert.deepStrictEqual(devices.devices, {});
+    });
+});
+
+test('listing or printing the devices does not start PC/SC', () => {
+  const devices = new Devices();
+  devices.start = () => assert.fail('started');
+  assert.deepStrictEqual(devices.listDevices(), []);
+  assert.strictEqual(`${devices}`, "Devices('')");
+  devices.devices.a = new Device(reader('a'), devices.options);
+  assert.strictEqual(`${devices}`, "Devices('a')");
+  assert.strictEqual(devices.pcsc, null);
+});
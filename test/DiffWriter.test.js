@@ -0,0 +1,168 @@
+'use strict';
+
+const test = require('node:test');
+const assert = require('assert');
+const DiffWriter = require('../lib/DiffWriter');
+
+const sw = (value) => Buffer.from([value >> 8, value & 0xff]);
+
+// an application over one transparent EF and one record file, logging the
+// instructions and P1 P2 Lc of what it is sent
+const fakeApplication = (binary, records) => {
+  const app = {
+    binary: Buffer.from(binary),
+    records: records.map((record) => Buffer.from(record)),
+    sent: [],
+    exchange: (command) => {
+      app.sent.push(command.subarray(0, 5).toString('hex'));
+      const offset = ((command[2] & 0x7f) << 8) | command[3];
+      const data = command.subarray(5);
+      let response = sw(0x9000);
+      switch (command[1]) {
+        case 0xb0: {
+          const end = offset + (command[4] || 0x100);
+          response =
+            offset < app.binary.length
+              ? Buffer.concat([app.binary.subarray(offset, end), sw(0x9000)])
+              : sw(0x6b00);
+          break;
+        }
+        case 0xd6:
+          data.copy(app.binary, offset);
+          break;
+        case 0xb2:
+          response =
+            command[2] <= app.records.length
+              ? Buffer.concat([app.records[command[2] - 1], sw(0x9000)])
+              : sw(0x6a83);
+          break;
+        case 0xdc:
+          app.records[command[2] - 1] = Buffer.from(data);
+          break;
+        case 0xe2:
+          app.records.push(Buffer.from(data));
+          break;
+      }
+      return Promise.resolve(response);
+    },
+  };
+  return app;
+};
+
+test('changed ranges merge runs at most gap bytes apart', () => {
+  const current = Buffer.alloc(10);
+  const data = Buffer.from('00aa00bb0000000000cc', 'hex');
+  const { changedRanges } = DiffWriter;
+  assert.deepStrictEqual(changedRanges(current, data, 0), [
+    [1, 2],
+    [3, 4],
+    [9, 10],
+  ]);
+  assert.deepStrictEqual(changedRanges(current, data, 1), [
+    [1, 4],
+    [9, 10],
+  ]);
+  assert.deepStrictEqual(changedRanges(current, data, 5), [[1, 10]]);
+  assert.deepStrictEqual(changedRanges(current, current, 4), []);
+  // bytes past the current content always count as changed
+  assert.deepStrictEqual(changedRanges(current, Buffer.alloc(12), 4), [
+    [10, 12],
+  ]);
+});
+
+test('changed bytes go out in chunks of at most maxWrite', async () => {
+  const app = fakeApplication(Buffer.alloc(600), []);
+  const writer = new DiffWriter(app, { maxWrite: 0x80 });
+  const data = Buffer.alloc(600);
+  data.fill(0x11, 10, 310);
+  const report = await writer.writeBinary(data, { fileId: 0x0101 });
+  assert.deepStrictEqual(app.sent, [
+    '00a4000c02',
+    '00b0000000',
+    '00b0010000',
+    '00b0020058',
+    '00d6000a80',
+    '00d6008a80',
+    '00d6010a2c',
+  ]);
+  assert.deepStrictEqual(app.binary, data);
+  assert.strictEqual(report.readBytes, 600);
+  assert.strictEqual(report.commands, 3);
+  assert.strictEqual(report.written, 300);
+  assert.strictEqual(report.skipped, 300);
+});
+
+test('unchanged bytes within mergeGap are rewritten', async () => {
+  const data = Buffer.from('aa0000bb', 'hex');
+  const merged = fakeApplication(Buffer.alloc(4), []);
+  const report = await new DiffWriter(merged).writeBinary(data);
+  assert.deepStrictEqual(merged.sent.slice(1), ['00d6000004']);
+  assert.deepStrictEqual([report.written, report.skipped], [4, 0]);
+  const apart = fakeApplication(Buffer.alloc(4), []);
+  const split = await new DiffWriter(apart, { mergeGap: 1 }).writeBinary(data);
+  assert.deepStrictEqual(apart.sent.slice(1), ['00d6000001', '00d6000301']);
+  assert.deepStrictEqual([split.written, split.skipped], [2, 2]);
+});
+
+test('a remembered image replaces reading the card', async () => {
+  const app = fakeApplication(Buffer.alloc(8), []);
+  const writer = new DiffWriter(app);
+  await writer.writeBinary(Buffer.alloc(8, 0x01), { key: 'ef' });
+  app.sent = [];
+  const data = Buffer.alloc(8, 0x01);
+  data[7] = 0x02;
+  const report = await writer.writeBinary(data, { key: 'ef' });
+  assert.deepStrictEqual(app.sent, ['00d6000701']);
+  assert.strictEqual(report.readBytes, 0);
+  writer.forget('ef');
+  app.sent = [];
+  await writer.writeBinary(data, { key: 'ef' });
+  assert.deepStrictEqual(app.sent, ['00b0000008']);
+});
+
+test('records are updated, appended or skipped', async () => {
+  const app = fakeApplication([], [[0x01, 0x02], [0x03, 0x04]]);
+  const writer = new DiffWriter(app);
+  const report = await writer.writeRecords(
+    [
+      [0x01, 0x02],
+      [0x03, 0x05],
+      [0x06, 0x07, 0x08],
+    ],
+    { sfi: 2 }
+  );
+  assert.deepStrictEqual(app.sent, [
+    '00b2011400',
+    '00b2021400',
+    '00b2031400',
+    '00dc021402',
+    '00e2001003',
+  ]);
+  assert.strictEqual(app.records.length, 3);
+  assert.deepStrictEqual(report, {
+    written: 5,
+    skipped: 2,
+    updated: 1,
+    appended: 1,
+    unchanged: 1,
+    commands: 2,
+    durationMs: report.durationMs,
+  });
+});
+
+test('one key can name a binary image and a record image', async () => {
+  const app = fakeApplication(Buffer.alloc(2), [[0x01]]);
+  const writer = new DiffWriter(app);
+  await writer.writeBinary(Buffer.from([0x01, 0x02]), { key: 'ef' });
+  app.sent = [];
+  const report = await writer.writeRecords([[0x01], [0x02]], { key: 'ef' });
+  assert.deepStrictEqual(app.sent, [
+    '00b2010400',
+    '00b2020400',
+    '00e2000001',
+  ]);
+  assert.strictEqual(report.unchanged, 1);
+  app.sent = [];
+  await writer.writeBinary(Buffer.from([0x01, 0x03]), { key: 'ef' });
+  assert.deepStrictEqual(app.sent, ['00d6000101']);
+});
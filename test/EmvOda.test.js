@@ -0,0 +1,214 @@
+'use strict';
+
+// EmvOda over a test PKI: certificates and signatures are laid out here as
+// EMV Book 2 tables 6, 7, 14 and 17 give them, and signed with raw RSA
+
+const test = require('node:test');
+const assert = require('assert');
+const crypto = require('crypto');
+const { CaKeyStore, EmvOda, ResponseApdu, Tlv } = require('../lib/index');
+
+const hex = (text) => Buffer.from(text.replace(/ /g, ''), 'hex');
+const sha1 = (...parts) =>
+  parts.reduce((h, p) => h.update(p), crypto.createHash('sha1')).digest();
+
+const keyPair = () => {
+  const { privateKey, publicKey } = crypto.generateKeyPairSync('rsa', {
+    modulusLength: 1024,
+    publicExponent: 3,
+  });
+  const jwk = publicKey.export({ format: 'jwk' });
+  return {
+    privateKey,
+    modulus: Buffer.from(jwk.n, 'base64'),
+    exponent: Buffer.from(jwk.e, 'base64'),
+  };
+};
+
+// 6A | fields | hash over fields and tail | BC, signed with raw RSA
+const sign = (signer, fields, tail) => {
+  const body = Buffer.concat(fields);
+  const data = Buffer.concat([
+    hex('6A'),
+    body,
+    sha1(body, ...tail),
+    hex('BC'),
+  ]);
+  assert.strictEqual(data.length, signer.modulus.length);
+  return crypto.privateEncrypt(
+    { key: signer.privateKey, padding: crypto.constants.RSA_NO_PADDING },
+    data
+  );
+};
+
+// the leftmost digits of a key that fit, and the remainder
+const split = (modulus, room) => ({
+  digits: modulus.subarray(0, room),
+  remainder: modulus.subarray(room),
+});
+
+const rid = hex('A000000003');
+const pan = hex('4761739001010010');
+const staticData = hex('5A084761739001010010 5F24033012318200 5C00');
+const ca = keyPair();
+const issuer = keyPair();
+const icc = keyPair();
+
+const issuerCertificate = (expiry) => {
+  const { digits, remainder } = split(issuer.modulus, ca.modulus.length - 36);
+  const fields = [
+    hex('02'),
+    hex('476173FF'),
+    hex(expiry),
+    hex('000001'),
+    hex('0101'),
+    Buffer.from([issuer.modulus.length, issuer.exponent.length]),
+    digits,
+  ];
+  return {
+    '90': sign(ca, fields, [remainder, issuer.exponent]),
+    '92': remainder,
+    '9f32': issuer.exponent,
+    '8f': hex('92'),
+  };
+};
+
+const iccCertificate = (certifiedPan) => {
+  const { digits, remainder } = split(icc.modulus, issuer.modulus.length - 42);
+  const fields = [
+    hex('04'),
+    Buffer.concat([certifiedPan, Buffer.alloc(2, 0xff)]),
+    hex('1230'),
+    hex('000002'),
+    hex('0101'),
+    Buffer.from([icc.modulus.length, icc.exponent.length]),
+    digits,
+  ];
+  return {
+    '9f46': sign(issuer, fields, [remainder, icc.exponent, staticData]),
+    '9f48': remainder,
+    '9f47': icc.exponent,
+  };
+};
+
+const signedStaticData = () => {
+  const pad = Buffer.alloc(issuer.modulus.length - 26, 0xbb);
+  return sign(issuer, [hex('03 01 DAC1'), pad], [staticData]);
+};
+
+const signedDynamicData = (dynamic, unpredictableNumber) => {
+  const pad = Buffer.alloc(icc.modulus.length - dynamic.length - 25, 0xbb);
+  const fields = [hex('05 01'), Buffer.from([dynamic.length]), dynamic, pad];
+  return sign(icc, fields, [unpredictableNumber]);
+};
+
+const tags = (overrides) =>
+  Object.assign(
+    { '5a': pan },
+    issuerCertificate('1230'),
+    iccCertificate(pan),
+    { '93': signedStaticData() },
+    overrides
+  );
+
+const oda = () =>
+  new EmvOda({
+    caKeys: new CaKeyStore([
+      { rid, index: 0x92, modulus: ca.modulus, exponent: ca.exponent },
+    ]),
+    now: () => new Date(Date.UTC(2026, 0, 15)),
+  });
+
+test('SDA, and the issuer key from the cache the second time', () => {
+  const verifier = oda();
+  return verifier
+    .verifySda(rid, tags(), staticData)
+    .then((result) => {
+      assert.strictEqual(result.error, null);
+      assert.strictEqual(result.dataAuthenticationCode, 'dac1');
+      assert.strictEqual(result.issuerKeyCached, false);
+      return verifier.verifySda(rid, tags(), staticData);
+    })
+    .then((result) => {
+      assert.strictEqual(result.ok, true);
+      assert.strictEqual(result.issuerKeyCached, true);
+      assert.strictEqual(verifier.getStats().issuerKeys, 1);
+    });
+});
+
+test('DDA over INTERNAL AUTHENTICATE', () => {
+  const challenge = hex('01020304');
+  const sdad = signedDynamicData(hex('03 AABBCC'), challenge);
+  const application = {
+    issueCommand: (command) => {
+      assert.strictEqual(command.toString(), '00880000040102030400');
+      return Promise.resolve(
+        new ResponseApdu(Buffer.concat([Tlv.encode(0x80, sdad), hex('9000')]))
+      );
+    },
+  };
+  return oda()
+    .verifyDda(application, rid, tags(), staticData, challenge)
+    .then((result) => {
+      assert.strictEqual(result.error, null);
+      assert.strictEqual(result.iccDynamicNumber, 'aabbcc');
+    });
+});
+
+test('CDA over a GENERATE AC response', () => {
+  const unpredictableNumber = hex('11223344');
+  const transactionData = hex('000000001000 0978 9F2701 80');
+  const dynamic = Buffer.concat([
+    hex('02 1234'),
+    hex('80'),
+    hex('0102030405060708'),
+    sha1(transactionData),
+  ]);
+  const generateAc = {
+    sdad: signedDynamicData(dynamic, unpredictableNumber),
+    unpredictableNumber,
+    transactionData,
+    cid: 0x80,
+  };
+  const verifier = oda();
+  return verifier
+    .verifyCda(rid, tags(), staticData, generateAc)
+    .then((result) => {
+      assert.strictEqual(result.error, null);
+      assert.strictEqual(result.cryptogram, '0102030405060708');
+      const tampered = Object.assign({}, generateAc, {
+        transactionData: hex('000000002000 0978 9F2701 80'),
+      });
+      return verifier.verifyCda(rid, tags(), staticData, tampered);
+    })
+    .then((result) => {
+      assert.strictEqual(result.error, 'transaction data hash wrong');
+    });
+});
+
+test('expired, foreign and altered certificates are refused', () => {
+  const verifier = oda();
+  const altered = Buffer.from(staticData);
+  altered[altered.length - 1] ^= 1;
+  return Promise.all([
+    verifier.verifySda(rid, tags(issuerCertificate('1225')), staticData),
+    verifier.verifyDda(
+      null,
+      rid,
+      tags(iccCertificate(hex('4761739001010028'))),
+      staticData
+    ),
+    verifier.verifySda(rid, tags(), altered),
+    verifier.verifySda(rid, tags({ '8f': hex('99') }), staticData),
+  ]).then((results) => {
+    assert.deepStrictEqual(
+      results.map((r) => r.error),
+      [
+        'issuer certificate expired 1225',
+        'ICC certificate is for another PAN',
+        'recovered data hash wrong',
+        'no CA key a000000003 index 153',
+      ]
+    );
+  });
+});
@@ -0,0 +1,50 @@
+'use strict';
+
+const test = require('node:test');
+const assert = require('assert');
+const { EventEmitter } = require('events');
+const EventStream = require('../lib/EventStream').default;
+
+const device = () => Object.assign(new EventEmitter(), { name: 'reader' });
+
+const take = (stream, count) => {
+  const values = [];
+  const next = () =>
+    values.length === count
+      ? Promise.resolve(values)
+      : stream.next().then((result) => {
+          values.push(result.value);
+          return next();
+        });
+  return next();
+};
+
+test('an insert followed by its remove is delivered as both', () => {
+  const reader = device();
+  const stream = EventStream.forDevice(reader);
+  reader.emit('card-inserted', { atr: '01' });
+  reader.emit('card-removed', {});
+  reader.emit('card-inserted', { atr: '02' });
+  return take(stream, 3).then((events) => {
+    assert.deepStrictEqual(
+      events.map((e) => e.type),
+      ['card-inserted', 'card-removed', 'card-inserted']
+    );
+    assert.strictEqual(events[2].atr, '02');
+    assert.strictEqual(stream.stats.coalesced, 0);
+    stream.return();
+  });
+});
+
+test('repeats of the same event collapse into the latest', () => {
+  const reader = device();
+  const stream = EventStream.forDevice(reader);
+  reader.emit('card-inserted', { atr: '01' });
+  reader.emit('card-inserted', { atr: '02' });
+  return take(stream, 1).then(([event]) => {
+    assert.strictEqual(event.atr, '02');
+    assert.strictEqual(stream.stats.coalesced, 1);
+    assert.strictEqual(stream.buffer.length, 0);
+    stream.return();
+  });
+});
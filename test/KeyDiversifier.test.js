@@ -0,0 +1,107 @@
+'use strict';
+
+// known answers of KeyDiversifier; the expected keys were computed with
+// OpenSSL (des-ede, aes-128-ecb and its CMAC) over blocks laid out by hand,
+// and 3DES keys parity adjusted
+
+const test = require('node:test');
+const assert = require('assert');
+const { KeyDiversifier } = require('../lib/index');
+
+const hex = (text) => Buffer.from(text.replace(/ /g, ''), 'hex');
+
+const masterKey = hex('0123456789ABCDEF FEDCBA9876543210');
+
+test('option A takes the rightmost 16 digits of PAN and PSN', () => {
+  assert.deepStrictEqual(
+    KeyDiversifier.optionA('5413330089020011', '01'),
+    hex('1333008902001101')
+  );
+  assert.deepStrictEqual(
+    KeyDiversifier.optionA(hex('5413330089020011FFFF'), '01'),
+    hex('1333008902001101')
+  );
+});
+
+test('option B is option A for a PAN of 16 digits or fewer', () => {
+  assert.deepStrictEqual(
+    KeyDiversifier.optionB('5413330089020011', '01'),
+    hex('1333008902001101')
+  );
+  assert.deepStrictEqual(
+    KeyDiversifier.optionB('541333008902001', '00'),
+    hex('4133300890200100')
+  );
+});
+
+test('option B decimalizes the SHA-1 of a longer PAN and PSN', () => {
+  assert.deepStrictEqual(
+    KeyDiversifier.optionB('5413330089020011234', '01'),
+    hex('1479606954530008')
+  );
+});
+
+test('ICC master keys', () => {
+  const diversifier = new KeyDiversifier();
+  const [a, b16, b19] = diversifier.deriveBatch([
+    { method: 'emv-a', key: masterKey, pan: '5413330089020011', psn: '01' },
+    { method: 'emv-b', key: masterKey, pan: '5413330089020011', psn: '01' },
+    { method: 'emv-b', key: masterKey, pan: '5413330089020011234', psn: '01' },
+  ]);
+  assert.deepStrictEqual(a, hex('73C4677545D991E986074A16BFBACD75'));
+  assert.deepStrictEqual(b16, a);
+  assert.deepStrictEqual(b19, hex('CB1C3B4AA88A5E7551EF1079A804F851'));
+});
+
+test('common session keys from the ATC', () => {
+  const diversifier = new KeyDiversifier();
+  const [tdes, aes] = diversifier.deriveBatch([
+    { method: 'emv-csk', key: masterKey, atc: 1 },
+    { method: 'emv-csk', key: masterKey, atc: 1, cipher: 'aes' },
+  ]);
+  assert.deepStrictEqual(tdes, hex('858C34707F67D50845F8296EF19BBFFD'));
+  assert.deepStrictEqual(aes, hex('44317CF550591F2DD0ABC4ECFD7578B6'));
+});
+
+test('CPS static keys from the last 6 bytes of the KDD', () => {
+  const kdd = hex('0000AABB 112233445566');
+  const [enc, mac] = new KeyDiversifier().deriveBatch([
+    { method: 'emv-cps', key: masterKey, kdd, usage: 'enc' },
+    { method: 'emv-cps', key: masterKey, kdd, usage: 'mac' },
+  ]);
+  assert.deepStrictEqual(enc, hex('F5806FDB5DF588596003A65455B1A5D6'));
+  assert.deepStrictEqual(mac, hex('67293611DE9E454762BE89776BB28FF3'));
+});
+
+test('SCP03 KDF, one and two blocks and a cryptogram', () => {
+  const key = hex('404142434445464748494A4B4C4D4E4F');
+  const context = hex('0001020304050607 08090A0B0C0D0E0F');
+  const { constants } = KeyDiversifier;
+  const [enc, mac, cryptogram] = new KeyDiversifier().deriveBatch([
+    { method: 'cmac', key, constant: constants.S_ENC, context },
+    { method: 'cmac', key, constant: constants.S_MAC, context, length: 256 },
+    {
+      method: 'cmac',
+      key,
+      constant: constants.CARD_CRYPTOGRAM,
+      context,
+      length: 64,
+    },
+  ]);
+  assert.deepStrictEqual(enc, hex('EB845BBC703969A9B312A5F8E4834AA2'));
+  assert.deepStrictEqual(
+    mac,
+    hex('F862F14F3AEAF76B7F63B2358E35241C 692FD3FE26413DC4609F38D02E643B03')
+  );
+  assert.deepStrictEqual(cryptogram, hex('18D3FADAA199CCD1'));
+});
+
+test('a batch shares cipher calls between derivations', () => {
+  const diversifier = new KeyDiversifier();
+  diversifier.deriveBatch([
+    { method: 'emv-a', key: masterKey, pan: '5413330089020011', psn: '01' },
+    { method: 'emv-a', key: masterKey, pan: '5413330089020029', psn: '01' },
+    { method: 'emv-csk', key: masterKey, atc: 7 },
+  ]);
+  assert.strictEqual(diversifier.getStats().cipherCalls, 1);
+});
@@ -0,0 +1,57 @@
+'use strict';
+
+const test = require('node:test');
+const assert = require('assert');
+const { Ndef } = require('../lib/index');
+
+test('text and URI records encode to known bytes', () => {
+  const text = Ndef.encode([Ndef.textRecord('hello', 'en')]);
+  assert.strictEqual(text.toString('hex'), 'd101085402656e68656c6c6f');
+  const uri = Ndef.encode([Ndef.uriRecord('https://example.com')]);
+  assert.strictEqual(uri.toString('hex'), 'd1010c55046578616d706c652e636f6d');
+  const www = Ndef.uriRecord('https://www.example.com');
+  assert.strictEqual(www.payload[0], 0x02);
+});
+
+test('a two record message round trips', () => {
+  const message = Ndef.encode([
+    Ndef.textRecord('hola', 'es'),
+    Ndef.uriRecord('tel:+1555'),
+  ]);
+  assert.strictEqual(message[0], 0x91);
+  const records = Ndef.parse(message);
+  assert.strictEqual(records.length, 2);
+  assert.strictEqual(records[1].type.toString(), 'U');
+  assert.deepStrictEqual(Ndef.decodeText(records[0]), {
+    language: 'es',
+    text: 'hola',
+  });
+  assert.strictEqual(Ndef.decodeUri(records[1]), 'tel:+1555');
+});
+
+test('long payloads use a four byte length', () => {
+  const payload = Buffer.alloc(300, 0xaa);
+  const message = Ndef.encode([{ tnf: Ndef.TNF.MEDIA, type: 'a/b', payload }]);
+  assert.strictEqual(message.subarray(0, 6).toString('hex'), 'c2030000012c');
+  const [record] = Ndef.parse(message);
+  assert.strictEqual(record.tnf, Ndef.TNF.MEDIA);
+  assert.deepStrictEqual(record.payload, payload);
+});
+
+test('chunked payloads are joined', () => {
+  const message = Buffer.from('b101035402656e56000268690000', 'hex');
+  const records = Ndef.parse(message, 0, 12);
+  assert.strictEqual(records.length, 1);
+  assert.deepStrictEqual(Ndef.decodeText(records[0]), {
+    language: 'en',
+    text: 'hi',
+  });
+});
+
+test('a record past the end of the message throws', () => {
+  const message = Buffer.from('d101085402656e68656c6c6f', 'hex');
+  assert.throws(
+    () => Ndef.parse(message, 0, message.length - 1),
+    /exceeds the message/
+  );
+});
@@ -0,0 +1,115 @@
+'use strict';
+
+const test = require('node:test');
+const assert = require('assert');
+const { EventEmitter } = require('events');
+const { OpenPgpApplication } = require('../lib/index');
+
+// a card that accepts PIN 123456 and signs anything with 'abcd'
+const fakeCard = () => {
+  const card = {
+    device: new EventEmitter(),
+    sent: [],
+    issueCommand: (command) => {
+      const hex = command.toString();
+      card.sent.push(hex.substring(0, 8));
+      let response = '9000';
+      if (hex.startsWith('00200081')) {
+        response = hex.includes('06313233343536') ? '9000' : '63c2';
+      } else if (hex.startsWith('002a9e9a')) {
+        response = 'abcd9000';
+      }
+      return Promise.resolve(Buffer.from(response, 'hex'));
+    },
+  };
+  return card;
+};
+
+const VERIFY = '00200081';
+const PSO_CDS = '002a9e9a';
+
+const singleSignature = {
+  extendedLength: false,
+  commandChaining: false,
+  pw1ValidForMultipleSignatures: false,
+};
+
+test('verify() is for signing by default and not sent twice', async () => {
+  const card = fakeCard();
+  const app = new OpenPgpApplication(card);
+  app.capabilities = Object.assign({}, singleSignature, {
+    pw1ValidForMultipleSignatures: true,
+  });
+  await app.verify('123456');
+  const response = await app.verify('123456');
+  assert.strictEqual(response.isOk(), true);
+  const results = await app.sign([Buffer.alloc(32), Buffer.alloc(32)]);
+  assert.strictEqual(results[1].signature.toString('hex'), 'abcd');
+  assert.deepStrictEqual(card.sent, [VERIFY, PSO_CDS, PSO_CDS]);
+  assert.strictEqual(app.signingPin, null);
+});
+
+test('without cachePin a single signature PW1 is not replayed', async () => {
+  const card = fakeCard();
+  const app = new OpenPgpApplication(card);
+  app.capabilities = singleSignature;
+  await app.verify('123456');
+  await app.computeDigitalSignature(Buffer.alloc(32));
+  await assert.rejects(
+    app.computeDigitalSignature(Buffer.alloc(32)),
+    /no PIN is cached/
+  );
+  assert.deepStrictEqual(card.sent, [VERIFY, PSO_CDS]);
+});
+
+test('with cachePin the PIN is verified before each signature', async () => {
+  const card = fakeCard();
+  const app = new OpenPgpApplication(card, { cachePin: true });
+  app.capabilities = singleSignature;
+  await app.verify(Buffer.from('123456'));
+  await app.sign([Buffer.alloc(32), Buffer.alloc(32)]);
+  assert.deepStrictEqual(card.sent, [VERIFY, PSO_CDS, VERIFY, PSO_CDS]);
+
+  // removing the card wipes the PIN
+  const pin = app.signingPin;
+  card.device.emit('card-removed', { card });
+  assert.strictEqual(app.signingPin, null);
+  assert.deepStrictEqual(pin, Buffer.alloc(6));
+  assert.strictEqual(card.device.listenerCount('card-removed'), 0);
+  await assert.rejects(app.sign([Buffer.alloc(32)]), /no PIN is cached/);
+});
+
+test('a refused PIN is not kept', async () => {
+  const card = fakeCard();
+  const app = new OpenPgpApplication(card, { cachePin: true });
+  const response = await app.verify('000000');
+  assert.strictEqual(response.getStatusCode(), '63c2');
+  assert.strictEqual(app.signingPin, null);
+  assert.strictEqual(app.isVerified(0x81), false);
+});
+
+test('long digest infos are sent extended or chained', () => {
+  const digestInfo = Buffer.alloc(300, 0x11);
+  const app = new OpenPgpApplication(fakeCard());
+  app.capabilities = {
+    extendedLength: true,
+    maxCommandLength: 0x400,
+    maxResponseLength: 0x200,
+  };
+  const [extended] = app.buildSignCommands(digestInfo);
+  const bytes = extended.toString();
+  assert.strictEqual(bytes.substring(0, 14), '002a9e9a00012c');
+  assert.strictEqual(bytes.substring(14 + 600), '0200');
+  assert.strictEqual(extended.getResponseLength(), 0x202);
+
+  app.capabilities = { extendedLength: false, commandChaining: true };
+  const chained = app.buildSignCommands(digestInfo);
+  assert.deepStrictEqual(
+    chained.map((command) => command.toString().substring(0, 10)),
+    ['102a9e9aff', '002a9e9a2d']
+  );
+  assert.strictEqual(chained[1].toString().length, (5 + 45 + 1) * 2);
+
+  app.capabilities = { extendedLength: false, commandChaining: false };
+  assert.throws(() => app.buildSignCommands(digestInfo), /exceeds card limit/);
+});
@@ -0,0 +1,109 @@
+'use strict';
+
+// known answers of SecureMessaging: the ICAO 9303-11 worked example (BAC,
+// 3DES) and, for AES, the NIST SP 800-38B CMAC vectors under the ISO
+// 9797-1 method 2 padding that ICAO 9303-11 requires
+
+const test = require('node:test');
+const assert = require('assert');
+const { SecureMessaging } = require('../lib/index');
+const CardCrypto = require('../lib/CardCrypto');
+
+const hex = (text) => Buffer.from(text.replace(/ /g, ''), 'hex');
+
+const wrap = (sm, command) =>
+  sm.wrap(SecureMessaging.parseCommand(hex(command))).bytes;
+
+test('ICAO 9303-11 worked example after BAC', () => {
+  const bac = new SecureMessaging({
+    cipher: '3des',
+    encKey: hex('979EC13B1CBFE9DCD01AB0FED307EAE5'),
+    macKey: hex('F1CB1F1FB5ADF208806B89DC579DC1F8'),
+    ssc: hex('887022120C06C226'),
+  });
+  assert.deepStrictEqual(
+    wrap(bac, '00A4020C02011E'),
+    hex('0CA4020C158709016375432908C044F68E08BF8B92D635FF24F800')
+  );
+  assert.deepStrictEqual(
+    bac.unwrap(hex('990290008E08FA855A5D4C50A8ED9000')),
+    hex('9000')
+  );
+  assert.deepStrictEqual(
+    wrap(bac, '00B0000004'),
+    hex('0CB000000D9701048E08ED6705417E96BA5500')
+  );
+  assert.deepStrictEqual(
+    bac.unwrap(hex('8709019FF0EC34F9922651990290008E08AD55CC17140B2DED9000')),
+    hex('60145F019000')
+  );
+  assert.deepStrictEqual(
+    wrap(bac, '00B0000412'),
+    hex('0CB000040D9701128E082EA28A70F3C7B53500')
+  );
+  assert.deepStrictEqual(
+    bac.unwrap(
+      hex(
+        '871901FB9235F4E4037F2327DCC8964F1F9B8C30F42C8E2FFF224A99029000' +
+          '8E08C8B2787EAEA07D749000'
+      )
+    ),
+    hex('04303130365F36063034303030305C0261759000')
+  );
+});
+
+test('a response with a wrong MAC is refused', () => {
+  const bac = new SecureMessaging({
+    cipher: '3des',
+    encKey: hex('979EC13B1CBFE9DCD01AB0FED307EAE5'),
+    macKey: hex('F1CB1F1FB5ADF208806B89DC579DC1F8'),
+    ssc: hex('887022120C06C226'),
+  });
+  wrap(bac, '00A4020C02011E');
+  assert.throws(() => bac.unwrap(hex('990290008E08FA855A5D4C50A8EE9000')));
+});
+
+// NIST SP 800-38B, AES-128 examples 1 and 2
+const nist = hex('2B7E151628AED2A6ABF7158809CF4F3C');
+
+test('AES-CMAC, NIST SP 800-38B', () => {
+  assert.deepStrictEqual(
+    CardCrypto.aesCmac(nist, Buffer.alloc(0)),
+    hex('BB1D6929E95937287FA37D129B756746')
+  );
+  assert.deepStrictEqual(
+    CardCrypto.aesCmac(nist, hex('6BC1BEE22E409F96E93D7E117393172A')),
+    hex('070A16B46B4D4144F79BDD9DD04A287C')
+  );
+});
+
+// AES: the MAC is the CMAC of the padded SSC, header and data objects
+test('AES secure messaging MACs the padded input', () => {
+  const aes = new SecureMessaging({
+    cipher: 'aes',
+    encKey: nist,
+    macKey: nist,
+    ssc: Buffer.alloc(16),
+  });
+  const wrapped = wrap(aes, '00B0000004');
+  const ssc = Buffer.alloc(16);
+  ssc[15] = 1;
+  const covered = Buffer.concat([
+    ssc,
+    CardCrypto.pad(hex('0CB00000'), 16),
+    hex('970104'),
+  ]);
+  const mac = CardCrypto.aesCmac(nist, CardCrypto.pad(covered, 16));
+  assert.deepStrictEqual(wrapped.subarray(-9, -1), mac.subarray(0, 8));
+
+  ssc[15] = 2;
+  const response = Buffer.concat([hex('99029000'), hex('8E08')]);
+  const responseMac = CardCrypto.aesCmac(
+    nist,
+    CardCrypto.pad(Buffer.concat([ssc, hex('99029000')]), 16)
+  ).subarray(0, 8);
+  assert.deepStrictEqual(
+    aes.unwrap(Buffer.concat([response, responseMac, hex('9000')])),
+    hex('9000')
+  );
+});
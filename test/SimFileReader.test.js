@@ -0,0 +1,127 @@
+'use strict';
+
+const test = require('node:test');
+const assert = require('assert');
+const { Card, SimFileReader, Tlv } = require('../lib/index');
+
+const sw = (value) => Buffer.from([value >> 8, value & 0xff]);
+const ok = (data) => Buffer.concat([data, sw(0x9000)]);
+
+const RECORD_LENGTH = 30;
+const EMPTY = Buffer.alloc(RECORD_LENGTH, 0xff);
+
+// EF_ADN record: 16 bytes of name, then length, TON and BCD digits
+const adn = (name, bcd) => {
+  const record = Buffer.from(EMPTY);
+  record.write(name, 0, 'ascii');
+  Buffer.from([1 + bcd.length / 2, 0x91]).copy(record, 16);
+  Buffer.from(bcd, 'hex').copy(record, 18);
+  return record;
+};
+
+const RECORDS = [adn('Alice', '51552143'), EMPTY, adn('Bob', '214365'), EMPTY];
+
+const fcp = Tlv.encode(
+  0x62,
+  Buffer.concat([
+    Tlv.encode(0x82, [0x42, 0x21, 0x00, RECORD_LENGTH, RECORDS.length]),
+    Tlv.encode(0x80, [0x00, RECORD_LENGTH * RECORDS.length]),
+  ])
+);
+
+// GSM 11.11 SELECT response of a linear fixed EF
+const gsmResponse = Buffer.from(
+  '00000078' + // 120 bytes
+    '6f3a04' + // EF_ADN, an EF
+    '001111000002' +
+    '011e', // linear fixed, records of 30 bytes
+  'hex'
+);
+
+const fakeDevice = (options) => {
+  const opts = options || {};
+  return {
+    name: 'Fake Reader',
+    sent: [],
+    respond(command) {
+      switch (command[1]) {
+        case 0xa4:
+          if (command[0] === 0xa0) return ok(gsmResponse);
+          return command[3] === 0x04 ? ok(fcp) : sw(0x9000);
+        case 0xa2: {
+          if (!opts.search) return sw(0x6d00);
+          const pattern = command.subarray(5, 5 + command[4]);
+          const found = RECORDS.map((r, i) => (r.equals(pattern) ? i + 1 : 0));
+          return ok(Buffer.from(found.filter((r) => r)));
+        }
+        case 0xb2:
+          return ok(RECORDS[command[2] - 1]);
+      }
+      return sw(0x6d00);
+    },
+    transmit(data, resLen, protocol, cb) {
+      this.sent.push(data.toString('hex'));
+      const response = this.respond(data);
+      setImmediate(() => cb(null, response));
+    },
+  };
+};
+
+const PATH = [0x3f00, 0x7f10, 0x6f3a];
+
+const readerFor = (device, options) =>
+  new SimFileReader(new Card(device, Buffer.from('3b00', 'hex'), 2), options);
+
+test('records are read in absolute mode with exact Le', async () => {
+  const device = fakeDevice();
+  const reader = readerFor(device);
+  const entries = await reader.readAllRecords(PATH, { decoder: 'adn' });
+  assert.deepStrictEqual(
+    entries.map((e) => [e.record, e.entry.name, e.entry.number]),
+    [
+      [1, 'Alice', '+15551234'],
+      [3, 'Bob', '+123456'],
+    ]
+  );
+  assert.deepStrictEqual(device.sent, [
+    '00a40804047f106f3a00',
+    `00a20104${RECORD_LENGTH.toString(16)}${EMPTY.toString('hex')}00`,
+    '00b201041e',
+    '00b202041e',
+    '00b203041e',
+    '00b204041e',
+  ]);
+  assert.strictEqual(reader.fileInfo['3f00/7f10/6f3a'].recordCount, 4);
+
+  // the file information is kept, and SEARCH RECORD is not tried again
+  device.sent = [];
+  await reader.readAllRecords(PATH);
+  assert.deepStrictEqual(device.sent.slice(0, 2), [
+    '00a4080c047f106f3a',
+    '00b201041e',
+  ]);
+});
+
+test('SEARCH RECORD leaves out the records of the fill pattern', async () => {
+  const device = fakeDevice({ search: true });
+  const reader = readerFor(device);
+  const entries = await reader.readAllRecords(PATH);
+  assert.deepStrictEqual(entries.map((e) => e.record), [1, 3]);
+  assert.deepStrictEqual(device.sent.slice(2), ['00b201041e', '00b203041e']);
+});
+
+test('GSM SIMs are selected level by level', async () => {
+  const device = fakeDevice({ search: true });
+  const reader = readerFor(device, { cla: 0xa0 });
+  const entries = await reader.readAllRecords(PATH, { decoder: 'adn' });
+  assert.deepStrictEqual(entries.map((e) => e.entry.name), ['Alice', 'Bob']);
+  assert.deepStrictEqual(device.sent, [
+    'a0a40000023f00',
+    'a0a40000027f10',
+    'a0a40000026f3a',
+    'a0b201041e',
+    'a0b202041e',
+    'a0b203041e',
+    'a0b204041e',
+  ]);
+});
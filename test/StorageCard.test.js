@@ -0,0 +1,110 @@
+'use strict';
+
+const test = require('node:test');
+const assert = require('assert');
+const { Card, StorageCard, StorageCardSimulator } = require('../lib/index');
+
+// the learned read limit is kept per reader name, so each test has its own
+const setUp = (name, options) => {
+  const memory = Buffer.alloc(64 * 16);
+  for (let i = 0; i < memory.length; i++) memory[i] = i & 0xff;
+  const simulator = new StorageCardSimulator(
+    Object.assign({ name, memory }, options)
+  );
+  const card = new Card(simulator, simulator.atr, 2);
+  return { simulator, card, memory, storageCard: new StorageCard(card) };
+};
+
+const spy = (simulator) => {
+  const sent = [];
+  const handle = simulator.handle.bind(simulator);
+  simulator.handle = (command) => {
+    sent.push(command.subarray(0, 4).toString('hex'));
+    return handle(command);
+  };
+  return sent;
+};
+
+test('multi-block reads halve the limit after a refused read', async () => {
+  const { simulator, memory, storageCard, card } = setUp('halving', {
+    maxBlocksPerRead: 2,
+  });
+  const sent = spy(simulator);
+  const data = await storageCard.readBlocks(4, 8);
+  assert.deepStrictEqual(data, memory.subarray(64, 192));
+  assert.deepStrictEqual(sent, [
+    'ff820000', // LOAD KEYS
+    'ff860000', // authenticate sector 1
+    'ffb00004', // 4 blocks, refused
+    'ff860000', // the failure ended the authentication
+    'ffb00004',
+    'ffb00006',
+    'ff860000', // sector 2
+    'ffb00008',
+    'ffb0000a',
+  ]);
+  const stats = storageCard.getStats();
+  assert.strictEqual(stats.maxBlocksPerRead, 2);
+  assert.strictEqual(stats.blocksRead, 8);
+  assert.strictEqual(stats.keyLoads, 1);
+  // the limit learned is kept for the reader
+  assert.strictEqual(new StorageCard(card).maxBlocksPerRead, 2);
+});
+
+test('a loaded key and an authenticated sector are skipped', async () => {
+  const { simulator, memory, storageCard } = setUp('skipping', {
+    maxBlocksPerRead: 4,
+  });
+  const sent = spy(simulator);
+  await storageCard.readBlocks(4, 4);
+  const data = await storageCard.readBlocks(4, 4);
+  assert.deepStrictEqual(data, memory.subarray(64, 128));
+  assert.deepStrictEqual(sent, [
+    'ff820000',
+    'ff860000',
+    'ffb00004',
+    'ffb00004',
+  ]);
+  const stats = storageCard.getStats();
+  assert.strictEqual(stats.keyLoads, 1);
+  assert.strictEqual(stats.keyLoadsSkipped, 1);
+  assert.strictEqual(stats.authentications, 1);
+  assert.strictEqual(stats.authenticationsSkipped, 1);
+});
+
+test('a new sector is authenticated again', async () => {
+  const { simulator, storageCard } = setUp('sectors', {
+    maxBlocksPerRead: 4,
+  });
+  const sent = spy(simulator);
+  await storageCard.writeBlocks(6, Buffer.alloc(48, 0x42));
+  const data = await storageCard.readBlocks(6, 2);
+  assert.deepStrictEqual(data, Buffer.alloc(32, 0x42));
+  assert.deepStrictEqual(sent, [
+    'ff820000',
+    'ff860000', // sector 1
+    'ffd60006',
+    'ffd60007',
+    'ff860000', // sector 2
+    'ffd60008',
+    'ff860000', // back to sector 1
+    'ffb00006',
+  ]);
+  const stats = storageCard.getStats();
+  assert.strictEqual(stats.authentications, 3);
+  assert.strictEqual(stats.keyLoadsSkipped, 3);
+  assert.strictEqual(stats.blocksWritten, 3);
+});
+
+test('stats give the blocks per second of busy time', async () => {
+  const { storageCard } = setUp('stats', {
+    maxBlocksPerRead: 4,
+    latencyMs: 5,
+  });
+  await storageCard.readBlocks(0, 16);
+  const stats = storageCard.getStats();
+  assert.strictEqual(stats.blocksRead, 16);
+  // LOAD KEYS, then an authentication and a read per sector, 5 ms each
+  assert.ok(stats.busyMs >= 40);
+  assert.strictEqual(stats.blocksPerSecond, 16 / (stats.busyMs / 1000));
+});
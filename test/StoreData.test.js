@@ -0,0 +1,102 @@
+'use strict';
+
+const test = require('node:test');
+const assert = require('assert');
+const StoreData = require('../lib/StoreData');
+
+const hex = (commands) => commands.map((command) => command.toString('hex'));
+
+test('DGIs take a one or three byte length', () => {
+  assert.strictEqual(
+    StoreData.encodeDgi(0x0101, [1, 2, 3]).toString('hex'),
+    '010103010203'
+  );
+  const long = StoreData.encodeDgi(0x0202, Buffer.alloc(255));
+  assert.strictEqual(long.length, 260);
+  assert.strictEqual(long.subarray(0, 5).toString('hex'), '0202ff00ff');
+});
+
+test('DGIs are chained over numbered blocks, the last one flagged', () => {
+  const storeData = new StoreData({ maxBlock: 8 });
+  const commands = storeData.prepare([
+    { dgi: 0x0101, data: Buffer.alloc(6, 0xaa) },
+    { dgi: 0x0102, data: [0x01] },
+  ]);
+  assert.deepStrictEqual(hex(commands), [
+    '80e2080008010106aaaaaaaaaa',
+    '80e2880105aa01020101',
+  ]);
+});
+
+test('a DGI that fits in a block starts a new one rather than split', () => {
+  const storeData = new StoreData({ maxBlock: 8 });
+  const commands = storeData.prepare([
+    { dgi: 0x0101, data: [0xaa] },
+    { dgi: 0x0102, data: [0xbb, 0xbb] },
+    { dgi: 0x0103, data: Buffer.alloc(5, 0xcc) },
+  ]);
+  assert.deepStrictEqual(hex(commands), [
+    '80e2080004010101aa',
+    '80e2080105010202bbbb',
+    '80e2880208010305cccccccccc',
+  ]);
+});
+
+const dek = Buffer.from('404142434445464748494a4b4c4d4e4f', 'hex');
+const key = Buffer.from('00112233445566778899aabbccddeeff', 'hex');
+
+// expected cryptograms computed with openssl enc -des-ede-ecb / -aes-128-ecb
+test('sensitive DGIs are encrypted in ECB, padded only when unaligned', () => {
+  const storeData = new StoreData({
+    cla: 0x84,
+    sensitive: [0x8000, 0x8001],
+    dek,
+  });
+  const commands = storeData.prepare([
+    { dgi: 0x0101, data: [0x01] },
+    { dgi: 0x8000, data: key },
+    { dgi: 0x8001, data: Buffer.from('1122334455', 'hex') },
+  ]);
+  assert.deepStrictEqual(hex(commands), [
+    '84e208000401010101',
+    '84e2e8011e' +
+      '800010' +
+      '6260e7c6a3e3376e21b427ef79471763' +
+      '800108' +
+      'b96bcb413740207c',
+  ]);
+});
+
+test('AES DEKs encrypt in ECB too', () => {
+  const storeData = new StoreData({ sensitive: [0x8000], dek, cipher: 'aes' });
+  const [command] = storeData.prepare([{ dgi: 0x8000, data: key }]);
+  assert.strictEqual(
+    command.toString('hex'),
+    '80e2e80013800010' + '4533bfd23699fc7c142d20bb1a4a191f'
+  );
+});
+
+test('prepare refuses what it cannot encode', () => {
+  const sensitive = new StoreData({ sensitive: [0x8000] });
+  assert.throws(
+    () => sensitive.prepare([{ dgi: 0x8000, data: [1] }]),
+    /without a DEK/
+  );
+  const dgis = [{ dgi: 0x0101, data: Buffer.alloc(257 * 4) }];
+  assert.throws(
+    () => new StoreData({ maxBlock: 4 }).prepare(dgis),
+    /at most 256/
+  );
+});
+
+test('precompute on a worker matches prepare', async () => {
+  const dgis = [{ dgi: 0x0101, data: Buffer.alloc(300, 0x55) }];
+  const storeData = new StoreData({ worker: true });
+  try {
+    const commands = await storeData.precompute(dgis);
+    assert.deepStrictEqual(hex(commands), hex(storeData.prepare(dgis)));
+    assert.strictEqual(typeof commands.precomputeMs, 'number');
+  } finally {
+    storeData.close();
+  }
+});
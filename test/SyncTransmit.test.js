@@ -0,0 +1,102 @@
+'use strict';
+
+const test = require('node:test');
+const assert = require('assert');
+const path = require('path');
+const { Worker } = require('worker_threads');
+const SyncTransmit = require('../lib/SyncTransmit');
+const SyncCard = require('../lib/SyncCard');
+
+// READ BINARY is answered, a command with CLA ff fails, INS ee never returns
+const fakeCard = () => ({
+  sent: [],
+  transmit(command, cb) {
+    this.sent.push(command.toString('hex'));
+    if (command[0] === 0xff) {
+      setImmediate(() => cb(new Error('reader gone')));
+    } else if (command[1] !== 0xee) {
+      setImmediate(() => cb(null, Buffer.from('0102039000', 'hex')));
+    }
+  },
+});
+
+const WORKER = `
+const { parentPort, workerData } = require('worker_threads');
+const SyncCard = require(workerData.module);
+const card = new SyncCard(workerData.channel, { timeoutMs: 100 });
+const results = workerData.commands.map((command) => {
+  try {
+    const response = card.transmitSync(command);
+    return { data: response.getDataOnly(), sw: response.getStatusCode() };
+  } catch (err) {
+    return { error: err.message };
+  }
+});
+parentPort.postMessage(results);
+`;
+
+const runWorker = (transmit, commands) =>
+  new Promise((resolve, reject) => {
+    const channel = transmit.channel();
+    const worker = new Worker(WORKER, {
+      eval: true,
+      workerData: {
+        module: path.join(__dirname, '../lib/SyncCard'),
+        channel,
+        commands,
+      },
+      transferList: [channel.port],
+    });
+    worker.once('message', resolve);
+    worker.once('error', reject);
+  });
+
+test('a worker gets responses and errors synchronously', async () => {
+  const card = fakeCard();
+  const transmit = new SyncTransmit(card);
+  try {
+    const results = await runWorker(transmit, [
+      '00b0000003',
+      [0xff, 0xca, 0x00, 0x00, 0x00],
+      '00b0000103',
+    ]);
+    assert.deepStrictEqual(results, [
+      { data: '010203', sw: '9000' },
+      { error: 'reader gone' },
+      { data: '010203', sw: '9000' },
+    ]);
+    assert.deepStrictEqual(card.sent, [
+      '00b0000003',
+      'ffca000000',
+      '00b0000103',
+    ]);
+  } finally {
+    transmit.close();
+  }
+});
+
+test('a timed out command leaves the card unusable', async () => {
+  const transmit = new SyncTransmit(fakeCard());
+  try {
+    const results = await runWorker(transmit, ['00ee0000', '00b0000003']);
+    assert.deepStrictEqual(results, [
+      { error: 'no response within 100ms' },
+      { error: 'card unusable, no response within 100ms' },
+    ]);
+  } finally {
+    transmit.close();
+  }
+});
+
+test('a closed channel refuses commands', async () => {
+  const transmit = new SyncTransmit(fakeCard());
+  transmit.close();
+  const results = await runWorker(transmit, ['00b0000003']);
+  assert.deepStrictEqual(results, [{ error: 'card closed' }]);
+});
+
+test('transmitSync cannot block the main thread', () => {
+  const transmit = new SyncTransmit(fakeCard());
+  assert.throws(() => new SyncCard(transmit.channel()), /worker thread/);
+  transmit.close();
+});
@@ -0,0 +1,77 @@
+'use strict';
+
+const test = require('node:test');
+const assert = require('assert');
+const {
+  Card,
+  Ndef,
+  StorageCardSimulator,
+  Type2Tag,
+} = require('../lib/index');
+
+const hex = (text) => Buffer.from(text.replace(/ /g, ''), 'hex');
+
+// 144 bytes of data area, a Lock Control and a Memory Control TLV ahead
+// of the terminator
+const ntag = (data) => {
+  const memory = Buffer.alloc(160);
+  hex('E1101200').copy(memory, 12);
+  data.copy(memory, 16);
+  const simulator = new StorageCardSimulator({
+    blockSize: 4,
+    blockCount: 40,
+    maxBlocksPerRead: 4,
+    memory,
+  });
+  const writes = [];
+  const handle = simulator.handle.bind(simulator);
+  simulator.handle = (command) => {
+    if (command[1] === 0xd6) {
+      writes.push({ page: command[3], data: command.toString('hex', 5) });
+    }
+    return handle(command);
+  };
+  return { simulator, writes, card: new Card(simulator, simulator.atr, 2) };
+};
+
+const controls = hex('0103A00C34 0203001000 FE');
+
+test('a new message goes after the control TLVs', () => {
+  const { simulator, card } = ntag(controls);
+  const record = Ndef.uriRecord('https://example.com');
+  return new Type2Tag(card)
+    .writeNdef([record])
+    .then(() => {
+      assert.deepStrictEqual(
+        simulator.memory.subarray(16, 26),
+        controls.subarray(0, 10)
+      );
+      assert.strictEqual(simulator.memory[26], 0x03);
+      return new Type2Tag(card).readNdef();
+    })
+    .then((records) => {
+      assert.strictEqual(Ndef.decodeUri(records[0]), 'https://example.com');
+    });
+});
+
+test('the length is zeroed first and written last', () => {
+  const old = Ndef.encode([Ndef.textRecord('old', 'en')]);
+  const existing = Buffer.concat([
+    Buffer.from([0x03, old.length]),
+    old,
+    Buffer.from([0xfe]),
+  ]);
+  const { writes, card } = ntag(existing);
+  const message = Ndef.encode([Ndef.textRecord('a longer new text', 'en')]);
+  return new Type2Tag(card).writeNdef(message).then(() => {
+    assert.ok(writes.length > 2);
+    assert.strictEqual(writes[0].page, 4);
+    assert.strictEqual(writes[0].data.slice(0, 4), '0300');
+    const last = writes[writes.length - 1];
+    assert.strictEqual(last.page, 4);
+    assert.strictEqual(
+      last.data.slice(0, 4),
+      `03${message.length.toString(16)}`
+    );
+  });
+});
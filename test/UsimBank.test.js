@@ -0,0 +1,31 @@
+'use strict';
+
+const test = require('node:test');
+const assert = require('assert');
+const { UsimBank } = require('../lib/index');
+
+const usim = () => ({
+  authenticate: () =>
+    new Promise((resolve) =>
+      setImmediate(() => resolve({ status: 'success', durationMs: 1 }))
+    ),
+});
+
+test('an id already in the bank is refused', () => {
+  const bank = new UsimBank({ batchSize: 1 });
+  bank.add('slot1', usim());
+  assert.throws(() => bank.add('slot1', usim()), /already added/);
+});
+
+test('requests queued for a removed SIM are rejected', () => {
+  const bank = new UsimBank({ batchSize: 1 });
+  bank.add('slot1', usim());
+  const first = bank.authenticate('slot1', Buffer.alloc(16), Buffer.alloc(16));
+  const queued = bank.authenticate('slot1', Buffer.alloc(16), Buffer.alloc(16));
+  bank.remove('slot1');
+  bank.add('slot1', usim());
+  return Promise.all([
+    first.then((result) => assert.strictEqual(result.status, 'success')),
+    assert.rejects(queued, /SIM 'slot1' removed/),
+  ]);
+});